@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2018, Jaguar Land Rover
+# This program is licensed under the terms and conditions of the
+# Mozilla Public License, version 2.0.  The full text of the
+# Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+#
+# Generate the codec for the synthetic Vehicle.Chassis branch built by
+# vsd_bench.c, using tools/vspec2codec.py.
+#
+#   gen_chassis_codec.py chassis_codec.c
+#
+# The branch built here must match the one in vsd_bench.c. If it does
+# not, registering the codec fails with EPROTO.
+#
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+
+import vspec2codec
+
+# Same as BENCH_CHASSIS_LEAVES and BENCH_CHASSIS_GROUP in vsd_bench.c.
+CHASSIS_LEAVES = 200
+CHASSIS_GROUP = 10
+
+# Same order as _chassis_types in vsd_bench.c.
+CHASSIS_TYPES = [
+    "uint8", "float", "uint16", "boolean", "int32",
+    "double", "int16", "uint32", "int8",
+]
+
+
+def chassis():
+    groups = {}
+
+    for ind in range(CHASSIS_LEAVES):
+        group = groups.setdefault("Group{}".format(ind // CHASSIS_GROUP), {"children": {}})
+        group["children"]["Signal{}".format(ind % CHASSIS_GROUP)] = {
+            "datatype": CHASSIS_TYPES[ind % len(CHASSIS_TYPES)]
+        }
+
+    return {"Vehicle": {"children": {"Chassis": {"children": groups}}}}
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: {} output_file".format(sys.argv[0]))
+        sys.exit(255)
+
+    with open(sys.argv[1], "w") as out:
+        out.write(vspec2codec.generate(chassis(), ["Vehicle.Chassis"],
+                                       "gen_chassis_codec.py",
+                                       "bench_register_chassis_codec"))
@@ -0,0 +1,279 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Synthetic signal specification for benchmarking.
+//
+// Implements the vss_*() calls otherwise provided by the code
+// generated by vspec2c, but builds the signal tree at runtime so
+// that benchmarks can be run against trees of any size.
+//
+#include "synthetic_vss.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+static vss_signal_t** _signals = 0;
+static int _signal_count = 0;
+static int _signal_allocated = 0;
+
+// Data types cycled through by leaf signals. Strings are less common
+// than scalars in real specifications.
+static const vss_data_type_e _leaf_types[] = {
+    VSS_UINT8, VSS_FLOAT, VSS_UINT16, VSS_BOOLEAN, VSS_INT32,
+    VSS_DOUBLE, VSS_INT16, VSS_UINT32, VSS_INT8, VSS_STRING
+};
+
+static uint32_t _path_signature(const char* path)
+{
+    uint32_t hash = 2166136261U;
+
+    while(*path)
+        hash = (hash ^ (uint8_t) *path++) * 16777619U;
+
+    return hash;
+}
+
+static vss_signal_t* _add_signal(vss_signal_t* parent,
+                                 const char* name,
+                                 vss_element_type_e element_type,
+                                 vss_data_type_e data_type)
+{
+    vss_signal_t* sig = (vss_signal_t*) malloc(sizeof(vss_signal_t));
+    vss_signal_t** children = (vss_signal_t**) calloc(1, sizeof(vss_signal_t*));
+    char path[1024];
+    char* name_copy = strdup(name);
+
+    if (!sig || !children || !name_copy) {
+        fprintf(stderr, "Out of memory\n");
+        exit(255);
+    }
+
+    if (_signal_count == _signal_allocated) {
+        _signal_allocated = _signal_allocated?(_signal_allocated * 2):1024;
+        _signals = (vss_signal_t**) realloc(_signals, _signal_allocated * sizeof(vss_signal_t*));
+        if (!_signals) {
+            fprintf(stderr, "Out of memory\n");
+            exit(255);
+        }
+    }
+
+    // Fields are const in the generated headers. Build the signal on
+    // the stack and copy it in place.
+    {
+        vss_signal_t tmp = {
+            .index = _signal_count,
+            .parent = parent,
+            .children = children,
+            .name = name_copy,
+            .uuid = name_copy,
+            .element_type = element_type,
+            .data_type = data_type,
+            .user_data = 0
+        };
+        memcpy(sig, &tmp, sizeof(tmp));
+    }
+
+    _signals[_signal_count++] = sig;
+
+    if (parent) {
+        int count = 0;
+
+        while(parent->children[count])
+            ++count;
+
+        children = (vss_signal_t**) realloc(parent->children, (count + 2) * sizeof(vss_signal_t*));
+        if (!children) {
+            fprintf(stderr, "Out of memory\n");
+            exit(255);
+        }
+        children[count] = sig;
+        children[count + 1] = 0;
+        memcpy((void*) &parent->children, &children, sizeof(children));
+    }
+
+    sig->signature = _path_signature(vss_get_signal_path(sig, path, sizeof(path)));
+    return sig;
+}
+
+
+// Create branches with up to fanout children each until
+// signal_count leaves have been created.
+static void _build_branch(vss_signal_t* branch, int depth, int fanout, int* remaining)
+{
+    char name[32];
+    int ind = 0;
+
+    // Lowest level branches host the leaves.
+    if (depth == 0) {
+        for(ind = 0; ind < fanout && *remaining; ++ind) {
+            vss_data_type_e type = _leaf_types[_signal_count % (sizeof(_leaf_types) / sizeof(_leaf_types[0]))];
+
+            snprintf(name, sizeof(name), "Signal%d", ind);
+            _add_signal(branch, name, VSS_SENSOR, type);
+            --*remaining;
+        }
+        return;
+    }
+
+    for(ind = 0; ind < fanout && *remaining; ++ind) {
+        snprintf(name, sizeof(name), "Branch%d", ind);
+        _build_branch(_add_signal(branch, name, VSS_BRANCH, VSS_NA), depth - 1, fanout, remaining);
+    }
+}
+
+
+vss_signal_t* synthetic_vss_build(int leaf_count, int fanout)
+{
+    vss_signal_t* root = _add_signal(0, "Vehicle", VSS_BRANCH, VSS_NA);
+    int remaining = leaf_count;
+    int depth = 0;
+    long capacity = fanout;
+
+    // Pick the smallest depth that holds all leaves.
+    while(capacity < leaf_count) {
+        capacity *= fanout;
+        ++depth;
+    }
+
+    _build_branch(root, depth, fanout, &remaining);
+    return root;
+}
+
+
+vss_signal_t* synthetic_vss_add_branch(vss_signal_t* parent, const char* name)
+{
+    return _add_signal(parent, name, VSS_BRANCH, VSS_NA);
+}
+
+
+vss_signal_t* synthetic_vss_add_leaf(vss_signal_t* parent, const char* name, vss_data_type_e type)
+{
+    return _add_signal(parent, name, VSS_SENSOR, type);
+}
+
+
+void synthetic_vss_set_range(vss_signal_t* sig, vss_value_u min, vss_value_u max)
+{
+    // Const fields. See _add_signal().
+    memcpy((void*) &sig->min_val, &min, sizeof(min));
+    memcpy((void*) &sig->max_val, &max, sizeof(max));
+}
+
+
+int vss_get_signal_count(void)
+{
+    return _signal_count;
+}
+
+
+vss_signal_t* vss_get_signal_by_index(int index)
+{
+    if (index < 0 || index >= _signal_count)
+        return 0;
+
+    return _signals[index];
+}
+
+
+uint32_t vss_get_subtree_signature(vss_signal_t* sig)
+{
+    return sig->signature;
+}
+
+
+char* vss_get_signal_path(vss_signal_t* sig, char* buf, int buf_len)
+{
+    int len = 0;
+
+    if (!sig->parent) {
+        snprintf(buf, buf_len, "%s", sig->name);
+        return buf;
+    }
+
+    vss_get_signal_path(sig->parent, buf, buf_len);
+    len = strlen(buf);
+    snprintf(buf + len, buf_len - len, ".%s", sig->name);
+    return buf;
+}
+
+
+// Walk the tree one path component at a time, the same way
+// the generated code does.
+int vss_get_signal_by_path(char* path, vss_signal_t** result)
+{
+    vss_signal_t* cur = 0;
+    const char* comp = path;
+    const char* end = 0;
+    int len = 0;
+
+    if (!path || !result || !_signal_count)
+        return EINVAL;
+
+    // First component must name the root.
+    cur = _signals[0];
+    end = strchr(comp, '.');
+    len = end?(end - comp):strlen(comp);
+
+    if (strncmp(cur->name, comp, len) || cur->name[len])
+        return ENOENT;
+
+    while(end) {
+        int ind = 0;
+
+        if (cur->element_type != VSS_BRANCH)
+            return ENOENT;
+
+        comp = end + 1;
+        end = strchr(comp, '.');
+        len = end?(end - comp):strlen(comp);
+
+        while(cur->children[ind] &&
+              (strncmp(cur->children[ind]->name, comp, len) ||
+               cur->children[ind]->name[len]))
+            ++ind;
+
+        if (!cur->children[ind])
+            return ENOENT;
+
+        cur = cur->children[ind];
+    }
+
+    *result = cur;
+    return 0;
+}
+
+
+const char* vss_data_type_string(vss_data_type_e type)
+{
+    switch(type) {
+    case VSS_INT8: return "int8";
+    case VSS_UINT8: return "uint8";
+    case VSS_INT16: return "int16";
+    case VSS_UINT16: return "uint16";
+    case VSS_INT32: return "int32";
+    case VSS_UINT32: return "uint32";
+    case VSS_DOUBLE: return "double";
+    case VSS_FLOAT: return "float";
+    case VSS_BOOLEAN: return "boolean";
+    case VSS_STRING: return "string";
+    case VSS_STREAM: return "stream";
+    default: return "na";
+    }
+}
+
+
+const char* vss_element_type_string(vss_element_type_e type)
+{
+    switch(type) {
+    case VSS_BRANCH: return "branch";
+    case VSS_SENSOR: return "sensor";
+    case VSS_ACTUATOR: return "actuator";
+    case VSS_ATTRIBUTE: return "attribute";
+    default: return "element";
+    }
+}
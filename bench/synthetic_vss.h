@@ -0,0 +1,30 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Synthetic signal specification for benchmarking.
+//
+#ifndef __SYNTHETIC_VSS_H__
+#define __SYNTHETIC_VSS_H__
+
+#include <vehicle_signal_specification.h>
+
+// Build a tree of leaf_count leaf signals under a "Vehicle" root.
+// Each branch has at most fanout children, and leaves are only found
+// in the lowest level branches. Leaf data types are mixed.
+// Returns the root signal.
+extern vss_signal_t* synthetic_vss_build(int leaf_count, int fanout);
+
+// Add a single branch or leaf to an existing tree.
+extern vss_signal_t* synthetic_vss_add_branch(vss_signal_t* parent, const char* name);
+extern vss_signal_t* synthetic_vss_add_leaf(vss_signal_t* parent,
+                                            const char* name,
+                                            vss_data_type_e type);
+
+// Set the min and max of a leaf, as a specification would.
+extern void synthetic_vss_set_range(vss_signal_t* sig, vss_value_u min, vss_value_u max);
+
+#endif // __SYNTHETIC_VSS_H__
@@ -0,0 +1,1224 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Microbenchmarks for encode, decode, lookup, setters and dispatch,
+// and for the full publish to callback path over the loopback transport.
+//
+// The library internals exercised are declared in vsd_internal.h.
+// The benchmarks run against a synthetic signal tree, see
+// synthetic_vss.c.
+//
+// Each benchmark prints one JSON object per line:
+//
+//   {"benchmark":"encode_branch","signals":1000,"iterations":2097152,
+//    "ns_per_op":123.4,"allocs_per_op":0.00,"bytes_per_op":0.0}
+//
+// Allocations are counted by wrapping malloc(3) and friends at link
+// time. See Makefile.
+//
+#include "vsd_internal.h"
+#include "synthetic_vss.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// Maximum frame size accepted by DSTC.
+#define BENCH_FRAME_SIZE 0xFF00
+
+// Number of children of each branch in the synthetic tree.
+#define BENCH_FANOUT 10
+
+// Number of pattern subscriptions made by pattern_dispatch.
+#define BENCH_PATTERN_COUNT 100
+
+// Frames received between deliveries to the conflating subscriber.
+#define BENCH_CONFLATE_FRAMES 100
+#define BENCH_CONFLATE_BRANCHES 10
+
+// Subscriptions held on the root while subscribe_churn runs.
+#define BENCH_CHURN_SUBSCRIPTIONS 1000
+
+// Leaf signals under the synthetic Vehicle.Chassis branch, in groups
+// of BENCH_CHASSIS_GROUP. Must match gen_chassis_codec.py.
+#define BENCH_CHASSIS_LEAVES 200
+#define BENCH_CHASSIS_GROUP 10
+
+// Generated by gen_chassis_codec.py into chassis_codec.c.
+extern int bench_register_chassis_codec(vsd_context_t* ctx);
+
+// Maintained by the __wrap_*() allocator functions below.
+static uint64_t _alloc_count = 0;
+static uint64_t _alloc_bytes = 0;
+
+extern void* __real_malloc(size_t size);
+extern void* __real_calloc(size_t nmemb, size_t size);
+extern void* __real_realloc(void* ptr, size_t size);
+extern void* __real_aligned_alloc(size_t alignment, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    _alloc_count++;
+    _alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    _alloc_count++;
+    _alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    _alloc_count++;
+    _alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void* __wrap_aligned_alloc(size_t alignment, size_t size)
+{
+    _alloc_count++;
+    _alloc_bytes += size;
+    return __real_aligned_alloc(alignment, size);
+}
+
+// An encoded frame, ready to be decoded.
+typedef struct {
+    uint8_t* data;
+    int len;
+} bench_frame_t;
+
+static vss_signal_t* _bench_root = 0;
+
+// Leaf signals, and their paths, in random order.
+static vss_signal_t** _leaves = 0;
+static char** _leaf_paths = 0;
+static char** _leaf_values = 0;
+static bench_frame_t* _leaf_frames = 0;
+static int _leaf_count = 0;
+
+// Lowest level branches, hosting the leaves, in random order.
+static vss_signal_t** _branches = 0;
+static bench_frame_t* _branch_frames = 0;
+static int _branch_count = 0;
+
+// Vehicle.Chassis, which is kept out of the leaf and branch arrays
+// above. All leaves have fixed size types, so that a codec can be
+// generated for it. Same order as in gen_chassis_codec.py.
+static const vss_data_type_e _chassis_types[] = {
+    VSS_UINT8, VSS_FLOAT, VSS_UINT16, VSS_BOOLEAN, VSS_INT32,
+    VSS_DOUBLE, VSS_INT16, VSS_UINT32, VSS_INT8
+};
+static vss_signal_t* _chassis = 0;
+static bench_frame_t _chassis_frame;
+
+// Signatures of all signals, in random order.
+static uint32_t* _all_signatures = 0;
+static int _all_signature_count = 0;
+
+static uint8_t _bench_buf[BENCH_FRAME_SIZE];
+
+// Prevents the compiler from optimizing away benchmarked calls.
+static volatile uint64_t _sink = 0;
+
+// String lengths used for string leaves. Most strings in real
+// specifications are short.
+static const int _string_lengths[] = { 0, 4, 8, 16, 32, 64, 255 };
+
+static uint32_t _rand_state = 0x12345678;
+
+static uint32_t _rand(void)
+{
+    // xorshift32. Deterministic so that runs are comparable.
+    _rand_state ^= _rand_state << 13;
+    _rand_state ^= _rand_state >> 17;
+    _rand_state ^= _rand_state << 5;
+    return _rand_state;
+}
+
+static void _shuffle(void* array, int count, size_t size)
+{
+    // Large enough for any element type shuffled here.
+    uint8_t tmp[64];
+    uint8_t* arr = (uint8_t*) array;
+    int ind = count;
+
+    while(ind > 1) {
+        int other = _rand() % ind--;
+
+        memcpy(tmp, arr + ind * size, size);
+        memcpy(arr + ind * size, arr + other * size, size);
+        memcpy(arr + other * size, tmp, size);
+    }
+}
+
+static void* _bench_alloc(size_t size)
+{
+    void* res = calloc(1, size);
+
+    if (!res) {
+        fprintf(stderr, "Out of memory\n");
+        exit(255);
+    }
+    return res;
+}
+
+// Create a value, as a string, for sig.
+static char* _make_value(vss_signal_t* sig)
+{
+    char buf[512];
+
+    switch(sig->data_type) {
+    case VSS_INT8:
+    case VSS_INT16:
+    case VSS_INT32:
+        snprintf(buf, sizeof(buf), "%d", (int) (_rand() % 200) - 100);
+        break;
+
+    case VSS_UINT8:
+    case VSS_UINT16:
+    case VSS_UINT32:
+        snprintf(buf, sizeof(buf), "%u", _rand() % 200);
+        break;
+
+    case VSS_FLOAT:
+    case VSS_DOUBLE:
+        snprintf(buf, sizeof(buf), "%f", (_rand() % 100000) / 100.0);
+        break;
+
+    case VSS_BOOLEAN:
+        snprintf(buf, sizeof(buf), "%d", _rand() & 1);
+        break;
+
+    case VSS_STRING: {
+        int len = _string_lengths[_rand() % (sizeof(_string_lengths) / sizeof(_string_lengths[0]))];
+        int ind = 0;
+
+        for(ind = 0; ind < len; ++ind)
+            buf[ind] = 'a' + _rand() % 26;
+
+        buf[len] = 0;
+        break;
+    }
+
+    default:
+        buf[0] = 0;
+        break;
+    }
+
+    return strdup(buf);
+}
+
+static void _encode(vss_signal_t* sig, bench_frame_t* frame)
+{
+    int len = 0;
+    int res = vsd_encode_frame(sig, _bench_buf, sizeof(_bench_buf), &len, 0);
+
+    if (res) {
+        fprintf(stderr, "Could not encode %s: %s\n", sig->name, strerror(res));
+        exit(255);
+    }
+
+    frame->data = (uint8_t*) malloc(len);
+    memcpy(frame->data, _bench_buf, len);
+    frame->len = len;
+}
+
+// Give chassis leaves ranges covering the values of _make_value(),
+// for the validation benchmarks.
+static void _set_chassis_range(vss_signal_t* sig)
+{
+    vss_value_u min = { 0 };
+    vss_value_u max = { 0 };
+
+    switch(sig->data_type) {
+    case VSS_INT8: min.i8 = -100; max.i8 = 100; break;
+    case VSS_UINT8: max.u8 = 200; break;
+    case VSS_INT16: min.i16 = -200; max.i16 = 200; break;
+    case VSS_UINT16: max.u16 = 200; break;
+    case VSS_INT32: min.i32 = -200; max.i32 = 200; break;
+    case VSS_UINT32: max.u32 = 200; break;
+    case VSS_FLOAT: min.f = -1000; max.f = 1000; break;
+    case VSS_DOUBLE: min.d = -1000; max.d = 1000; break;
+    default: return;
+    }
+
+    synthetic_vss_set_range(sig, min, max);
+}
+
+// Add the Vehicle.Chassis branch to the tree.
+static void _build_chassis(void)
+{
+    vss_signal_t* group = 0;
+    char name[32];
+    int ind = 0;
+
+    _chassis = synthetic_vss_add_branch(_bench_root, "Chassis");
+
+    for(ind = 0; ind < BENCH_CHASSIS_LEAVES; ++ind) {
+        if (!(ind % BENCH_CHASSIS_GROUP)) {
+            snprintf(name, sizeof(name), "Group%d", ind / BENCH_CHASSIS_GROUP);
+            group = synthetic_vss_add_branch(_chassis, name);
+        }
+
+        snprintf(name, sizeof(name), "Signal%d", ind % BENCH_CHASSIS_GROUP);
+        _set_chassis_range(synthetic_vss_add_leaf(group, name,
+                                                  _chassis_types[ind % (sizeof(_chassis_types) / sizeof(_chassis_types[0]))]));
+    }
+}
+
+static void _setup(int signal_count)
+{
+    char path[1024];
+    int count = 0;
+    int ind = 0;
+
+    _bench_root = synthetic_vss_build(signal_count, BENCH_FANOUT);
+    count = vss_get_signal_count();
+
+    // Added before any signal state is allocated, which is sized by
+    // the signal count.
+    _build_chassis();
+
+    _leaves = (vss_signal_t**) _bench_alloc(count * sizeof(vss_signal_t*));
+    _branches = (vss_signal_t**) _bench_alloc(count * sizeof(vss_signal_t*));
+    _all_signatures = (uint32_t*) _bench_alloc(count * sizeof(uint32_t));
+
+    for(ind = 0; ind < count; ++ind) {
+        vss_signal_t* sig = vss_get_signal_by_index(ind);
+
+        _all_signatures[_all_signature_count++] = sig->signature;
+
+        if (sig->element_type != VSS_BRANCH) {
+            _leaves[_leaf_count++] = sig;
+            continue;
+        }
+
+        if (sig->children[0] && sig->children[0]->element_type != VSS_BRANCH)
+            _branches[_branch_count++] = sig;
+    }
+
+    _shuffle(_leaves, _leaf_count, sizeof(vss_signal_t*));
+    _shuffle(_branches, _branch_count, sizeof(vss_signal_t*));
+    _shuffle(_all_signatures, _all_signature_count, sizeof(uint32_t));
+
+    // Assign an initial value to all leaves.
+    _leaf_paths = (char**) _bench_alloc(_leaf_count * sizeof(char*));
+    _leaf_values = (char**) _bench_alloc(_leaf_count * sizeof(char*));
+
+    for(ind = 0; ind < _leaf_count; ++ind) {
+        _leaf_paths[ind] = strdup(vss_get_signal_path(_leaves[ind], path, sizeof(path)));
+        _leaf_values[ind] = _make_value(_leaves[ind]);
+        vsd_set_value_by_signal_convert(0, _leaves[ind], _leaf_values[ind]);
+    }
+
+    // Pre-encode frames for the decode and dispatch benchmarks.
+    _leaf_frames = (bench_frame_t*) _bench_alloc(_leaf_count * sizeof(bench_frame_t));
+    _branch_frames = (bench_frame_t*) _bench_alloc(_branch_count * sizeof(bench_frame_t));
+
+    for(ind = 0; ind < _leaf_count; ++ind)
+        _encode(_leaves[ind], &_leaf_frames[ind]);
+
+    for(ind = 0; ind < _branch_count; ++ind)
+        _encode(_branches[ind], &_branch_frames[ind]);
+
+    // Populate the signature hash table.
+    for(ind = 0; ind < _all_signature_count; ++ind)
+        vsd_signal_by_signature(_all_signatures[ind]);
+
+    for(ind = _chassis->index; ind < vss_get_signal_count(); ++ind) {
+        vss_signal_t* sig = vss_get_signal_by_index(ind);
+        char* value = 0;
+
+        vsd_signal_by_signature(sig->signature);
+        if (sig->element_type == VSS_BRANCH)
+            continue;
+
+        value = _make_value(sig);
+        vsd_set_value_by_signal_convert(0, sig, value);
+        free(value);
+    }
+
+    // Encoded generically. Codecs produce the same encoding.
+    _encode(_chassis, &_chassis_frame);
+}
+
+
+//
+// Benchmarks. Each runs iterations operations, cycling through the
+// signals in the (randomized) order set up by _setup().
+//
+
+static void _bench_encode_leaf(uint64_t iterations)
+{
+    uint64_t ind = 0;
+    int len = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        vsd_encode_frame(_leaves[ind % _leaf_count], _bench_buf, sizeof(_bench_buf), &len, 0);
+        _sink += len;
+    }
+}
+
+static void _bench_encode_branch(uint64_t iterations)
+{
+    uint64_t ind = 0;
+    int len = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        vsd_encode_frame(_branches[ind % _branch_count], _bench_buf, sizeof(_bench_buf), &len, 0);
+        _sink += len;
+    }
+}
+
+static void _decode(vss_signal_t* sig, bench_frame_t* frame)
+{
+    vsd_signal_list_t lst;
+
+    vsd_signal_list_init(&lst, 0, 0, 0);
+    _sink += vsd_decode_frame(sig, frame->data, frame->len, &lst);
+    vsd_signal_list_empty(&lst);
+}
+
+static void _bench_decode_leaf(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        _decode(_leaves[ind % _leaf_count], &_leaf_frames[ind % _leaf_count]);
+}
+
+static void _bench_decode_branch(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        _decode(_branches[ind % _branch_count], &_branch_frames[ind % _branch_count]);
+}
+
+// Encode and decode of the 200 signal Vehicle.Chassis branch, with
+// the generic encoder and decoder, and with the generated codec.
+static void _setup_chassis_generic(void)
+{
+    vsd_register_codec(0, _chassis, 0);
+}
+
+static void _setup_chassis_codec(void)
+{
+    int res = bench_register_chassis_codec(0);
+
+    if (res) {
+        fprintf(stderr, "Could not register chassis codec: %s\n", strerror(res));
+        exit(255);
+    }
+}
+
+static void _bench_encode_chassis(uint64_t iterations)
+{
+    uint64_t ind = 0;
+    int len = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        vsd_encode_frame(_chassis, _bench_buf, sizeof(_bench_buf), &len, 0);
+        _sink += len;
+    }
+}
+
+static void _bench_decode_chassis(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        _decode(_chassis, &_chassis_frame);
+}
+
+// The Vehicle.Chassis leaves, in random order, as records for
+// vsd_set_values(). Mimics a gateway storing decoded CAN signals.
+static vsd_set_record_t* _chassis_records = 0;
+static int _chassis_record_count = 0;
+
+static void _setup_set_chassis(void)
+{
+    int ind = 0;
+
+    if (_chassis_records)
+        return;
+
+    _chassis_records = (vsd_set_record_t*) _bench_alloc(BENCH_CHASSIS_LEAVES * sizeof(vsd_set_record_t));
+
+    for(ind = _chassis->index; ind < vss_get_signal_count(); ++ind) {
+        vss_signal_t* sig = vss_get_signal_by_index(ind);
+        vsd_set_record_t* rec = &_chassis_records[_chassis_record_count];
+
+        if (sig->element_type == VSS_BRANCH)
+            continue;
+
+        rec->index = sig->index;
+        rec->data_type = sig->data_type;
+        vsd_string_to_data(sig->data_type, "42", &rec->value);
+        _chassis_record_count++;
+    }
+
+    _shuffle(_chassis_records, _chassis_record_count, sizeof(vsd_set_record_t));
+}
+
+static int _set_by_index(const vsd_set_record_t* rec)
+{
+    switch(rec->data_type) {
+    case VSS_INT8: return vsd_set_value_by_index_int8(0, rec->index, rec->value.i8);
+    case VSS_UINT8: return vsd_set_value_by_index_uint8(0, rec->index, rec->value.u8);
+    case VSS_INT16: return vsd_set_value_by_index_int16(0, rec->index, rec->value.i16);
+    case VSS_UINT16: return vsd_set_value_by_index_uint16(0, rec->index, rec->value.u16);
+    case VSS_INT32: return vsd_set_value_by_index_int32(0, rec->index, rec->value.i32);
+    case VSS_UINT32: return vsd_set_value_by_index_uint32(0, rec->index, rec->value.u32);
+    case VSS_FLOAT: return vsd_set_value_by_index_float(0, rec->index, rec->value.f);
+    case VSS_DOUBLE: return vsd_set_value_by_index_double(0, rec->index, rec->value.d);
+    default: return vsd_set_value_by_index_boolean(0, rec->index, rec->value.b);
+    }
+}
+
+static void _bench_set_by_index(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        _sink += _set_by_index(&_chassis_records[ind % _chassis_record_count]);
+}
+
+// The same, with all values checked against the chassis ranges.
+static void _setup_validate_strict(void)
+{
+    _setup_set_chassis();
+    vsd_set_validation(0, VSD_VALIDATE_STRICT);
+}
+
+static void _setup_validate_permissive(void)
+{
+    _setup_set_chassis();
+    vsd_set_validation(0, VSD_VALIDATE_PERMISSIVE);
+}
+
+static void _teardown_validate(void)
+{
+    vsd_set_validation(0, VSD_VALIDATE_NONE);
+}
+
+// One operation is one record.
+static void _bench_set_bulk(uint64_t iterations)
+{
+    uint32_t applied = 0;
+
+    while(iterations) {
+        uint64_t count = iterations < _chassis_record_count ? iterations : _chassis_record_count;
+
+        _sink += vsd_set_values(0, _chassis_records, count, VSD_SET_ATOMIC, &applied);
+        _sink += applied;
+        iterations -= count;
+    }
+}
+
+static void _bench_signature_lookup(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        _sink += (uintptr_t) vsd_signal_by_signature(_all_signatures[ind % _all_signature_count]);
+}
+
+// Typed setters for scalars. Strings are set through
+// vsd_set_value_by_path_convert(), since
+// vsd_set_value_by_path_string() does not copy the string.
+static int _set_by_path(vss_signal_t* sig, char* path, char* value)
+{
+    switch(sig->data_type) {
+    case VSS_INT8: return vsd_set_value_by_path_int8(0, path, -8);
+    case VSS_UINT8: return vsd_set_value_by_path_uint8(0, path, 8);
+    case VSS_INT16: return vsd_set_value_by_path_int16(0, path, -16);
+    case VSS_UINT16: return vsd_set_value_by_path_uint16(0, path, 16);
+    case VSS_INT32: return vsd_set_value_by_path_int32(0, path, -32);
+    case VSS_UINT32: return vsd_set_value_by_path_uint32(0, path, 32);
+    case VSS_FLOAT: return vsd_set_value_by_path_float(0, path, 1.5);
+    case VSS_DOUBLE: return vsd_set_value_by_path_double(0, path, 2.5);
+    case VSS_BOOLEAN: return vsd_set_value_by_path_boolean(0, path, 1);
+    default: return vsd_set_value_by_path_convert(0, path, value);
+    }
+}
+
+static void _bench_set_by_path(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        int leaf = ind % _leaf_count;
+
+        _sink += _set_by_path(_leaves[leaf], _leaf_paths[leaf], _leaf_values[leaf]);
+    }
+}
+
+static void _bench_set_by_path_convert(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        int leaf = ind % _leaf_count;
+
+        _sink += vsd_set_value_by_path_convert(0, _leaf_paths[leaf], _leaf_values[leaf]);
+    }
+}
+
+// All leaf values as path:value lines, for vsd_set_values_from_text().
+// _text_offsets[n] is the length of the first n lines.
+static char* _text = 0;
+static size_t* _text_offsets = 0;
+
+static void _setup_ingest_text(void)
+{
+    size_t len = 0;
+    int ind = 0;
+
+    if (_text)
+        return;
+
+    _text_offsets = (size_t*) _bench_alloc((_leaf_count + 1) * sizeof(size_t));
+    for(ind = 0; ind < _leaf_count; ++ind) {
+        _text_offsets[ind] = len;
+        len += strlen(_leaf_paths[ind]) + strlen(_leaf_values[ind]) + 2;
+    }
+    _text_offsets[_leaf_count] = len;
+
+    _text = (char*) _bench_alloc(len + 1);
+    for(ind = 0; ind < _leaf_count; ++ind)
+        sprintf(_text + _text_offsets[ind], "%s:%s\n", _leaf_paths[ind], _leaf_values[ind]);
+}
+
+// One operation is one line.
+static void _bench_ingest_text(uint64_t iterations)
+{
+    uint32_t applied = 0;
+
+    while(iterations) {
+        uint64_t lines = iterations < _leaf_count ? iterations : _leaf_count;
+
+        _sink += vsd_set_values_from_text(0, _text, _text_offsets[lines], &applied);
+        _sink += applied;
+        iterations -= lines;
+    }
+}
+
+// Publish to callback latency, recorded by the loopback
+// latency benchmark.
+static vsd_histogram_t _latency;
+static volatile uint64_t _latency_start = 0;
+
+// Only the first subscriber invoked for a frame is timed.
+static void _latency_record(void)
+{
+    uint64_t nsec = 0;
+
+    if (!_latency_start)
+        return;
+
+    nsec = vsd_nsec_monotonic_timestamp() - _latency_start;
+    _latency.buckets[vsd_histogram_bucket(nsec)]++;
+    _latency.count++;
+    _latency.sum_nsec += nsec;
+    if (nsec > _latency.max_nsec)
+        _latency.max_nsec = nsec;
+    _latency_start = 0;
+}
+
+static void _bench_subscriber(vsd_context_t* ctx, vsd_signal_list_t* lst)
+{
+    _sink++;
+    _latency_record();
+}
+
+// Full receive path for a branch frame: signature lookup, decode
+// and invocation of one subscriber on the branch and one on the root.
+static void _bench_dispatch(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        int branch = ind % _branch_count;
+
+        vsd_receive_frame(0, _branches[branch]->signature,
+                          _branch_frames[branch].data,
+                          _branch_frames[branch].len);
+    }
+}
+
+static void _setup_dispatch(void)
+{
+    static int subscribed = 0;
+    int ind = 0;
+
+    if (subscribed)
+        return;
+
+    subscribed = 1;
+    vsd_subscribe(0, _bench_root, _bench_subscriber);
+    for(ind = 0; ind < _branch_count; ++ind)
+        vsd_subscribe(0, _branches[ind], _bench_subscriber);
+}
+
+// Same as dispatch, with BENCH_PATTERN_COUNT pattern subscriptions
+// added. Each pattern is the path of a random leaf with its second
+// component replaced by "*".
+static void _setup_pattern_dispatch(void)
+{
+    static int subscribed = 0;
+    char pattern[256];
+    int ind = 0;
+
+    _setup_dispatch();
+
+    if (subscribed)
+        return;
+
+    subscribed = 1;
+    for(ind = 0; ind < BENCH_PATTERN_COUNT && ind < _leaf_count; ++ind) {
+        char* second = strchr(_leaf_paths[ind], '.');
+        char* third = second ? strchr(second + 1, '.') : 0;
+
+        if (third)
+            snprintf(pattern, sizeof(pattern), "%.*s.*%s",
+                     (int) (second - _leaf_paths[ind]), _leaf_paths[ind], third);
+        else
+            snprintf(pattern, sizeof(pattern), "%s", _leaf_paths[ind]);
+
+        vsd_subscribe_pattern(0, pattern, _bench_subscriber);
+    }
+}
+
+// Receive path with a conflating subscriber on the root, delivered
+// to once every BENCH_CONFLATE_FRAMES frames, as a dashboard slower
+// than the incoming traffic would be. Frames cycle over
+// BENCH_CONFLATE_BRANCHES branches, so each delivery carries the
+// latest of several updates of each signal.
+static void _setup_conflate(void)
+{
+    vsd_subscribe_ext(0, _bench_root, _bench_subscriber, VSD_SUBSCRIBE_CONFLATE);
+}
+
+static void _teardown_conflate(void)
+{
+    vsd_unsubscribe(0, _bench_root, _bench_subscriber);
+}
+
+static void _bench_dispatch_conflated(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        int branch = ind % BENCH_CONFLATE_BRANCHES % _branch_count;
+
+        vsd_receive_frame(0, _branches[branch]->signature,
+                          _branch_frames[branch].data,
+                          _branch_frames[branch].len);
+
+        if (!((ind + 1) % BENCH_CONFLATE_FRAMES))
+            vsd_deliver_conflated(0, 0);
+    }
+}
+
+// Receive path with an on change subscriber on the root. The
+// pre-encoded frames resend the same values, so after the first
+// round no callbacks are made.
+static void _setup_on_change(void)
+{
+    vsd_subscribe_ext(0, _bench_root, _bench_subscriber, VSD_SUBSCRIBE_ON_CHANGE);
+}
+
+static void _teardown_on_change(void)
+{
+    vsd_unsubscribe(0, _bench_root, _bench_subscriber);
+}
+
+// Publish path into a transport that drops every frame. With
+// interest filtering on and no node subscribing, publish_uninterested
+// returns before anything is encoded.
+static int _null_transmit(vsd_transport_t* transport,
+                          uint32_t signature,
+                          const uint8_t* data,
+                          uint16_t len)
+{
+    _sink += len;
+    return 0;
+}
+
+static vsd_transport_t _null_transport = { .name = "null", .transmit = _null_transmit };
+
+static void _setup_publish(void)
+{
+    vsd_set_transport(0, &_null_transport);
+}
+
+static void _setup_publish_filtered(void)
+{
+    vsd_set_transport(0, &_null_transport);
+    vsd_set_interest_mode(0, VSD_INTEREST_FILTER);
+}
+
+static void _teardown_publish(void)
+{
+    vsd_set_interest_mode(0, 0);
+    vsd_set_transport(0, 0);
+}
+
+static void _bench_publish(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        vsd_publish(_branches[ind % _branch_count]);
+}
+
+// Receive path for frames nobody subscribed to, decoded on arrival
+// or held by lazy decoding. receive_lazy_get reads one signal of
+// each frame, which decodes the held frame on demand.
+static void _setup_lazy(void)
+{
+    vsd_set_lazy_decode(0, 1);
+}
+
+static void _teardown_lazy(void)
+{
+    vsd_set_lazy_decode(0, 0);
+}
+
+static void _bench_receive_lazy_get(uint64_t iterations)
+{
+    uint64_t ind = 0;
+    vsd_data_u val;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        int branch = ind % _branch_count;
+
+        vsd_receive_frame(0, _branches[branch]->signature,
+                          _branch_frames[branch].data,
+                          _branch_frames[branch].len);
+        vsd_get_value(_branches[branch]->children[0], &val);
+    }
+}
+
+// Receive path with a rate limited subscription on the root, which
+// is delivered once and then waits out its period for the rest of the
+// run. Frames are decoded, or held by lazy decoding.
+static void _setup_rate_limited(void)
+{
+    vsd_subscribe_rate_limited(0, _bench_root, _bench_subscriber, 1000000);
+}
+
+static void _setup_rate_limited_lazy(void)
+{
+    _setup_rate_limited();
+    vsd_set_lazy_decode(0, 1);
+}
+
+static void _teardown_rate_limited(void)
+{
+    vsd_set_lazy_decode(0, 0);
+    vsd_unsubscribe(0, _bench_root, _bench_subscriber);
+}
+
+// Subscribe and unsubscribe one subscriber on the root, alongside
+// BENCH_CHURN_SUBSCRIPTIONS others, as a plugin host loading and
+// unloading plugins would. vsd_unsubscribe() searches the list by
+// callback, while vsd_unsubscribe_handle() goes straight to the slot.
+static vsd_subscription_t _churn_handles[BENCH_CHURN_SUBSCRIPTIONS];
+
+static void _churn_subscriber(vsd_context_t* ctx, vsd_signal_list_t* lst)
+{
+    _sink++;
+}
+
+static void _churn_ctx_subscriber(vsd_context_t* ctx, vsd_signal_list_t* lst, void* user_data)
+{
+    _sink++;
+}
+
+static void _setup_churn(void)
+{
+    int ind = 0;
+
+    for(ind = 0; ind < BENCH_CHURN_SUBSCRIPTIONS; ++ind)
+        vsd_subscribe(0, _bench_root, _bench_subscriber);
+}
+
+static void _teardown_churn(void)
+{
+    int ind = 0;
+
+    for(ind = 0; ind < BENCH_CHURN_SUBSCRIPTIONS; ++ind)
+        vsd_unsubscribe(0, _bench_root, _bench_subscriber);
+}
+
+static void _bench_subscribe_churn(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        vsd_subscribe(0, _bench_root, _churn_subscriber);
+        vsd_unsubscribe(0, _bench_root, _churn_subscriber);
+    }
+}
+
+static void _setup_churn_handle(void)
+{
+    int ind = 0;
+
+    for(ind = 0; ind < BENCH_CHURN_SUBSCRIPTIONS; ++ind)
+        vsd_subscribe_ctx(0, _bench_root, _churn_ctx_subscriber,
+                          &_churn_handles[ind], 0, &_churn_handles[ind]);
+}
+
+static void _teardown_churn_handle(void)
+{
+    int ind = 0;
+
+    for(ind = 0; ind < BENCH_CHURN_SUBSCRIPTIONS; ++ind)
+        vsd_unsubscribe_handle(0, _churn_handles[ind]);
+}
+
+static void _bench_subscribe_churn_handle(uint64_t iterations)
+{
+    vsd_subscription_t handle = 0;
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind) {
+        vsd_subscribe_ctx(0, _bench_root, _churn_ctx_subscriber, 0, 0, &handle);
+        vsd_unsubscribe_handle(0, handle);
+    }
+}
+
+// Full publish to callback path through the loopback transport:
+// encode, transmit, decode and dispatch.
+static vsd_transport_t* _loopback = 0;
+static vsd_transport_t* _loopback_thread = 0;
+
+static void _setup_loopback(void)
+{
+    _setup_dispatch();
+
+    if (!_loopback)
+        vsd_loopback_create(0, 0, &_loopback);
+
+    vsd_set_transport(0, _loopback);
+}
+
+static void _setup_loopback_thread(void)
+{
+    _setup_dispatch();
+
+    if (!_loopback_thread)
+        vsd_loopback_create(0, VSD_LOOPBACK_THREAD, &_loopback_thread);
+
+    vsd_set_transport(0, _loopback_thread);
+}
+
+// Throughput with the receive path running on its own thread.
+static void _bench_loopback_thread(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    for(ind = 0; ind < iterations; ++ind)
+        vsd_publish(_branches[ind % _branch_count]);
+
+    vsd_loopback_flush(_loopback_thread);
+}
+
+// One publish at a time, waiting for delivery before the next.
+static void _bench_loopback_thread_latency(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    memset(&_latency, 0, sizeof(_latency));
+    for(ind = 0; ind < iterations; ++ind) {
+        _latency_start = vsd_nsec_monotonic_timestamp();
+        vsd_publish(_branches[ind % _branch_count]);
+        vsd_loopback_flush(_loopback_thread);
+    }
+}
+
+// Round trip between two processes through the shared memory
+// transport. A forked child subscribes to a ping branch and publishes
+// a pong branch from its callback.
+static vsd_transport_t* _shm = 0;
+static pid_t _shm_child = 0;
+static volatile int _pong_received = 0;
+
+static void _shm_ping_cb(vsd_context_t* ctx, vsd_signal_list_t* lst)
+{
+    vsd_publish(_branches[1]);
+}
+
+static void _shm_pong_cb(vsd_context_t* ctx, vsd_signal_list_t* lst)
+{
+    _latency_record();
+    _pong_received = 1;
+}
+
+static void _shm_child_main(void)
+{
+    vsd_transport_t* shm = 0;
+
+    // Die with the benchmark.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    if (vsd_shm_create(0, VSD_SHM_LOCAL_ONLY, &shm)) {
+        fprintf(stderr, "Could not create shared memory transport\n");
+        exit(255);
+    }
+
+    vsd_set_transport(0, shm);
+    vsd_subscribe(0, _branches[0], _shm_ping_cb);
+
+    while(1)
+        vsd_shm_process(0, -1);
+}
+
+static void _shm_ping(void)
+{
+    _pong_received = 0;
+    _latency_start = vsd_nsec_monotonic_timestamp();
+    vsd_publish(_branches[0]);
+
+    while(!_pong_received)
+        vsd_shm_process(0, -1);
+}
+
+static void _setup_shm(void)
+{
+    int res = 0;
+
+    if (_shm)
+        return;
+
+    if (_branch_count < 2) {
+        fprintf(stderr, "shm_round_trip needs at least two branches\n");
+        exit(255);
+    }
+
+    _shm_child = fork();
+    if (!_shm_child)
+        _shm_child_main();
+
+    res = vsd_shm_create(0, VSD_SHM_LOCAL_ONLY, &_shm);
+    if (res) {
+        fprintf(stderr, "Could not create shared memory transport: %s\n", strerror(res));
+        exit(255);
+    }
+
+    vsd_set_transport(0, _shm);
+    vsd_subscribe(0, _branches[1], _shm_pong_cb);
+
+    // Ping until the child has attached to our ring.
+    while(!_pong_received) {
+        _latency_start = 0;
+        vsd_publish(_branches[0]);
+        vsd_shm_process(0, 10);
+    }
+}
+
+static void _teardown_shm(void)
+{
+    vsd_set_transport(0, 0);
+    vsd_shm_destroy(_shm);
+    _shm = 0;
+
+    kill(_shm_child, SIGKILL);
+    waitpid(_shm_child, 0, 0);
+}
+
+static void _bench_shm_round_trip(uint64_t iterations)
+{
+    uint64_t ind = 0;
+
+    memset(&_latency, 0, sizeof(_latency));
+    for(ind = 0; ind < iterations; ++ind)
+        _shm_ping();
+}
+
+typedef struct {
+    const char* name;
+    void (*setup)(void);
+    void (*run)(uint64_t iterations);
+    // If set, percentiles of this histogram are reported as well.
+    vsd_histogram_t* histogram;
+    void (*teardown)(void);
+} benchmark_t;
+
+// Run in this order. Setters overwrite values, and dispatch and
+// loopback add subscribers, so these go last.
+static benchmark_t _benchmarks[] = {
+    { "encode_leaf", 0, _bench_encode_leaf },
+    { "encode_branch", 0, _bench_encode_branch },
+    { "decode_leaf", 0, _bench_decode_leaf },
+    { "decode_branch", 0, _bench_decode_branch },
+    { "encode_chassis", _setup_chassis_generic, _bench_encode_chassis },
+    { "encode_chassis_codec", _setup_chassis_codec, _bench_encode_chassis, 0, _setup_chassis_generic },
+    { "decode_chassis", _setup_chassis_generic, _bench_decode_chassis },
+    { "decode_chassis_codec", _setup_chassis_codec, _bench_decode_chassis, 0, _setup_chassis_generic },
+    { "set_by_index", _setup_set_chassis, _bench_set_by_index },
+    { "set_bulk", _setup_set_chassis, _bench_set_bulk },
+    { "set_by_index_permissive", _setup_validate_permissive, _bench_set_by_index, 0, _teardown_validate },
+    { "set_by_index_strict", _setup_validate_strict, _bench_set_by_index, 0, _teardown_validate },
+    { "set_bulk_strict", _setup_validate_strict, _bench_set_bulk, 0, _teardown_validate },
+    { "decode_chassis_strict", _setup_validate_strict, _bench_decode_chassis, 0, _teardown_validate },
+    { "signature_lookup", 0, _bench_signature_lookup },
+    { "set_by_path", 0, _bench_set_by_path },
+    { "set_by_path_convert", 0, _bench_set_by_path_convert },
+    { "ingest_text", _setup_ingest_text, _bench_ingest_text },
+    { "publish", _setup_publish, _bench_publish, 0, _teardown_publish },
+    { "publish_uninterested", _setup_publish_filtered, _bench_publish, 0, _teardown_publish },
+    { "receive_unsubscribed", 0, _bench_dispatch },
+    { "receive_lazy", _setup_lazy, _bench_dispatch, 0, _teardown_lazy },
+    { "receive_lazy_get", _setup_lazy, _bench_receive_lazy_get, 0, _teardown_lazy },
+    { "receive_rate_limited", _setup_rate_limited, _bench_dispatch, 0, _teardown_rate_limited },
+    { "receive_rate_limited_lazy", _setup_rate_limited_lazy, _bench_dispatch, 0, _teardown_rate_limited },
+    { "subscribe_churn", _setup_churn, _bench_subscribe_churn, 0, _teardown_churn },
+    { "subscribe_churn_handle", _setup_churn_handle, _bench_subscribe_churn_handle, 0, _teardown_churn_handle },
+    { "dispatch_conflated", _setup_conflate, _bench_dispatch_conflated, 0, _teardown_conflate },
+    { "dispatch_on_change", _setup_on_change, _bench_dispatch, 0, _teardown_on_change },
+    { "dispatch", _setup_dispatch, _bench_dispatch },
+    { "pattern_dispatch", _setup_pattern_dispatch, _bench_dispatch },
+    { "loopback", _setup_loopback, _bench_publish },
+    { "loopback_thread", _setup_loopback_thread, _bench_loopback_thread },
+    { "loopback_thread_latency", _setup_loopback_thread,
+      _bench_loopback_thread_latency, &_latency },
+    { "shm_round_trip", _setup_shm, _bench_shm_round_trip, &_latency, _teardown_shm },
+};
+
+
+static int64_t _nsec_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Double the number of iterations until a run takes at least
+// min_msec, and report that run.
+static void _run(benchmark_t* bench, int signal_count, int min_msec)
+{
+    uint64_t iterations = 1;
+    uint64_t alloc_count = 0;
+    uint64_t alloc_bytes = 0;
+    int64_t elapsed = 0;
+
+    if (bench->setup)
+        (*bench->setup)();
+
+    // Warm up caches and lazily allocated state.
+    (*bench->run)(_leaf_count);
+
+    while(1) {
+        int64_t start = 0;
+
+        alloc_count = _alloc_count;
+        alloc_bytes = _alloc_bytes;
+        start = _nsec_timestamp();
+        (*bench->run)(iterations);
+        elapsed = _nsec_timestamp() - start;
+        alloc_count = _alloc_count - alloc_count;
+        alloc_bytes = _alloc_bytes - alloc_bytes;
+
+        if (elapsed >= min_msec * 1000000LL)
+            break;
+
+        iterations *= 2;
+    }
+
+    printf("{\"benchmark\":\"%s\",\"signals\":%d,\"iterations\":%llu,"
+           "\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f",
+           bench->name,
+           signal_count,
+           (unsigned long long) iterations,
+           (double) elapsed / iterations,
+           (double) alloc_count / iterations,
+           (double) alloc_bytes / iterations);
+
+    if (bench->histogram)
+        printf(",\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu",
+               (unsigned long long) vsd_histogram_percentile(bench->histogram, 50),
+               (unsigned long long) vsd_histogram_percentile(bench->histogram, 99),
+               (unsigned long long) bench->histogram->max_nsec);
+
+    printf("}\n");
+    fflush(stdout);
+
+    if (bench->teardown)
+        (*bench->teardown)();
+}
+
+
+static void usage(char* name)
+{
+    fprintf(stderr, "Usage: %s [-n signals] [-b benchmark] [-t msec]\n", name);
+    fprintf(stderr, "  -n signals    Number of leaf signals in synthetic tree. Default 1000\n");
+    fprintf(stderr, "  -b benchmark  Only run the given benchmark. Default all\n");
+    fprintf(stderr, "  -t msec       Minimum run time of each benchmark. Default 200\n");
+    fprintf(stderr, "Benchmarks:");
+    for(int ind = 0; ind < sizeof(_benchmarks) / sizeof(_benchmarks[0]); ++ind)
+        fprintf(stderr, " %s", _benchmarks[ind].name);
+    fprintf(stderr, "\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    int signal_count = 1000;
+    int min_msec = 200;
+    char* only = 0;
+    int opt = 0;
+    int ind = 0;
+
+    while ((opt = getopt(argc, argv, "n:b:t:")) != -1) {
+        switch (opt) {
+        case 'n':
+            signal_count = atoi(optarg);
+            break;
+
+        case 'b':
+            only = optarg;
+            break;
+
+        case 't':
+            min_msec = atoi(optarg);
+            break;
+
+        default: /* '?' */
+            usage(argv[0]);
+            exit(255);
+        }
+    }
+
+    if (signal_count <= 0 || min_msec <= 0) {
+        usage(argv[0]);
+        exit(255);
+    }
+
+    _setup(signal_count);
+
+    for(ind = 0; ind < sizeof(_benchmarks) / sizeof(_benchmarks[0]); ++ind) {
+        if (only && strcmp(only, _benchmarks[ind].name))
+            continue;
+
+        _run(&_benchmarks[ind], signal_count, min_msec);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,216 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Typed C++ access to VSD signals.
+//
+// Signal and branch types are generated from the VSS specification by
+// vspec2cpp.py into vss.hpp. Each type carries its signal index and
+// data type as compile time constants:
+//
+//   #include "vss.hpp"
+//
+//   vsd::set<vss::Vehicle::Speed>(87.5f);
+//   float speed = vsd::get<vss::Vehicle::Speed>();
+//   vsd::publish<vss::Vehicle>();
+//
+// Setting a value of the wrong type fails to compile, and no path
+// lookup or run time type dispatch takes place.
+//
+// Requires C++17.
+//
+
+#ifndef __VSD_HPP__
+#define __VSD_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include "vehicle_signal_distribution.h"
+}
+
+namespace vsd {
+
+// Maps a VSS data type to the C++ type holding its values, the
+// vsd_data_u member storing it, its setter, and its encoded size.
+template <vss_data_type_e DataType> struct data_type_traits;
+
+#define VSD_DATA_TYPE_TRAITS(DATA_TYPE, TYPE, MEMBER, SETTER, SIZE)     \
+    template <> struct data_type_traits<DATA_TYPE> {                    \
+        using type = TYPE;                                              \
+        static constexpr std::size_t encoded_size = SIZE;               \
+        static type get(const vsd_data_u& val) { return val.MEMBER; }   \
+        static int set(vss_signal_t* sig, type val)                     \
+        {                                                               \
+            return SETTER(0, sig, val);                                 \
+        }                                                               \
+    }
+
+VSD_DATA_TYPE_TRAITS(VSS_INT8, int8_t, i8, vsd_set_value_by_signal_int8, 1);
+VSD_DATA_TYPE_TRAITS(VSS_UINT8, uint8_t, u8, vsd_set_value_by_signal_uint8, 1);
+VSD_DATA_TYPE_TRAITS(VSS_INT16, int16_t, i16, vsd_set_value_by_signal_int16, 2);
+VSD_DATA_TYPE_TRAITS(VSS_UINT16, uint16_t, u16, vsd_set_value_by_signal_uint16, 2);
+VSD_DATA_TYPE_TRAITS(VSS_INT32, int32_t, i32, vsd_set_value_by_signal_int32, 4);
+VSD_DATA_TYPE_TRAITS(VSS_UINT32, uint32_t, u32, vsd_set_value_by_signal_uint32, 4);
+VSD_DATA_TYPE_TRAITS(VSS_FLOAT, float, f, vsd_set_value_by_signal_float, 4);
+VSD_DATA_TYPE_TRAITS(VSS_DOUBLE, double, d, vsd_set_value_by_signal_double, 8);
+VSD_DATA_TYPE_TRAITS(VSS_BOOLEAN, bool, b, vsd_set_value_by_signal_boolean, 1);
+
+#undef VSD_DATA_TYPE_TRAITS
+
+// Strings are set from, and returned as, null terminated strings.
+// A returned string is owned by VSD and valid until the signal is
+// next set or received.
+template <> struct data_type_traits<VSS_STRING> {
+    using type = const char*;
+    // Length field only. The string itself is not included.
+    static constexpr std::size_t encoded_size = sizeof(uint16_t);
+    static type get(const vsd_data_u& val) { return val.s.data; }
+    static int set(vss_signal_t* sig, type val)
+    {
+        // The setter copies val and does not modify it.
+        return vsd_set_value_by_signal_string(0, sig, const_cast<char*>(val));
+    }
+};
+
+// Base of all generated leaf signal types.
+template <int Index, vss_data_type_e DataType>
+struct signal {
+    static constexpr int index = Index;
+    static constexpr vss_data_type_e data_type = DataType;
+    static constexpr bool is_branch = false;
+    using value_type = typename data_type_traits<DataType>::type;
+
+    // Bytes used by the signal in an encoded frame: its signature and
+    // value. Excludes the payload of string signals, and per-signal
+    // timestamps.
+    static constexpr std::size_t encoded_size =
+        sizeof(uint32_t) + data_type_traits<DataType>::encoded_size;
+
+    // Set if encoded_size is exact.
+    static constexpr bool fixed_size = DataType != VSS_STRING;
+
+    static vss_signal_t* get_signal() { return vss_get_signal_by_index(Index); }
+};
+
+// Base of all generated branch types.
+// EncodedSize and FixedSize are the sums of the encoded_size and
+// fixed_size of all signals under the branch, computed by the generator.
+template <int Index, std::size_t EncodedSize, bool FixedSize>
+struct branch {
+    static constexpr int index = Index;
+    static constexpr bool is_branch = true;
+    static constexpr std::size_t encoded_size = EncodedSize;
+    static constexpr bool fixed_size = FixedSize;
+
+    static vss_signal_t* get_signal() { return vss_get_signal_by_index(Index); }
+};
+
+// Set the value of Signal.
+// Returns the result of the underlying vsd_set_value_by_signal_*() call.
+template <typename Signal>
+inline int set(typename Signal::value_type val)
+{
+    static_assert(!Signal::is_branch, "Cannot set the value of a branch");
+    return data_type_traits<Signal::data_type>::set(Signal::get_signal(), val);
+}
+
+// Return the current value of Signal.
+template <typename Signal>
+inline typename Signal::value_type get()
+{
+    static_assert(!Signal::is_branch, "Cannot get the value of a branch");
+    vsd_data_u val;
+
+    std::memset(&val, 0, sizeof(val));
+    vsd_get_value(Signal::get_signal(), &val);
+    return data_type_traits<Signal::data_type>::get(val);
+}
+
+// Return the current value of Signal, and its source timestamp in
+// timestamp. See vsd_get_value_ts().
+template <typename Signal>
+inline typename Signal::value_type get(uint64_t& timestamp)
+{
+    static_assert(!Signal::is_branch, "Cannot get the value of a branch");
+    vsd_data_u val;
+
+    std::memset(&val, 0, sizeof(val));
+    timestamp = 0;
+    vsd_get_value_ts(Signal::get_signal(), &val, &timestamp);
+    return data_type_traits<Signal::data_type>::get(val);
+}
+
+// Return the value of Signal in a list delivered to a subscriber.
+// Values in the list are current as of the callback.
+template <typename Signal>
+inline typename Signal::value_type get(vsd_signal_node_t* node)
+{
+    static_assert(!Signal::is_branch, "Cannot get the value of a branch");
+    vsd_data_u val;
+
+    std::memset(&val, 0, sizeof(val));
+    vsd_get_value(node->data, &val);
+    return data_type_traits<Signal::data_type>::get(val);
+}
+
+// Return true if node in a list delivered to a subscriber is Node.
+template <typename Node>
+inline bool is(const vsd_signal_node_t* node)
+{
+    return node->data->index == Node::index;
+}
+
+template <typename Node>
+inline int publish()
+{
+    return vsd_publish(Node::get_signal());
+}
+
+template <typename Node>
+inline int subscribe(vsd_subscriber_cb_t callback)
+{
+    return vsd_subscribe(0, Node::get_signal(), callback);
+}
+
+template <typename Node>
+inline int unsubscribe(vsd_subscriber_cb_t callback)
+{
+    return vsd_unsubscribe(0, Node::get_signal(), callback);
+}
+
+// Entry in the table of all signals emitted by vspec2cpp.py.
+struct signal_entry {
+    int index;
+    const char* path;
+};
+
+// Check that the loaded specification matches the one the types
+// were generated from, by comparing the path of each signal index.
+// Returns the index of the first mismatch, or -1 if all match.
+inline int verify(const signal_entry* table, int count)
+{
+    if (vss_get_signal_count() != count)
+        return vss_get_signal_count() < count ? vss_get_signal_count() : count;
+
+    for (int ind = 0; ind < count; ++ind) {
+        vss_signal_t* sig = vss_get_signal_by_index(table[ind].index);
+        char path[1024];
+
+        if (!sig ||
+            !vss_get_signal_path(sig, path, sizeof(path)) ||
+            std::strcmp(path, table[ind].path))
+            return table[ind].index;
+    }
+
+    return -1;
+}
+
+} // namespace vsd
+
+#endif // __VSD_HPP__
@@ -0,0 +1,464 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// C++20 coroutine subscriptions.
+//
+// A subscription delivers the signals of each received frame under its
+// node to a coroutine, which resumes on an executor thread:
+//
+//   vsd::coro::task watch_speed(vsd::coro::executor& exec)
+//   {
+//       vsd::coro::subscription sub(exec, vss::Vehicle::get_signal());
+//
+//       while(true) {
+//           vsd::coro::update upd = co_await sub.next();
+//
+//           for (const vsd::coro::entry& ent : upd)
+//               if (ent.is<vss::Vehicle::Speed>())
+//                   show(ent.get<vss::Vehicle::Speed>());
+//       }
+//   }
+//
+//   vsd::coro::executor exec;
+//   exec.spawn(watch_speed(exec));
+//   exec.run();
+//
+// Any number of coroutines can share an executor. The update returned
+// by next() holds a copy of the values received in one frame, and is
+// valid until next() is called again.
+//
+// Updates are handed from the thread receiving frames to the executor
+// thread through a fixed size ring per subscription, without locks and
+// without allocating memory. If the ring is full the update is dropped
+// and counted by dropped().
+//
+// As with vsd_subscribe(), subscriptions must not be created or
+// destroyed while another thread is receiving frames. Create and
+// destroy them in the coroutine using them, as above.
+//
+// Requires C++20.
+//
+
+#ifndef __VSD_CORO_HPP__
+#define __VSD_CORO_HPP__
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <utility>
+#include <vector>
+#include <errno.h>
+
+#include "vsd.hpp"
+
+namespace vsd {
+namespace coro {
+
+class executor;
+class subscription;
+
+// A coroutine waiting to be resumed by an executor.
+struct ready_node {
+    ready_node* next = nullptr;
+    std::coroutine_handle<> handle;
+};
+
+// Fire and forget coroutine, started with executor::spawn().
+// The coroutine frame is freed when it returns.
+class task {
+public:
+    struct promise_type {
+        ready_node node;
+
+        task get_return_object()
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    // Destroy the coroutine if it was never spawned.
+    ~task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+private:
+    friend class executor;
+    explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Resumes coroutines on the thread calling run() or poll().
+// schedule() and spawn() can be called from any thread.
+class executor {
+public:
+    executor() = default;
+    executor(const executor&) = delete;
+    executor& operator=(const executor&) = delete;
+
+    void spawn(task&& tsk)
+    {
+        ready_node* node = &tsk.handle_.promise().node;
+
+        node->handle = std::exchange(tsk.handle_, {});
+        schedule(node);
+    }
+
+    // Queue node to be resumed. Lock free.
+    void schedule(ready_node* node)
+    {
+        node->next = ready_.load(std::memory_order_relaxed);
+        while(!ready_.compare_exchange_weak(node->next, node,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+            ;
+
+        wake_.fetch_add(1, std::memory_order_release);
+        wake_.notify_one();
+    }
+
+    // Resume all queued coroutines, in the order they were queued.
+    // Returns the number of coroutines resumed.
+    std::size_t poll()
+    {
+        ready_node* node = ready_.exchange(nullptr, std::memory_order_acquire);
+        ready_node* fifo = nullptr;
+        std::size_t count = 0;
+
+        while(node) {
+            ready_node* next = node->next;
+
+            node->next = fifo;
+            fifo = node;
+            node = next;
+        }
+
+        while(fifo) {
+            ready_node* next = fifo->next;
+
+            // The node may be reused as soon as its coroutine runs.
+            fifo->handle.resume();
+            fifo = next;
+            ++count;
+        }
+        return count;
+    }
+
+    // Resume coroutines as they are queued, until stop() is called.
+    void run()
+    {
+        while(!stopped_.load(std::memory_order_acquire)) {
+            uint32_t wake = wake_.load(std::memory_order_acquire);
+
+            if (!poll())
+                wake_.wait(wake, std::memory_order_acquire);
+        }
+    }
+
+    void stop()
+    {
+        stopped_.store(true, std::memory_order_release);
+        wake_.fetch_add(1, std::memory_order_release);
+        wake_.notify_all();
+    }
+
+private:
+    std::atomic<ready_node*> ready_{nullptr};
+    std::atomic<uint32_t> wake_{0};
+    std::atomic<bool> stopped_{false};
+};
+
+// A signal value received in a frame.
+struct entry {
+    vss_signal_t* signal;
+    // String values point into the update holding the entry.
+    vsd_data_u value;
+    uint64_t timestamp;
+
+    template <typename Signal>
+    bool is() const { return signal->index == Signal::index; }
+
+    template <typename Signal>
+    typename Signal::value_type get() const
+    {
+        static_assert(!Signal::is_branch, "Cannot get the value of a branch");
+        return data_type_traits<Signal::data_type>::get(value);
+    }
+};
+
+// The signals received in one frame, in frame order.
+class update {
+public:
+    update() = default;
+    update(const entry* begin, const entry* end) : begin_(begin), end_(end) {}
+
+    const entry* begin() const { return begin_; }
+    const entry* end() const { return end_; }
+    std::size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+
+    // Return the entry of Signal, or nullptr if not in the update.
+    template <typename Signal>
+    const entry* find() const
+    {
+        for (const entry* ent = begin_; ent != end_; ++ent)
+            if (ent->is<Signal>())
+                return ent;
+
+        return nullptr;
+    }
+
+private:
+    const entry* begin_ = nullptr;
+    const entry* end_ = nullptr;
+};
+
+namespace detail {
+
+void deliver(vsd_context_t* ctx, vsd_signal_list_t* lst, void* user_data);
+
+inline int leaf_count(vss_signal_t* sig, bool& has_strings)
+{
+    int count = 0;
+
+    if (sig->element_type != VSS_BRANCH) {
+        has_strings = has_strings || sig->data_type == VSS_STRING;
+        return 1;
+    }
+
+    for (int ind = 0; sig->children && sig->children[ind]; ++ind)
+        count += leaf_count(sig->children[ind], has_strings);
+
+    return count;
+}
+
+} // namespace detail
+
+// Delivers frames received on a signal, or anywhere below it, to the
+// coroutine awaiting next(). Only one coroutine may await a
+// subscription at a time.
+class subscription {
+public:
+    // Subscribe to sig. Up to depth - 1 updates are buffered while the
+    // coroutine is busy with the previous one.
+    subscription(executor& exec, vss_signal_t* sig, std::size_t depth = 4)
+        : exec_(exec), slots_(depth < 2 ? 2 : depth)
+    {
+        bool has_strings = false;
+
+        if (!sig) {
+            status_ = EINVAL;
+            return;
+        }
+
+        capacity_ = detail::leaf_count(sig, has_strings);
+        has_strings_ = has_strings;
+        for (frame& frm : slots_)
+            frm.entries.resize(capacity_);
+
+        status_ = vsd_subscribe_ctx(0, sig, &detail::deliver, this, 0, &handle_);
+    }
+
+    subscription(const subscription&) = delete;
+    subscription& operator=(const subscription&) = delete;
+
+    ~subscription()
+    {
+        if (handle_)
+            vsd_unsubscribe_handle(0, handle_);
+    }
+
+    // 0 if subscribed, or the error from vsd_subscribe_ctx().
+    // next() never completes on a failed subscription.
+    int status() const { return status_; }
+
+    // Number of updates dropped because the ring was full.
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    class next_awaiter {
+    public:
+        explicit next_awaiter(subscription& sub) : sub_(sub) {}
+
+        bool await_ready()
+        {
+            sub_.release();
+            return sub_.pending();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            sub_.node_.handle = handle;
+            sub_.waiter_.store(handle.address(), std::memory_order_seq_cst);
+
+            if (!sub_.pending())
+                return true;
+
+            // An update arrived before the handle was stored. Resume
+            // now, unless the receiving thread already took the
+            // handle and scheduled us.
+            return sub_.waiter_.exchange(nullptr, std::memory_order_seq_cst) == nullptr;
+        }
+
+        update await_resume() { return sub_.front(); }
+
+    private:
+        subscription& sub_;
+    };
+
+    // Wait for the next update. Releases the previous update.
+    next_awaiter next() { return next_awaiter(*this); }
+
+private:
+    friend void detail::deliver(vsd_context_t* ctx, vsd_signal_list_t* lst, void* user_data);
+
+    struct frame {
+        std::vector<entry> entries;
+        std::size_t count = 0;
+        std::vector<char> strings;
+    };
+
+    struct collector {
+        frame* frm;
+        std::size_t capacity;
+        std::size_t string_bytes;
+    };
+
+    static uint8_t count_strings(vsd_signal_node_t* node, void* user_data)
+    {
+        collector* col = static_cast<collector*>(user_data);
+        vsd_data_u val;
+
+        if (node->data->data_type == VSS_STRING && !vsd_get_value(node->data, &val))
+            col->string_bytes += val.s.len;
+
+        return 1;
+    }
+
+    static uint8_t collect(vsd_signal_node_t* node, void* user_data)
+    {
+        collector* col = static_cast<collector*>(user_data);
+        frame* frm = col->frm;
+
+        if (frm->count == col->capacity)
+            return 0;
+
+        entry& ent = frm->entries[frm->count];
+        ent.signal = node->data;
+        ent.timestamp = 0;
+        if (vsd_get_value_ts(node->data, &ent.value, &ent.timestamp))
+            return 1;
+
+        // Strings in the value store change with the next frame.
+        // Copy them. Room was reserved by count_strings().
+        if (node->data->data_type == VSS_STRING) {
+            char* data = frm->strings.data() + col->string_bytes;
+
+            std::memcpy(data, ent.value.s.data, ent.value.s.len);
+            ent.value.s.data = data;
+            ent.value.s.allocated = 0;
+            col->string_bytes += ent.value.s.len;
+        }
+
+        frm->count++;
+        return 1;
+    }
+
+    // Called on the thread receiving frames.
+    void push(vsd_signal_list_t* lst)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        collector col = { nullptr, capacity_, 0 };
+        void* waiter = nullptr;
+
+        if (head - tail_.load(std::memory_order_acquire) == slots_.size()) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        col.frm = &slots_[head % slots_.size()];
+        col.frm->count = 0;
+
+        // Only grows when longer strings than before are received.
+        if (has_strings_) {
+            vsd_signal_list_for_each(lst, count_strings, &col);
+            if (col.frm->strings.size() < col.string_bytes)
+                col.frm->strings.resize(col.string_bytes);
+            col.string_bytes = 0;
+        }
+
+        vsd_signal_list_for_each(lst, collect, &col);
+        head_.store(head + 1, std::memory_order_seq_cst);
+
+        waiter = waiter_.exchange(nullptr, std::memory_order_seq_cst);
+        if (waiter)
+            exec_.schedule(&node_);
+    }
+
+    bool pending() const
+    {
+        return head_.load(std::memory_order_seq_cst) != tail_.load(std::memory_order_relaxed);
+    }
+
+    // Hand the update being read back to the ring.
+    void release()
+    {
+        if (!holding_)
+            return;
+
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        holding_ = false;
+    }
+
+    update front()
+    {
+        const frame& frm = slots_[tail_.load(std::memory_order_relaxed) % slots_.size()];
+
+        holding_ = true;
+        return update(frm.entries.data(), frm.entries.data() + frm.count);
+    }
+
+    executor& exec_;
+    std::vector<frame> slots_;
+    std::size_t capacity_ = 0;
+    bool has_strings_ = false;
+    vsd_subscription_t handle_ = 0;
+    int status_ = 0;
+
+    // Written by the receiving thread.
+    std::atomic<uint64_t> head_{0};
+    std::atomic<uint64_t> dropped_{0};
+    // Written by the executor thread.
+    std::atomic<uint64_t> tail_{0};
+    bool holding_ = false;
+
+    // Address of the coroutine suspended in next(), if any.
+    std::atomic<void*> waiter_{nullptr};
+    ready_node node_;
+};
+
+inline void detail::deliver(vsd_context_t* ctx, vsd_signal_list_t* lst, void* user_data)
+{
+    static_cast<subscription*>(user_data)->push(lst);
+}
+
+} // namespace coro
+} // namespace vsd
+
+#endif // __VSD_CORO_HPP__
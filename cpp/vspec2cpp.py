@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2018, Jaguar Land Rover
+# This program is licensed under the terms and conditions of the
+# Mozilla Public License, version 2.0.  The full text of the
+# Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+#
+# Generate vss.hpp, the typed C++ signal and branch types used with
+# vsd.hpp, from a Vehicle Signal Specification.
+#
+# Takes the same arguments as vspec2c.py from the VSS tools directory,
+# and needs its vspec module:
+#
+#   vspec2cpp.py -I spec_dir -i:spec_dir/VehicleSignalSpecification.id \
+#       spec_dir/VehicleSignalSpecification.vspec vss.hpp
+#
+# Signal indices are assigned depth first, in specification order, as
+# done by vspec2c.py, so that they match the vss.h loaded at run time.
+# Call vss::verify() at startup to check that they do.
+#
+import getopt
+import sys
+
+import vspec
+
+# VSS data type -> (vss_data_type_e, encoded size excluding signature)
+DATA_TYPES = {
+    "int8": ("VSS_INT8", 1),
+    "uint8": ("VSS_UINT8", 1),
+    "int16": ("VSS_INT16", 2),
+    "uint16": ("VSS_UINT16", 2),
+    "int32": ("VSS_INT32", 4),
+    "uint32": ("VSS_UINT32", 4),
+    "float": ("VSS_FLOAT", 4),
+    "double": ("VSS_DOUBLE", 8),
+    "boolean": ("VSS_BOOLEAN", 1),
+    "string": ("VSS_STRING", 2),
+}
+
+SIGNATURE_SIZE = 4
+
+CPP_KEYWORDS = {
+    "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case",
+    "catch", "char", "class", "const", "constexpr", "continue", "default",
+    "delete", "do", "double", "else", "enum", "explicit", "export",
+    "extern", "false", "float", "for", "friend", "goto", "if", "inline",
+    "int", "long", "mutable", "namespace", "new", "noexcept", "not",
+    "nullptr", "operator", "or", "private", "protected", "public",
+    "register", "return", "short", "signed", "sizeof", "static",
+    "struct", "switch", "template", "this", "throw", "true", "try",
+    "typedef", "typename", "union", "unsigned", "using", "virtual",
+    "void", "volatile", "while", "xor",
+}
+
+
+def usage():
+    print("Usage: {} [-I include_dir] ... [-i prefix:id_file] vspec_file output_file".format(sys.argv[0]))
+    print("  -I include_dir       Add include_dir to the vspec include search path.")
+    print("  -i prefix:id_file    Accepted for compatibility with vspec2c.py. Signal ids")
+    print("                       are not used by the generated types.")
+    print("  vspec_file           The VSS specification to generate types for.")
+    print("  output_file          The header file to write.")
+    sys.exit(255)
+
+
+def identifier(name, enclosing):
+    # Make a VSS node name usable as a C++ type name.
+    res = "".join(c if c.isalnum() or c == "_" else "_" for c in name)
+
+    if res[0].isdigit() or res in CPP_KEYWORDS:
+        res = "_" + res
+
+    # A nested type cannot have the name of the type enclosing it.
+    if res == enclosing:
+        res += "_"
+
+    return res
+
+
+class Generator:
+    def __init__(self):
+        self.index = 0
+        self.table = []
+        self.lines = []
+
+    def emit(self, depth, line):
+        self.lines.append("    " * depth + line if line else "")
+
+    # Generate the type for node and everything below it.
+    # Returns (encoded_size, fixed_size) of node.
+    def node(self, name, node, path, depth, enclosing):
+        index = self.index
+        self.index += 1
+        self.table.append((index, path))
+        type_name = identifier(name, enclosing)
+
+        if "children" in node and node["children"] is not None:
+            # Emit children first into a separate buffer, since the
+            # branch declaration needs their total size.
+            outer = self.lines
+            self.lines = []
+            size = 0
+            fixed = True
+
+            for child_name, child in node["children"].items():
+                child_size, child_fixed = self.node(child_name, child,
+                                                    path + "." + child_name,
+                                                    depth + 1, type_name)
+                size += child_size
+                fixed = fixed and child_fixed
+
+            children = self.lines
+            self.lines = outer
+
+            while children and not children[-1]:
+                children.pop()
+
+            self.emit(depth, "struct {} : vsd::branch<{}, {}, {}> {{".format(
+                type_name, index, size, "true" if fixed else "false"))
+            self.emit(depth + 1, 'static constexpr const char* path = "{}";'.format(path))
+            self.lines += children
+            self.emit(depth, "};")
+            self.emit(0, "")
+            return (size, fixed)
+
+        datatype = node.get("datatype")
+        if datatype not in DATA_TYPES:
+            self.emit(depth, "// {}: data type {} not supported by VSD.".format(path, datatype))
+            self.emit(0, "")
+            return (0, False)
+
+        (vss_type, size) = DATA_TYPES[datatype]
+        self.emit(depth, "struct {} : vsd::signal<{}, {}> {{".format(type_name, index, vss_type))
+        self.emit(depth + 1, 'static constexpr const char* path = "{}";'.format(path))
+        self.emit(depth, "};")
+        self.emit(0, "")
+        return (SIGNATURE_SIZE + size, datatype != "string")
+
+    def header(self, vspec_file, tree):
+        for name, node in tree.items():
+            self.node(name, node, name, 1, "")
+
+        res = [
+            "// Generated by vspec2cpp.py from {}".format(vspec_file),
+            "// Do not edit.",
+            "//",
+            "",
+            "#ifndef __VSS_HPP__",
+            "#define __VSS_HPP__",
+            "",
+            '#include "vsd.hpp"',
+            "",
+            "namespace vss {",
+            "",
+        ]
+        res += self.lines
+        res.append("    // Path of every signal and branch, by index.")
+        res.append("    inline constexpr vsd::signal_entry signal_table[] = {")
+        for (index, path) in self.table:
+            res.append('        {{ {}, "{}" }},'.format(index, path))
+        res.append("    };")
+        res.append("")
+        res.append("    inline constexpr int signal_count = {};".format(len(self.table)))
+        res.append("")
+        res.append("    // Return -1 if the loaded specification matches this header,")
+        res.append("    // or the index of the first mismatching signal.")
+        res.append("    inline int verify() { return vsd::verify(signal_table, signal_count); }")
+        res.append("")
+        res.append("} // namespace vss")
+        res.append("")
+        res.append("#endif // __VSS_HPP__")
+        return "\n".join(res) + "\n"
+
+
+if __name__ == "__main__":
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "I:i:")
+    except getopt.GetoptError:
+        usage()
+
+    include_dirs = ["."]
+    for o, a in opts:
+        if o == "-I":
+            include_dirs.append(a)
+        elif o == "-i":
+            pass
+        else:
+            usage()
+
+    if len(args) != 2:
+        usage()
+
+    try:
+        tree = vspec.load(args[0], include_dirs)
+    except vspec.VSpecError as e:
+        print("Error: {}".format(e))
+        sys.exit(255)
+
+    with open(args[1], "w") as out:
+        out.write(Generator().header(args[0], tree))
@@ -19,8 +19,9 @@
 #include <getopt.h>
 void usage(char* prog)
 {
-        fprintf(stderr, "Usage: %s-p <signal->path> -s:<signal-path:value> ...\n", prog);
+        fprintf(stderr, "Usage: %s-p <signal->path> [-c <msec>] -s:<signal-path:value> ...\n", prog);
         fprintf(stderr, "  -p <signal->path>        The signal tree to publish\n");
+        fprintf(stderr, "  -c <msec>                Publish cyclically every <msec> milliseconds\n");
         fprintf(stderr, "  <signal-path:value> ...  Signal-value pair to set before publish\n\n");
         fprintf(stderr, "Example: %s -p Vehicle.Drivetrain.InternalCombustionEngine \\\n",
                 prog);
@@ -41,12 +42,15 @@ int main(int argc, char* argv[])
     char sig_path[1024];
     char *val;
     msec_timestamp_t stop_ts = 0;
+    uint32_t period = 0;
+    vsd_schedule_t* sched = 0;
+    int timeout = 0;
 
     if (argc == 1)
         usage(argv[0]);
 
 
-    while ((opt = getopt(argc, argv, "s:p:")) != -1) {
+    while ((opt = getopt(argc, argv, "s:p:c:")) != -1) {
         switch (opt) {
 
         case 's':
@@ -74,6 +78,10 @@ int main(int argc, char* argv[])
             }
             break;
 
+        case 'c':
+            period = (uint32_t) strtoul(optarg, 0, 10);
+            break;
+
         default: /* '?' */
             break;
         }
@@ -92,6 +100,20 @@ int main(int argc, char* argv[])
     while(dstc_msec_monotonic_timestamp() < stop_ts)
         dstc_process_events(stop_ts - dstc_msec_monotonic_timestamp());
 
+    // Let VSD publish the signal tree every period milliseconds.
+    if (period) {
+        res = vsd_schedule_publish(0, sig, period, VSD_PHASE_AUTO, &sched);
+        if (res) {
+            printf("Cannot schedule signal %s %s\n", argv[2], strerror(res));
+            exit(255);
+        }
+
+        while(1) {
+            vsd_process_timers(0, &timeout);
+            dstc_process_events(timeout);
+        }
+    }
+
     // Send publish command to update
     res = vsd_publish(sig);
 
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2018, Jaguar Land Rover
+# This program is licensed under the terms and conditions of the
+# Mozilla Public License, version 2.0.  The full text of the
+# Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+#
+# Generate specialized encoders and decoders for selected branches of
+# a Vehicle Signal Specification. See vsd_register_codec() in
+# vehicle_signal_distribution.h.
+#
+# Takes the same arguments as vspec2c.py, plus one -b option for each
+# branch to generate a codec for:
+#
+#   vspec2codec.py -I spec_dir -i:spec_dir/VehicleSignalSpecification.id \
+#       -b Vehicle.Chassis -b Vehicle.Powertrain \
+#       spec_dir/VehicleSignalSpecification.vspec vsd_codecs.c
+#
+# The generated file defines vsd_register_generated_codecs(), or the
+# function given with -n, which registers all generated codecs.
+#
+import getopt
+import sys
+
+# VSS data type -> (vss_data_type_e, vsd_data_u member, encoded size)
+DATA_TYPES = {
+    "int8": ("VSS_INT8", "i8", 1),
+    "uint8": ("VSS_UINT8", "u8", 1),
+    "int16": ("VSS_INT16", "i16", 2),
+    "uint16": ("VSS_UINT16", "u16", 2),
+    "int32": ("VSS_INT32", "i32", 4),
+    "uint32": ("VSS_UINT32", "u32", 4),
+    "float": ("VSS_FLOAT", "f", 4),
+    "double": ("VSS_DOUBLE", "d", 8),
+    "boolean": ("VSS_BOOLEAN", "b", 1),
+}
+
+SIGNATURE_SIZE = 4
+
+
+class CodecError(Exception):
+    pass
+
+
+def usage():
+    print("Usage: {} [-I include_dir] ... [-i prefix:id_file] -b branch ... [-n function] vspec_file output_file".format(sys.argv[0]))
+    print("  -I include_dir       Add include_dir to the vspec include search path.")
+    print("  -i prefix:id_file    Accepted for compatibility with vspec2c.py.")
+    print("  -b branch            Generate a codec for branch, such as Vehicle.Chassis.")
+    print("  -n function          Name of the generated registration function.")
+    print("                       Default vsd_register_generated_codecs")
+    print("  vspec_file           The VSS specification to generate codecs from.")
+    print("  output_file          The C file to write.")
+    sys.exit(255)
+
+
+def find_node(tree, path):
+    nodes = tree
+    node = None
+
+    for name in path.split("."):
+        if nodes is None or name not in nodes:
+            raise CodecError("Branch {} not found".format(path))
+        node = nodes[name]
+        nodes = node.get("children")
+
+    if node.get("children") is None:
+        raise CodecError("{} is not a branch".format(path))
+
+    return node
+
+
+# Return (path, data type) of all leaves under node, depth first.
+def leaves(node, path):
+    if node.get("children") is None:
+        return [(path, node.get("datatype"))]
+
+    res = []
+    for name, child in node["children"].items():
+        res += leaves(child, path + "." + name)
+
+    return res
+
+
+def codec(path, node):
+    name = "_" + path.replace(".", "_")
+    leaf_list = leaves(node, path)
+    types = []
+    encode = []
+    check = []
+    decode = []
+    offset = 0
+
+    for ind, (leaf_path, datatype) in enumerate(leaf_list):
+        if datatype not in DATA_TYPES:
+            raise CodecError("{}: {} has data type {}, which has no fixed size".format(
+                path, leaf_path, datatype))
+
+        (vss_type, member, size) = DATA_TYPES[datatype]
+        types.append("    {}, // {}".format(vss_type, leaf_path))
+        encode.append("    memcpy(buf + {}, &s[{}], {});".format(offset, ind, SIGNATURE_SIZE))
+        check.append("    memcpy(&sig, buf + {}, {}); diff |= sig ^ s[{}];".format(offset, SIGNATURE_SIZE, ind))
+        offset += SIGNATURE_SIZE
+        encode.append("    memcpy(buf + {}, &v[{}]->{}, {});".format(offset, ind, member, size))
+        decode.append("    memcpy(&v[{}]->{}, buf + {}, {});".format(ind, member, offset, size))
+        offset += size
+
+    res = ["//", "// {}: {} signals, {} bytes".format(path, len(leaf_list), offset), "//", ""]
+    res.append("static const vss_data_type_e {}_types[{}] = {{".format(name, len(leaf_list)))
+    res += types
+    res.append("};")
+    res.append("")
+    res.append("static void {}_encode(const vsd_data_u* const* v, const uint32_t* s, uint8_t* buf)".format(name))
+    res.append("{")
+    res += encode
+    res.append("}")
+    res.append("")
+    res.append("static int {}_decode(vsd_data_u* const* v, const uint32_t* s, const uint8_t* buf)".format(name))
+    res.append("{")
+    res.append("    uint32_t diff = 0;")
+    res.append("    uint32_t sig = 0;")
+    res.append("")
+    res += check
+    res.append("")
+    res.append("    if (diff)")
+    res.append("        return 1;")
+    res.append("")
+    res += decode
+    res.append("    return 0;")
+    res.append("}")
+    res.append("")
+    res.append("static const vsd_codec_t {}_codec = {{".format(name))
+    res.append("    .leaf_count = {},".format(len(leaf_list)))
+    res.append("    .data_types = {}_types,".format(name))
+    res.append("    .encoded_size = {},".format(offset))
+    res.append("    .encode = {}_encode,".format(name))
+    res.append("    .decode = {}_decode".format(name))
+    res.append("};")
+    res.append("")
+    return (name + "_codec", res)
+
+
+# Generate the C source of codecs for branch_paths in tree.
+def generate(tree, branch_paths, source, function):
+    res = [
+        "// Generated by vspec2codec.py from {}".format(source),
+        "// Do not edit.",
+        "//",
+        "",
+        "#include <string.h>",
+        '#include "vehicle_signal_distribution.h"',
+        "",
+    ]
+    codecs = []
+
+    for path in branch_paths:
+        (name, lines) = codec(path, find_node(tree, path))
+        codecs.append((path, name))
+        res += lines
+
+    res.append("// Register the codecs of all generated branches.")
+    res.append("// Returns the first error from vsd_find_signal_by_path() or")
+    res.append("// vsd_register_codec(), or 0 if all codecs were registered.")
+    res.append("int {}(vsd_context_t* ctx)".format(function))
+    res.append("{")
+    res.append("    vss_signal_t* sig = 0;")
+    res.append("    int res = 0;")
+    for (path, name) in codecs:
+        res.append("")
+        res.append('    res = vsd_find_signal_by_path(ctx, "{}", &sig);'.format(path))
+        res.append("    if (!res)")
+        res.append("        res = vsd_register_codec(ctx, sig, &{});".format(name))
+        res.append("    if (res)")
+        res.append("        return res;")
+    res.append("")
+    res.append("    return 0;")
+    res.append("}")
+    return "\n".join(res) + "\n"
+
+
+if __name__ == "__main__":
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "I:i:b:n:")
+    except getopt.GetoptError:
+        usage()
+
+    include_dirs = ["."]
+    branches = []
+    function = "vsd_register_generated_codecs"
+    for o, a in opts:
+        if o == "-I":
+            include_dirs.append(a)
+        elif o == "-i":
+            pass
+        elif o == "-b":
+            branches.append(a)
+        elif o == "-n":
+            function = a
+        else:
+            usage()
+
+    if len(args) != 2 or not branches:
+        usage()
+
+    import vspec
+
+    try:
+        tree = vspec.load(args[0], include_dirs)
+        output = generate(tree, branches, args[0], function)
+    except (vspec.VSpecError, CodecError) as e:
+        print("Error: {}".format(e))
+        sys.exit(255)
+
+    with open(args[1], "w") as out:
+        out.write(output)
@@ -9,6 +9,7 @@
 #ifndef __VEHICLE_SIGNAL_DISTRIBUTION_H__
 #define __VEHICLE_SIGNAL_DISTRIBUTION_H__
 #include <stdint.h>
+#include <time.h>
 #include <rmc_list.h>
 
 // From
@@ -53,6 +54,99 @@ typedef vsd_subscriber_node vsd_subscriber_node_t;
 extern int vsd_get_value(struct _vss_signal_t* sig,
                          vsd_data_u *result);
 
+// Get the current value of a signal together with its source timestamp.
+// The timestamp is in nanoseconds of the clock given to
+// vsd_set_timestamp_mode() by the node that set the value.
+// 0 is returned if the value carries no timestamp.
+extern int vsd_get_value_ts(struct _vss_signal_t* sig,
+                            vsd_data_u *result,
+                            uint64_t* timestamp);
+
+// Timestamp modes for vsd_set_timestamp_mode()
+
+// No timestamps are captured or transmitted. Default.
+#define VSD_TIMESTAMP_NONE 0
+
+// Each published frame carries the time of the publish.
+// Receivers use it as the timestamp of all signals in the frame.
+#define VSD_TIMESTAMP_FRAME 1
+
+// Each published frame carries the time of the publish, and each
+// signal in the frame carries the time it was set as a
+// variable length delta to the frame time.
+#define VSD_TIMESTAMP_SIGNAL 2
+
+// Capture a timestamp from clock each time a signal value is set, and
+// transmit timestamps as specified by mode.
+//
+// clock is a clock accepted by clock_gettime(3).  CLOCK_MONOTONIC
+// is only comparable between processes on the same host. Use
+// CLOCK_REALTIME or CLOCK_TAI on PTP synchronized hosts, or a PTP
+// hardware clock opened with FD_TO_CLOCKID(), to compare timestamps
+// across the network.
+//
+// All nodes should use the same clock.
+//
+// Return:
+//  0 - OK
+//  EINVAL - mode or clock is invalid.
+extern int vsd_set_timestamp_mode(vsd_context_t* ctx, int mode, clockid_t clock);
+
+// Validation policies for vsd_set_validation()
+
+// Values are not checked. Default.
+#define VSD_VALIDATE_NONE 0
+
+// Numbers outside the min/max of their signal are clamped to the
+// nearest bound. Strings and numbers that are not among the
+// enumerated values of their signal are accepted as is.
+#define VSD_VALIDATE_PERMISSIVE 1
+
+// Values outside the min/max, or not among the enumerated values, of
+// their signal are rejected. Setters return an error and leave the
+// signal unchanged. Received values are dropped and not delivered to
+// subscribers.
+#define VSD_VALIDATE_STRICT 2
+
+// Check all values set locally or received from the network against
+// the min, max and enum constraints of the specification.
+//
+// The constraints are compiled into per-signal tables on the first
+// call with a policy other than VSD_VALIDATE_NONE. Specifications do
+// not tell a zero bound from a missing one, so a min or max of 0 is
+// taken as not given, unless min is 0 and max is not.
+//
+// Values rejected or clamped are counted in invalid_values of the
+// signal statistics.
+//
+// Return:
+//  0 - OK
+//  EINVAL - policy is invalid.
+extern int vsd_set_validation(vsd_context_t* ctx, int policy);
+
+// Leave received frames undecoded until their values are needed.
+//
+// With lazy decoding enabled, a frame is only decoded on arrival if a
+// subscriber on its signal, or on one of its ancestors, is to be
+// handed the frame. Other frames are copied aside, replacing any
+// earlier frame held for the same signal, and decoded the first time
+// vsd_get_value() is called for a signal in them, or when a branch
+// holding them is published. Nodes that only use a small part of the
+// specification then do not pay to decode all traffic.
+//
+// Lazy decoding is not used while pattern or conflating
+// subscriptions exist, or while this process owns a value table.
+// Rate limited subscriptions only need frames once their period
+// has passed, see vsd_subscribe_rate_limited().
+//
+// Return:
+//  0 - OK
+extern int vsd_set_lazy_decode(vsd_context_t* ctx, int enable);
+
+// Return the current time, in nanoseconds, of the clock given to
+// vsd_set_timestamp_mode(). Use to compute the age of received values.
+extern uint64_t vsd_timestamp_now(vsd_context_t* ctx);
+
 // Convert an arbitrary string to a vsd_data_u element.
 extern int vsd_string_to_data(enum _vss_data_type_e type,
                               char* str,
@@ -62,6 +156,38 @@ extern int vsd_string_to_data(enum _vss_data_type_e type,
 // Do not modify the content of the returned string.
 extern const char* vsd_signal_to_path_static(struct _vss_signal_t* sig);
 
+// Default maximum number of paths held by the path cache.
+#define VSD_PATH_CACHE_SIZE 4096
+
+// Find the signal with the given dot-separated path.
+//
+// Lookups, including those made by the vsd_set_value_by_path_*()
+// setters, are served from a hash table of recently used paths. Only
+// paths not found in it are resolved by walking the signal tree.
+//
+// The returned signal can be kept and passed to the
+// vsd_set_value_by_signal_*() setters, to set the same signal
+// repeatedly without any path lookup at all.
+//
+// Return:
+//  0 - Signal found and stored in result.
+//  ENOENT - Signal with the given path name cannot be found.
+//  ENOTDIR - One or more components in the path exist but are not branches.
+//  EINVAL - Path or result is nil
+extern int vsd_find_signal_by_path(vsd_context_t* ctx,
+                                   const char* path,
+                                   struct _vss_signal_t** result);
+
+// Set the maximum number of paths held by the path cache.
+// Once full, the least recently added path is evicted for each new
+// one. Set to 0 to disable the cache and release its memory. Set to
+// the number of signals in the specification to never evict.
+//
+// Each entry uses roughly 100 bytes plus the length of its path.
+// A cache much smaller than the set of paths in use is slower than
+// no cache at all.
+extern int vsd_set_path_cache_size(vsd_context_t* ctx, uint32_t max_entries);
+
 // Set the boolean value of a signal identified by its pointer
 //
 // Sig is returned by vsd_find_signal_by_id() or vsd_find_signal_by_path().
@@ -72,9 +198,10 @@ extern const char* vsd_signal_to_path_static(struct _vss_signal_t* sig);
 //  EINVAL - Sig is nil
 //  EINVAL - Sig is not an uint8_t
 //
-// FIXME: Validate that val is legal if sig is enumerated.
-// FIXME: Validate that val is not greater than maximum allowed value, if specified.
-// FIXME: Validate that val is not less than minimum allowed value, if specified.
+//  ERANGE - Val is outside the min/max of sig (VSD_VALIDATE_STRICT).
+//  EINVAL - Val is not one of the enumerated values of sig (VSD_VALIDATE_STRICT).
+//
+// See vsd_set_validation() for how values are checked.
 
 extern int vsd_set_value_by_signal_boolean(vsd_context_t* context, struct _vss_signal_t* sig, uint8_t val);
 
@@ -89,7 +216,7 @@ extern int vsd_set_value_by_signal_boolean(vsd_context_t* context, struct _vss_s
 //  ENOTDIR - One or more components in the path exist but are not branches.
 //  EINVAL - Path is nil
 //  EINVAL - Signal is not an uint8_t
-extern int vsd_set_value_by_path_boolean(vsd_context_t* context, char* path, uint8_t val);
+extern int vsd_set_value_by_path_boolean(vsd_context_t* context, const char* path, uint8_t val);
 
 // Set the boolean value of a signal identified by its numerical signal ID.
 // Signal ID is the unique ID assigned to the signal by the second field
@@ -103,47 +230,113 @@ extern int vsd_set_value_by_path_boolean(vsd_context_t* context, char* path, uin
 extern int vsd_set_value_by_index_boolean(vsd_context_t* context, int index, uint8_t val);
 
 extern int vsd_set_value_by_signal_int8(vsd_context_t* context, struct _vss_signal_t* sig, int8_t val);
-extern int vsd_set_value_by_path_int8(vsd_context_t* context, char* path, int8_t val);
+extern int vsd_set_value_by_path_int8(vsd_context_t* context, const char* path, int8_t val);
 extern int vsd_set_value_by_index_int8(vsd_context_t* context, int index, int8_t val);
 
 extern int vsd_set_value_by_signal_uint8(vsd_context_t* context, struct _vss_signal_t* sig, uint8_t val);
-extern int vsd_set_value_by_path_uint8(vsd_context_t* context, char* path, uint8_t val);
+extern int vsd_set_value_by_path_uint8(vsd_context_t* context, const char* path, uint8_t val);
 extern int vsd_set_value_by_index_uint8(vsd_context_t* context, int index, uint8_t val);
 
 extern int vsd_set_value_by_signal_int16(vsd_context_t* context, struct _vss_signal_t* sig, int16_t val);
-extern int vsd_set_value_by_path_int16(vsd_context_t* context, char* path, int16_t val);
+extern int vsd_set_value_by_path_int16(vsd_context_t* context, const char* path, int16_t val);
 extern int vsd_set_value_by_index_int16(vsd_context_t* context, int index, int16_t val);
 
 extern int vsd_set_value_by_signal_uint16(vsd_context_t* context, struct _vss_signal_t* sig, uint16_t val);
-extern int vsd_set_value_by_path_uint16(vsd_context_t* context, char* path, uint16_t val);
+extern int vsd_set_value_by_path_uint16(vsd_context_t* context, const char* path, uint16_t val);
 extern int vsd_set_value_by_index_uint16(vsd_context_t* context, int index, uint16_t val);
 
 extern int vsd_set_value_by_signal_int32(vsd_context_t* context, struct _vss_signal_t* sig, int32_t val);
-extern int vsd_set_value_by_path_int32(vsd_context_t* context, char* path, int32_t val);
+extern int vsd_set_value_by_path_int32(vsd_context_t* context, const char* path, int32_t val);
 extern int vsd_set_value_by_index_int32(vsd_context_t* context, int index, int32_t val);
 
 extern int vsd_set_value_by_signal_uint32(vsd_context_t* context, struct _vss_signal_t* sig, uint32_t val);
-extern int vsd_set_value_by_path_uint32(vsd_context_t* context, char* path, uint32_t val);
+extern int vsd_set_value_by_path_uint32(vsd_context_t* context, const char* path, uint32_t val);
 extern int vsd_set_value_by_index_uint32(vsd_context_t* context, int index, uint32_t val);
 
 extern int vsd_set_value_by_signal_float(vsd_context_t* context, struct _vss_signal_t* sig, float val);
-extern int vsd_set_value_by_path_float(vsd_context_t* context, char* path, float val);
+extern int vsd_set_value_by_path_float(vsd_context_t* context, const char* path, float val);
 extern int vsd_set_value_by_index_float(vsd_context_t* context, int index, float val);
 
 extern int vsd_set_value_by_signal_double(vsd_context_t* context, struct _vss_signal_t* sig, double val);
-extern int vsd_set_value_by_path_double(vsd_context_t* context, char* path, double val);
+extern int vsd_set_value_by_path_double(vsd_context_t* context, const char* path, double val);
 extern int vsd_set_value_by_index_double(vsd_context_t* context, int index, double val);
 
 extern int vsd_set_value_by_signal_string(vsd_context_t* context, struct _vss_signal_t* sig, char* data);
-extern int vsd_set_value_by_path_string(vsd_context_t* context, char* path, char* data);
+extern int vsd_set_value_by_path_string(vsd_context_t* context, const char* path, char* data);
 extern int vsd_set_value_by_index_string(vsd_context_t* context, int index, char* data);
 
 // Convert a literal string ("23.54") to the right type for the signal and
-// set its value to it.
+// set its value to it. Numbers are always parsed as in the C locale,
+// regardless of the locale of the process.
 extern int vsd_set_value_by_signal_convert(vsd_context_t* context, struct _vss_signal_t* sig, char* value);
-extern int vsd_set_value_by_path_convert(vsd_context_t* context, char* path, char* value);
+extern int vsd_set_value_by_path_convert(vsd_context_t* context, const char* path, char* value);
 extern int vsd_set_value_by_index_convert(vsd_context_t* context, int index, char* value);
 
+// Set signal values from len bytes of text with one path:value pair
+// per line, as given to vsd_pub_example -s:
+//
+//   Vehicle.Speed:87.5
+//   Vehicle.Cabin.Infotainment.Media.Played.Artist:Miles Davis
+//
+// Values are converted as by vsd_set_value_by_path_convert(). Text
+// need not be null terminated. Empty lines are skipped, and a \r
+// before a \n is ignored. Lines that cannot be applied are skipped.
+//
+// If applied is not nil, it is set to the number of values set.
+//
+// Return:
+//  0 - All lines applied.
+//  EINVAL - Text is nil, or a line has no colon.
+//  ENOENT - A path was not found.
+//  E2BIG - A string value is longer than 65534 bytes.
+// If several lines fail, the error of the first one is returned.
+extern int vsd_set_values_from_text(vsd_context_t* ctx,
+                                    const char* text,
+                                    size_t len,
+                                    uint32_t* applied);
+
+// A single value to set with vsd_set_values().
+typedef struct {
+    // Index of the signal to set, as given to vsd_set_value_by_index_*().
+    int index;
+
+    // Type of value. Must match the data type of the signal.
+    vss_data_type_e data_type;
+
+    // The value. Strings are given in s.data, with s.len including
+    // the null terminator, and are copied.
+    vsd_data_u value;
+} vsd_set_record_t;
+
+// Flags for vsd_set_values()
+// Set no value at all unless all records are valid.
+#define VSD_SET_ATOMIC 0x00000001
+
+// Set the values of count signals in one call.
+//
+// All records are validated in a single pass over the array and
+// stored with the same timestamp. Branches setup with
+// vsd_auto_publish() without a coalesce window are published once,
+// after all records have been stored, rather than once per value.
+//
+// Invalid records are skipped, unless VSD_SET_ATOMIC is given in
+// flags, in which case no value is set if any record is invalid.
+//
+// If applied is not nil, it is set to the number of values set.
+//
+// Return:
+//  0 - All records applied.
+//  EINVAL - Records is nil, or a record refers to a branch, has a
+//           data type other than that of its signal, or a nil string.
+//  ENOENT - A record has an index that is out of range.
+//  ERANGE, EINVAL - A value failed validation (VSD_VALIDATE_STRICT).
+// If several records fail, the error of the first one is returned.
+extern int vsd_set_values(vsd_context_t* ctx,
+                          const vsd_set_record_t* records,
+                          int count,
+                          uint32_t flags,
+                          uint32_t* applied);
+
 
 // Convert the provided string into a signal data element.
 // The string is converted according to the type specified in 'type'.
@@ -168,16 +361,692 @@ extern int vsd_publish(struct _vss_signal_t* sig);
 // If sig is a branch, any updates made to a signal under sig will be reported
 // to the callback.
 // If an unchanged value is received, it will still trigger a callback.
+// See VSD_SUBSCRIBE_ON_CHANGE to avoid that.
 //
 extern int vsd_subscribe(struct vsd_context* ctx,
                                  struct _vss_signal_t* sig,
                                  vsd_subscriber_cb_t callback);
 
+// Flags for vsd_subscribe_ext()
+
+// Request a snapshot of the current values of all signals under sig
+// from the network. See vsd_request_snapshot().
+#define VSD_SUBSCRIBE_SNAPSHOT 0x00000001
+
+// Deliver only the latest values, when the subscriber is ready for
+// them. Received frames update the signal values and mark the
+// signals under sig as pending, without invoking callback. Each
+// vsd_deliver_conflated() invokes callback once with all pending
+// signals, however many frames carried them.
+//
+// Unlike regular subscriptions, signals under sig are picked up from
+// any received frame, including frames published on a branch below
+// sig.
+#define VSD_SUBSCRIBE_CONFLATE 0x00000002
+
+// Only deliver signals whose value changed. Each received value is
+// compared with the one already stored, word by word for numbers and
+// by length and content for strings. Callback gets a list of the
+// changed signals only, and is not invoked at all for frames where
+// nothing changed.
+//
+// The first value received for a signal, and any value received
+// after the signal was set locally, counts as changed.
+#define VSD_SUBSCRIBE_ON_CHANGE 0x00000004
+
+// Subscribe to signal updates in sig, with flags modifying
+// the subscription. See VSD_SUBSCRIBE_* above.
+//
+// VSD_SUBSCRIBE_CONFLATE and VSD_SUBSCRIBE_ON_CHANGE cannot be
+// combined. EINVAL is returned for the combination, and for any flag
+// not defined above.
+extern int vsd_subscribe_ext(struct vsd_context* ctx,
+                             struct _vss_signal_t* sig,
+                             vsd_subscriber_cb_t callback,
+                             uint32_t flags);
+
+// Invoke the callbacks of VSD_SUBSCRIBE_CONFLATE subscriptions with
+// all signals received since their previous delivery. Subscriptions
+// with nothing pending are skipped. If callback is not nil, only the
+// subscriptions made with callback are delivered.
+//
+// A dashboard or logger calls this at the rate it can keep up with,
+// typically once per redraw, and its CPU use is then bounded by that
+// rate rather than by the rate of incoming frames.
+//
+// Return:
+//  0 - Delivered, or nothing to deliver.
+//  ESRCH - Callback is not nil and has no conflating subscriptions.
+extern int vsd_deliver_conflated(vsd_context_t* ctx, vsd_subscriber_cb_t callback);
+
+// Subscribe to signal updates in sig, delivered at most once every
+// period_msec milliseconds, such as 100 for 10 Hz.
+//
+// The subscription conflates as with VSD_SUBSCRIBE_CONFLATE, but is
+// delivered by vsd_process_timers() instead of vsd_deliver_conflated().
+// The first frame after a quiet period is delivered at once. Frames
+// received within period_msec of a delivery only mark their signals
+// as pending, and are delivered together, with their latest values,
+// once the period has passed.
+//
+// With vsd_set_lazy_decode() enabled, frames received while the
+// subscription waits out its period are not decoded at all, unless
+// another subscriber needs them. The next delivery then carries all
+// signals of the subscription.
+//
+// The period is included in interest announcements, letting
+// publishers using VSD_INTEREST_FILTER send a branch no more often
+// than the nodes subscribing to it ask for.
+//
+// Remove with vsd_unsubscribe().
+//
+// Return:
+//  0 - OK
+//  EINVAL - sig or callback is nil, or period_msec is 0.
+//  ENOENT - There are no signals under sig.
+extern int vsd_subscribe_rate_limited(struct vsd_context* ctx,
+                                      struct _vss_signal_t* sig,
+                                      vsd_subscriber_cb_t callback,
+                                      uint32_t period_msec);
+
+// Request the current values of all signals under sig from the network.
+// Any node that holds a value for one or more signals under sig
+// will reply with a single frame carrying those values.
+// Replies are decoded into the local signal tree as they arrive, for
+// VSD_SNAPSHOT_WINDOW_MSEC after the request. Once the window closes,
+// vsd_process_timers() invokes callback once with all signals carried
+// by any reply, so that nodes owning different subtrees together
+// make up the snapshot. Later replies are ignored.
+//
+// If no node holds any values, callback is never invoked.
+//
+#define VSD_SNAPSHOT_WINDOW_MSEC 500
+
+extern int vsd_request_snapshot(struct vsd_context* ctx,
+                                struct _vss_signal_t* sig,
+                                vsd_subscriber_cb_t callback);
+
 // Unsubscribe to a signal previously subscribed to
 extern int vsd_unsubscribe(struct vsd_context* ctx,
                                    struct _vss_signal_t* sig,
                                    vsd_subscriber_cb_t callback);
 
+// Subscriber callback carrying the user_data given to vsd_subscribe_ctx().
+// ctx is the context passed to vsd_receive_frame().
+typedef void (*vsd_subscriber_ctx_cb_t)(vsd_context_t* ctx,
+                                        vsd_signal_list_t* signals,
+                                        void* user_data);
+
+// Handle to a subscription made with vsd_subscribe_ctx().
+// Zero is never a valid handle.
+typedef uint64_t vsd_subscription_t;
+
+// Subscribe to signal updates in sig, as vsd_subscribe(), and have
+// user_data passed to callback with each delivery. The same callback
+// may be subscribed any number of times, to the same or different
+// signals, with different user_data.
+//
+// The handle of the new subscription is stored in *handle, and is
+// later given to vsd_unsubscribe_handle(). Both calls run in
+// constant time, regardless of the number of subscriptions.
+//
+// flags may be 0 or VSD_SUBSCRIBE_ON_CHANGE.
+//
+// Return values
+//  0      - Success
+//  EINVAL - sig, callback or handle is nil, or flags are not supported
+//
+extern int vsd_subscribe_ctx(struct vsd_context* ctx,
+                             struct _vss_signal_t* sig,
+                             vsd_subscriber_ctx_cb_t callback,
+                             void* user_data,
+                             uint32_t flags,
+                             vsd_subscription_t* handle);
+
+// Remove a subscription made with vsd_subscribe_ctx().
+// May be called from within a callback, including the callback of
+// the subscription being removed. The callback is not invoked again
+// once this call returns.
+//
+// Return values
+//  0     - Success
+//  ESRCH - handle does not refer to an active subscription
+//
+extern int vsd_unsubscribe_handle(struct vsd_context* ctx,
+                                  vsd_subscription_t handle);
+
+// Subscribe to all signals matching pattern.
+//
+// Pattern is a dot-separated path where a "*" component matches any
+// single signal or branch at that level, as in
+// "Vehicle.*.Wheel.*.Speed". A pattern ending in a branch matches
+// all signals under it.
+//
+// Unlike vsd_subscribe(), callback is invoked for any received frame
+// carrying one or more matching signals, regardless of which branch
+// it was published on. The full list of decoded signals is passed to
+// callback, and may include signals not matched by pattern.
+// Callback is invoked once per frame, however many signals match.
+//
+// Return:
+//  0 - Subscribed.
+//  ENOENT - Pattern matches no signals.
+//  EINVAL - Pattern or callback is nil.
+extern int vsd_subscribe_pattern(struct vsd_context* ctx,
+                                 const char* pattern,
+                                 vsd_subscriber_cb_t callback);
+
+// Subscribe to all signals matching any of the pattern_count
+// patterns, or plain paths, in patterns. See vsd_subscribe_pattern().
+// Callback is invoked at most once per received frame.
+extern int vsd_subscribe_paths(struct vsd_context* ctx,
+                               const char** patterns,
+                               int pattern_count,
+                               vsd_subscriber_cb_t callback);
+
+// Remove all pattern subscriptions made with callback.
+// May be called from within a callback.
+//
+// Return:
+//  0 - Unsubscribed.
+//  ESRCH - No pattern subscriptions use callback.
+extern int vsd_unsubscribe_pattern(struct vsd_context* ctx,
+                                   vsd_subscriber_cb_t callback);
+
+
+// Publish sig automatically whenever a signal under it is changed
+// through one of the vsd_set_value_by_*() calls.
+//
+// If coalesce_msec is 0, sig is published from within the set call.
+// Otherwise the first set arms a timer, and sig is published once
+// coalesce_msec milliseconds have passed, carrying all sets made in the
+// meantime as a single frame. The timer is run by vsd_process_timers().
+// A manual vsd_publish() of sig within the window cancels the automatic
+// publish.
+//
+// Calling vsd_auto_publish() on an already registered signal updates
+// coalesce_msec.
+//
+// Return:
+//  0 - Registered.
+//  EINVAL - sig is nil.
+extern int vsd_auto_publish(vsd_context_t* ctx,
+                            struct _vss_signal_t* sig,
+                            uint32_t coalesce_msec);
+
+// Stop publishing sig automatically.
+//
+// Return:
+//  0 - Registration removed.
+//  EINVAL - sig is nil.
+//  ESRCH - sig is not registered.
+extern int vsd_auto_publish_cancel(vsd_context_t* ctx, struct _vss_signal_t* sig);
+
+// Cyclic publishing.
+//
+// Branches or signals registered with vsd_schedule_publish() are
+// published every period_msec milliseconds by vsd_process_timers().
+// All schedules share a single timer wheel, giving O(1) registration,
+// removal, and firing regardless of the number of schedules.
+//
+typedef struct vsd_schedule vsd_schedule_t;
+
+// Let VSD pick a phase that spreads publishes evenly over the period
+// instead of having all schedules with the same period fire at once.
+#define VSD_PHASE_AUTO -1
+
+// Measured delay between the time a cyclic publish was due and the
+// time it was actually made.
+typedef struct _vsd_jitter_stats_t {
+    uint64_t count;     // Number of publishes made.
+    uint64_t missed;    // Number of publishes skipped since we fell behind.
+    int64_t min_usec;
+    int64_t max_usec;
+    int64_t sum_usec;   // Divide by count to get the mean.
+} vsd_jitter_stats_t;
+
+// Publish sig every period_msec milliseconds.
+// Publishes are made at monotonic times where (time - phase_msec) is a
+// multiple of period_msec. Set phase_msec to VSD_PHASE_AUTO to
+// stagger publishes automatically.
+//
+// Return:
+//  0 - Schedule created and returned in *result.
+//  EINVAL - sig or result is nil, or period_msec is 0.
+//  ERANGE - phase_msec is not within [0, period_msec).
+extern int vsd_schedule_publish(vsd_context_t* ctx,
+                                struct _vss_signal_t* sig,
+                                uint32_t period_msec,
+                                int32_t phase_msec,
+                                vsd_schedule_t** result);
+
+// Stop and free a schedule returned by vsd_schedule_publish().
+extern int vsd_unschedule_publish(vsd_context_t* ctx, vsd_schedule_t* sched);
+
+// Retrieve the jitter measured for a schedule.
+extern int vsd_get_schedule_jitter(vsd_schedule_t* sched, vsd_jitter_stats_t* result);
+
+// Run all timers that are due, including cyclic publishes.
+// If timeout_msec is not nil, it is set to the number of milliseconds
+// until this function needs to be called again, or -1 if there are no
+// timers armed. The value can be handed directly to dstc_process_events():
+//
+//    while(1) {
+//        vsd_process_timers(ctx, &timeout);
+//        dstc_process_events(timeout);
+//    }
+//
+extern int vsd_process_timers(vsd_context_t* ctx, int* timeout_msec);
+
+// Traffic statistics.
+//
+// VSD counts the traffic of each signal and branch. A leaf signal is
+// counted every time it is encoded or decoded, whether published on its
+// own or as part of a branch. A branch is counted every time it is
+// published or received as the root of a frame, with the byte counters
+// holding the total frame size.
+//
+typedef struct _vsd_signal_stats_t {
+    uint64_t published;          // Times encoded for transmission.
+    uint64_t received;           // Times decoded from the network.
+    uint64_t bytes_encoded;
+    uint64_t bytes_decoded;
+    uint64_t decode_errors;      // Frames rooted at this signal that failed to decode.
+    uint64_t oversize_frames;    // Publishes that did not fit in a frame.
+    uint64_t dropped_deliveries; // Received frames not delivered to subscribers.
+    uint64_t invalid_values;     // Values rejected or clamped by vsd_set_validation().
+    uint64_t lazy_frames;        // Frames rooted at this signal held undecoded. See vsd_set_lazy_decode().
+    uint64_t skipped_publishes;  // Publishes no node was interested in. See vsd_set_interest_mode().
+    uint64_t held_publishes;     // Publishes deferred to the rate asked for. See vsd_subscribe_rate_limited().
+} vsd_signal_stats_t;
+
+typedef struct _vsd_stats_entry_t {
+    struct _vss_signal_t* sig;
+    vsd_signal_stats_t stats;
+} vsd_stats_entry_t;
+
+// Sort keys for vsd_get_stats()
+#define VSD_STATS_FRAMES 0        // published + received
+#define VSD_STATS_PUBLISHED 1
+#define VSD_STATS_RECEIVED 2
+#define VSD_STATS_BYTES 3         // bytes_encoded + bytes_decoded
+#define VSD_STATS_BYTES_ENCODED 4
+#define VSD_STATS_BYTES_DECODED 5
+
+// Get the counters of a single signal or branch.
+extern int vsd_get_signal_stats(struct _vss_signal_t* sig, vsd_signal_stats_t* result);
+
+// Return the *count leaf signals with the highest counter value for
+// sort_key, in descending order. *count is set to the number of
+// entries returned in result.
+// Signals without traffic are not returned.
+extern int vsd_get_stats(vsd_context_t* ctx,
+                         int sort_key,
+                         vsd_stats_entry_t* result,
+                         int* count);
+
+// Return the number of received signatures that did not
+// match any signal in the loaded specification.
+extern uint64_t vsd_get_unknown_signature_count(vsd_context_t* ctx);
+
+// Clear all counters.
+extern void vsd_reset_stats(vsd_context_t* ctx);
+
+// Latency histograms.
+//
+// When the library is built with VSD_INSTRUMENTATION defined
+// (make INSTRUMENTATION=1), the time spent in each stage between
+// vsd_publish() and the subscriber callbacks is recorded in a histogram
+// per published branch or signal.  Without VSD_INSTRUMENTATION the
+// recording code is compiled out, and the calls below return ENOTSUP.
+//
+
+// Time spent encoding a frame in vsd_publish().
+#define VSD_LATENCY_ENCODE 0
+// Time from publish to receive, measured using the frame timestamp.
+// Requires vsd_set_timestamp_mode() with a clock shared with the publisher.
+#define VSD_LATENCY_TRANSPORT 1
+// Time spent decoding a received frame.
+#define VSD_LATENCY_DECODE 2
+// Time spent invoking all subscribers of a received frame.
+#define VSD_LATENCY_DISPATCH 3
+// Time spent in each individual subscriber callback.
+#define VSD_LATENCY_CALLBACK 4
+#define VSD_LATENCY_STAGE_COUNT 5
+
+// Each power of two is split into 2^VSD_HISTOGRAM_SUB_BITS buckets.
+// Values of 2^40 nsec (~18 minutes) and above go into the last bucket.
+#define VSD_HISTOGRAM_SUB_BITS 3
+#define VSD_HISTOGRAM_BUCKETS ((40 - VSD_HISTOGRAM_SUB_BITS + 2) << VSD_HISTOGRAM_SUB_BITS)
+
+typedef struct _vsd_histogram_t {
+    uint64_t count;
+    uint64_t sum_nsec;
+    uint64_t min_nsec;
+    uint64_t max_nsec;
+    uint64_t buckets[VSD_HISTOGRAM_BUCKETS];
+} vsd_histogram_t;
+
+// Copy the histogram for the given VSD_LATENCY_* stage of sig into result.
+//
+// Return:
+//  0 - OK. An empty histogram is returned if nothing has been recorded.
+//  EINVAL - Invalid sig or stage.
+//  ENOTSUP - Library built without VSD_INSTRUMENTATION.
+extern int vsd_get_latency_histogram(struct _vss_signal_t* sig,
+                                     int stage,
+                                     vsd_histogram_t* result);
+
+// Clear all histograms of sig.
+extern int vsd_reset_latency_histograms(struct _vss_signal_t* sig);
+
+// Return the smallest value, in nsec, counted by the given bucket.
+extern uint64_t vsd_histogram_bucket_lower(int bucket);
+
+// Return the value, in nsec, at the given percentile (0-100) of hist.
+extern uint64_t vsd_histogram_percentile(const vsd_histogram_t* hist, double percentile);
+
+// Transports.
+//
+// Frames encoded by vsd_publish() are handed to a transport for
+// delivery.  The default transport multicasts frames to all nodes
+// through DSTC.  A transport delivers a frame on the receiving side by
+// calling vsd_receive_frame(), which decodes it and invokes subscribers.
+//
+typedef struct _vsd_transport_t vsd_transport_t;
+
+struct _vsd_transport_t {
+    const char* name;
+
+    // Send the encoded frame in data, rooted at the signal or branch
+    // with the given signature. data is only valid during the call.
+    // Returns 0 or an errno value, which is returned by vsd_publish().
+    int (*transmit)(vsd_transport_t* transport,
+                    uint32_t signature,
+                    const uint8_t* data,
+                    uint16_t len);
+
+    void* user_data;
+};
+
+// Send all subsequent publishes through transport.
+// Set transport to nil to restore the default DSTC transport.
+extern int vsd_set_transport(vsd_context_t* ctx, vsd_transport_t* transport);
+
+// Return the transport currently in use.
+extern vsd_transport_t* vsd_get_transport(vsd_context_t* ctx);
+
+// Decode a frame received by a transport into the local signal tree
+// and invoke all subscribers of the frame root and its ancestors.
+//
+// Return:
+//  0 - Frame delivered.
+//  ENOENT - signature does not match any local signal.
+//  ENOMEM - Frame is truncated.
+//  EPROTO - Frame version mismatch.
+extern int vsd_receive_frame(vsd_context_t* ctx,
+                             uint32_t signature,
+                             const uint8_t* data,
+                             uint16_t len);
+
+// In-process loopback transport.
+//
+// Published frames are delivered to the receive path of the publishing
+// process itself, without DSTC or a network. Used to test and benchmark
+// the full publish to callback path on a single machine.
+//
+// By default frames are delivered from within vsd_publish(). With
+// VSD_LOOPBACK_THREAD, frames are copied to a queue and delivered, in
+// order, by a thread owned by the transport. Subscribers are then
+// invoked on that thread, which also writes received values into the
+// signal tree. vsd_publish() may be called while frames are queued,
+// since it does not encode while a frame is being delivered. The
+// caller must not otherwise set or read signals until
+// vsd_loopback_flush() has returned.
+//
+#define VSD_LOOPBACK_THREAD 0x00000001
+
+// Number of frames queued by a threaded loopback before
+// vsd_publish() blocks. Frames published by subscribers on the
+// loopback thread are queued past this limit.
+#define VSD_LOOPBACK_QUEUE_LENGTH 256
+
+// Create a loopback transport. Install it with vsd_set_transport().
+extern int vsd_loopback_create(vsd_context_t* ctx,
+                               uint32_t flags,
+                               vsd_transport_t** result);
+
+// Wait until all queued frames have been delivered.
+// Returns immediately for a non-threaded loopback.
+extern int vsd_loopback_flush(vsd_transport_t* transport);
+
+// Deliver all queued frames, stop the delivery thread, and free
+// transport. The transport must not be in use by vsd_set_transport().
+extern int vsd_loopback_destroy(vsd_transport_t* transport);
+
+// Shared memory transport.
+//
+// Delivers frames to subscribers in other processes on the same host
+// through shared memory, bypassing DSTC and the network stack.  Each
+// publishing process writes frames to a ring of its own, which is read
+// by all other local processes using this transport.
+//
+// Frames are also multicast through DSTC to reach remote subscribers.
+// They carry an id of the publishing host, which is used by local
+// processes using this transport to drop the DSTC copy of frames they
+// have already received through shared memory.
+//
+// A subscriber that falls more than a ring (1 MB) behind a publisher
+// loses the oldest frames. See vsd_shm_get_overrun_count().
+//
+// Only one shared memory transport can exist per process.
+//
+
+// Do not multicast frames through DSTC. Only local subscribers
+// receive them.
+#define VSD_SHM_LOCAL_ONLY 0x00000001
+
+// Create the shared memory transport. Install it with vsd_set_transport().
+//
+// Return:
+//  0 - Transport created.
+//  EBUSY - A shared memory transport already exists.
+//  ENOSPC - The maximum number of publishers on the host has been reached.
+//  Other - errno from creating or mapping shared memory objects.
+extern int vsd_shm_create(vsd_context_t* ctx,
+                          uint32_t flags,
+                          vsd_transport_t** result);
+
+// Deliver all frames published by other local processes since the
+// last call. If there are none, wait up to timeout_msec milliseconds
+// for one to arrive, or forever if timeout_msec is -1.
+// Subscribers are invoked from within this call.
+//
+// Return:
+//  0 - One or more frames were delivered.
+//  ETIME - No frames arrived.
+//  EINVAL - No shared memory transport has been created.
+extern int vsd_shm_process(vsd_context_t* ctx, int timeout_msec);
+
+// Return the number of times a subscriber in this process was
+// overrun by a publisher and lost frames.
+extern uint64_t vsd_shm_get_overrun_count(vsd_context_t* ctx);
+
+// Release the ring of this process and free transport.
+// The transport must not be in use by vsd_set_transport().
+extern int vsd_shm_destroy(vsd_transport_t* transport);
+
+// Partitioned transport.
+//
+// The default DSTC transport multicasts all frames through a single
+// endpoint, so every node receives and processes the traffic of the
+// whole specification. A partitioned transport instead sends each
+// frame through the transport assigned to the branch it was published
+// on, or to the nearest ancestor of that branch.
+//
+// The transports assigned are typically DSTC partition endpoints,
+// returned by vsd_dstc_partition(). A node only receives the frames of
+// the partitions it declares a server for, once per partition, in one
+// of its source files:
+//
+//   #include <dstc.h>
+//   #include <vehicle_signal_distribution.h>
+//
+//   VSD_PARTITION_SERVER(2)
+//
+// DSTC drops the frames of other partitions before they reach VSD.
+// Publishers and subscribers must agree on the partition of each
+// branch. Snapshot requests and replies always use the default
+// endpoint.
+//
+
+// Number of DSTC partition endpoints.
+#define VSD_PARTITION_COUNT 8
+
+// Create a partitioned transport. Frames published on branches without
+// an assigned transport are sent through fallback, or through the
+// default DSTC transport if fallback is nil.
+// Install it with vsd_set_transport().
+extern int vsd_partition_create(vsd_context_t* ctx,
+                                vsd_transport_t* fallback,
+                                vsd_transport_t** result);
+
+// Send frames published on sig, or on any signal under it, through
+// target. Assignments made to signals under sig take precedence.
+// Set target to nil to remove the assignment of sig.
+//
+// Return:
+//  0 - OK
+//  EINVAL - transport is not a partitioned transport, or sig is nil.
+//  ENOENT - sig was added after the transport was created.
+extern int vsd_partition_assign(vsd_transport_t* transport,
+                                struct _vss_signal_t* sig,
+                                vsd_transport_t* target);
+
+// Free a partitioned transport. The transport must not be in use by
+// vsd_set_transport().
+extern int vsd_partition_destroy(vsd_transport_t* transport);
+
+// Return the transport sending frames through the DSTC endpoint of
+// the given partition, or nil if partition is out of range.
+extern vsd_transport_t* vsd_dstc_partition(int partition);
+
+// Declare the DSTC endpoint of partition, making this node receive the
+// frames sent through vsd_dstc_partition(partition).
+// partition must be a literal between 0 and VSD_PARTITION_COUNT - 1.
+#define VSD_PARTITION_SERVER(partition)                                 \
+    extern void vsd_signal_transmit(uint32_t vss_signature, dstc_dynamic_data_t dynarg); \
+    DSTC_SERVER(vsd_partition_transmit_##partition, uint32_t,, DSTC_DECL_DYNAMIC_ARG ) \
+    void vsd_partition_transmit_##partition(uint32_t vss_signature, dstc_dynamic_data_t dynarg) \
+    {                                                                   \
+        vsd_signal_transmit(vss_signature, dynarg);                     \
+    }
+
+// Interest aware publishing.
+//
+// A node announcing its interest multicasts, through DSTC, a bitset
+// over signal indices with the signals it subscribes to. This
+// includes regular, on change, conflating and pattern subscriptions,
+// and signals given to vsd_set_interest(). The set is announced on
+// the first vsd_process_timers() after any subscription changes, and
+// every VSD_INTEREST_INTERVAL_MSEC after that.
+//
+// A node filtering its publishes keeps the latest announcement of each
+// node, forgetting nodes not heard from for three intervals.
+// vsd_publish() then returns 0 without encoding or sending anything if
+// no node, including this one, subscribes to the published signal, to
+// any of its ancestors, or to any signal under it. Such publishes are
+// counted in skipped_publishes of the signal statistics.
+//
+// Rate limited subscriptions, see vsd_subscribe_rate_limited(), are
+// announced with their period. If all interest in a signal comes from
+// such subscriptions, the signal is published at most once per the
+// shortest of their periods. Publishes made sooner are counted in
+// held_publishes, and the signal is published with its latest values
+// once the period has passed.
+//
+// Filtering is only safe if every node receiving signals announces
+// its interest. Nodes reading values with vsd_get_value(), or from a
+// value table, without subscribing must use vsd_set_interest().
+// Right after filtering is enabled, publishes are skipped until the
+// other nodes have answered, which they are asked to do at once.
+//
+// All nodes must use the same signal specification. Announcements
+// from nodes whose root signal has a different signature are ignored.
+//
+#define VSD_INTEREST_ANNOUNCE 0x00000001
+#define VSD_INTEREST_FILTER   0x00000002
+
+#define VSD_INTEREST_INTERVAL_MSEC 1000
+
+// Set the interest flags of this node, VSD_INTEREST_ANNOUNCE,
+// VSD_INTEREST_FILTER, both, or 0 to stop announcing and publish
+// everything. vsd_process_timers() must be called for either to work.
+//
+// Return:
+//  0 - OK
+//  EINVAL - flags is invalid.
+extern int vsd_set_interest_mode(vsd_context_t* ctx, uint32_t flags);
+
+// Announce, or stop announcing, interest in sig without subscribing
+// to it. Use on nodes that read values of sig on demand.
+//
+// Return:
+//  0 - OK
+//  EINVAL - sig is nil.
+//  ENOENT - sig is not part of the specification.
+extern int vsd_set_interest(vsd_context_t* ctx, struct _vss_signal_t* sig, int interested);
+
+// Shared memory value table.
+//
+// Lets many local processes read the current value of any signal
+// without subscribing and without any IPC.
+//
+// One process, typically a daemon receiving all signals, creates the
+// table. Every value assigned in that process from then on, whether
+// set locally or received from a publisher, is written to the table.
+// Other processes attach to the table, after which vsd_get_value()
+// and vsd_get_value_ts() read straight from it.
+//
+// The table is indexed by signal, so all processes must use the same
+// signal specification.
+//
+
+// Create the value table name, such as "/vsd-values", and fill it with
+// the values assigned so far. A table left behind by an earlier owner
+// is replaced.
+//
+// String values longer than max_string_len bytes, including null
+// terminator, are truncated in the table.
+//
+// Return:
+//  0 - Table created.
+//  EBUSY - A table is already created or attached by this process.
+//  EINVAL - Invalid name.
+//  Other - errno from creating or mapping the shared memory object.
+extern int vsd_value_table_create(vsd_context_t* ctx,
+                                  const char* name,
+                                  uint16_t max_string_len);
+
+// Attach to the value table name, read only.
+//
+// Once attached, vsd_get_value() and vsd_get_value_ts() return
+// the values in the table. They return ESTALE once the owner has
+// closed the table, in which case the caller should close and attach
+// again, and EAGAIN in the unlikely event that the value was being
+// written throughout every read attempt.
+//
+// Return:
+//  0 - Table attached.
+//  EBUSY - A table is already created or attached by this process.
+//  EPROTO - The table is closed, or uses a different signal specification.
+//  Other - errno from opening or mapping the shared memory object.
+extern int vsd_value_table_attach(vsd_context_t* ctx, const char* name);
+
+// Close a created or attached value table.
+// A closed table created by this process is removed, and is
+// reported as stale to all processes attached to it.
+extern int vsd_value_table_close(vsd_context_t* ctx);
 
 // Return the current value of sig.
 extern vsd_data_u vsd_value(struct _vss_signal_t* sig);
@@ -189,6 +1058,55 @@ extern vsd_data_u vsd_value(struct _vss_signal_t* sig);
 //extern vsd_data_u vsd_max(struct _vss_signal_t* sig);
 
 
+// Specialized codecs.
+//
+// A codec encodes and decodes all signals under one branch with
+// straight-line code at fixed offsets, replacing the generic recursive
+// encoder and decoder. Codecs are generated for selected branches by
+// tools/vspec2codec.py and registered with vsd_register_codec().
+//
+// A registered codec is used by vsd_publish() for the branch, and when
+// a frame published on the branch is received, unless the frame carries
+// per-signal timestamps (VSD_TIMESTAMP_SIGNAL). Frames encoded
+// generically are still decoded generically, so codecs need only be
+// registered on some nodes.
+//
+// Codecs are limited to branches where every signal under it has a
+// fixed size type. That is, not a string.
+//
+typedef struct {
+    // Number of leaf signals under the branch, depth first.
+    int leaf_count;
+    // Data type of each leaf signal. Used to verify that the codec
+    // matches the loaded specification.
+    const vss_data_type_e* data_types;
+    // Size of the encoded signals, excluding the frame header.
+    int encoded_size;
+    // Encode values[0..leaf_count-1], each prefixed by the matching
+    // signature, into buf. buf holds at least encoded_size bytes.
+    void (*encode)(const vsd_data_u* const* values,
+                   const uint32_t* signatures,
+                   uint8_t* buf);
+    // Decode encoded_size bytes in buf into values. Returns non-zero,
+    // without storing anything, if the signatures in buf do not match
+    // signatures.
+    int (*decode)(vsd_data_u* const* values,
+                  const uint32_t* signatures,
+                  const uint8_t* buf);
+} vsd_codec_t;
+
+// Register codec for the branch sig, replacing any codec already
+// registered. A nil codec unregisters the current codec.
+// Codec must remain valid while registered.
+//
+// Return:
+//  0 - Codec registered.
+//  EINVAL - Sig is nil or not a branch, or codec is incomplete.
+//  EPROTO - Codec was generated from a different specification.
+extern int vsd_register_codec(vsd_context_t* ctx,
+                              struct _vss_signal_t* sig,
+                              const vsd_codec_t* codec);
+
 // Set user data for ctx.
 //  The provided user data can be retrieved by future calls
 //  to vsd_get_user_data().
@@ -8,9 +8,11 @@
 // Common signal functions
 //
 #include "vehicle_signal_distribution.h"
+#include "vsd_internal.h"
 #include <memory.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <dstc.h>
 #include <rmc_list_template.h>
 #include <rmc_log.h>
@@ -19,6 +21,14 @@
 DSTC_CLIENT(vsd_signal_transmit, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
 DSTC_SERVER(vsd_signal_transmit, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
 
+// Late joiner snapshot request and reply.
+// See vsd_request_snapshot() below.
+DSTC_CLIENT(vsd_snapshot_request, uint32_t,, uint32_t,)
+DSTC_SERVER(vsd_snapshot_request, uint32_t,, uint32_t,)
+
+DSTC_CLIENT(vsd_snapshot_reply, uint32_t,, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_SERVER(vsd_snapshot_reply, uint32_t,, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+
 RMC_LIST_IMPL(vsd_signal_list, vsd_signal_node, vss_signal_t*)
 RMC_LIST_IMPL(vsd_subscriber_list, vsd_subscriber_node, vsd_subscriber_cb_t)
 
@@ -26,10 +36,129 @@ RMC_LIST_IMPL(vsd_subscriber_list, vsd_subscriber_node, vsd_subscriber_cb_t)
 typedef struct _vsd_user_data_t {
     vsd_data_u value;
     vsd_subscriber_list_t subscribers;
+    // Subscribers made with VSD_SUBSCRIBE_ON_CHANGE.
+    vsd_subscriber_list_t change_subscribers;
+    // First and last subscription made with vsd_subscribe_ctx(), as
+    // indices into _subs. Zero if there are none.
+    uint32_t first_sub;
+    uint32_t last_sub;
+    // Number of those made with VSD_SUBSCRIBE_ON_CHANGE.
+    uint32_t change_subs;
+    // Set once the signal has been assigned a value, either locally
+    // or by a received publish. Only such signals are sent in
+    // snapshot replies.
+    uint8_t has_value;
+    // Set when a value is assigned locally, and cleared when one is
+    // received. A value received after a local set always counts as
+    // a change, since the local set, delivered through a loopback
+    // transport, has already overwritten the value it is compared to.
+    uint8_t set_locally;
+    // Number of values set locally under this signal since it was
+    // last published. Maintained by _value_assigned() for each
+    // ancestor of the set signal while auto publishing is in use.
+    uint32_t dirty;
+    // Set if sig is registered through vsd_auto_publish().
+    struct _vsd_auto_publish_t* auto_publish;
+    // Source timestamp of value, in nanoseconds, or 0 if unknown.
+    // See vsd_set_timestamp_mode().
+    uint64_t timestamp;
+    // Set if a specialized codec is registered for the branch through
+    // vsd_register_codec().
+    struct _vsd_codec_state_t* codec;
+    // Sequence number of the frame value was received in, or of the
+    // last frame received before it was set locally. Keeps frames held
+    // by lazy decoding from overwriting newer values once decoded.
+    uint64_t seq;
+    // Latest frame received on the signal and held undecoded.
+    // See vsd_set_lazy_decode().
+    struct _vsd_lazy_frame_t* lazy;
 } vsd_user_data_t;
 
+// Codec registered for a branch, together with the leaves under
+// the branch resolved in the order the codec expects them.
+typedef struct _vsd_codec_state_t {
+    const vsd_codec_t* codec;
+    vss_signal_t** leaves;
+    vsd_data_u** values;
+    uint32_t* signatures;
+    // Set if any leaf has limits. See vsd_set_validation().
+    int constrained;
+} vsd_codec_state_t;
+
+// Frame held undecoded by lazy decoding.
+typedef struct _vsd_lazy_frame_t {
+    vss_signal_t* sig;
+    uint8_t* data;
+    uint32_t len;       // 0 if no frame is held.
+    uint32_t allocated;
+    uint64_t seq;
+} vsd_lazy_frame_t;
+
+// Auto publish registration created by vsd_auto_publish().
+typedef struct _vsd_auto_publish_t {
+    vsd_timer_t timer;
+    vss_signal_t* sig;
+    uint32_t coalesce_msec;
+} vsd_auto_publish_t;
+
+// Number of active auto publish registrations.
+// Dirty counters are only maintained while this is non-zero.
+static uint32_t _auto_publish_count = 0;
+
 static void* _user_data = 0;
 
+// Set by vsd_set_timestamp_mode()
+static int _timestamp_mode = VSD_TIMESTAMP_NONE;
+static clockid_t _timestamp_clock = CLOCK_MONOTONIC;
+
+// Every frame handed to DSTC starts with a header:
+//
+//   uint8_t  version   - FRAME_VERSION
+//   uint8_t  flags     - FRAME_* flags below
+//   uint64_t timestamp - Frame timestamp in nsec. Only if FRAME_TIMESTAMP is set.
+//   uint64_t origin    - Host id of publisher. Only if FRAME_ORIGIN is set.
+//
+// The header is followed by the encoded signals. If
+// FRAME_SIGNAL_TIMESTAMPS is set, each signal value is followed by
+// the age of the value relative to the frame timestamp, in nsec,
+// encoded as a LEB128 varint.
+#define FRAME_VERSION 1
+#define FRAME_TIMESTAMP 0x01
+#define FRAME_SIGNAL_TIMESTAMPS 0x02
+#define FRAME_ORIGIN 0x04
+
+typedef struct {
+    uint8_t flags;
+    uint64_t timestamp;
+    uint64_t origin;
+    // Encoding only. Skip signals that have not been assigned a value.
+    uint8_t valid_only;
+    // Decoding only. If not nil, signals whose value differs from the
+    // one already stored are pushed here as well.
+    vsd_signal_list_t* changed;
+    // Decoding only. Sequence number of the frame. Signals holding a
+    // value from a later frame, or set locally after it was received,
+    // are left as they are.
+    uint64_t seq;
+    // Decoding only. Set if the frame was held by lazy decoding.
+    uint8_t lazy;
+} frame_info_t;
+
+// Sequence number of the latest frame received.
+static uint64_t _frame_seq = 0;
+
+// Set by vsd_set_lazy_decode().
+static int _lazy_decode = 0;
+
+// Number of frames held undecoded, and all frames ever held,
+// one per signal.
+static uint32_t _lazy_pending = 0;
+static vsd_lazy_frame_t** _lazy_frames = 0;
+static uint32_t _lazy_frame_count = 0;
+static uint32_t _lazy_frame_allocated = 0;
+
+static void _lazy_resolve(vss_signal_t* sig);
+
 static int _data_type_size[] =
 {
     sizeof(int8_t),    // VSS_INT8
@@ -61,25 +190,91 @@ typedef struct {
 
 static signal_hash_t* _signatures = NULL;
 
+// Hash table mapping full dotted paths to signals, used by the
+// vsd_set_value_by_path_*() setters.
+//
+// Populated by _get_signal_by_path() on a miss that resolves to a
+// signal. Holds at most _path_cache_size entries. Once full, the
+// oldest entry is evicted to make room for a new one.
+typedef struct {
+    vss_signal_t* signal;
+    UT_hash_handle hh;
+    // Bytes available in path.
+    size_t allocated;
+    char path[];
+} path_hash_t;
+
+static path_hash_t* _paths = NULL;
+static uint32_t _path_cache_size = VSD_PATH_CACHE_SIZE;
+
+// Paths up to this length are resolved from a copy on the stack.
+#define PATH_BUF_LEN 256
+
+// Outstanding snapshot requests sent by vsd_request_snapshot(),
+// keyed by request id. Replies are decoded as they arrive, and the
+// signals they carry are collected in received, a bitset over signal
+// indices. Once VSD_SNAPSHOT_WINDOW_MSEC has passed, the timer hands
+// all of them to the callback in a single list and frees the request.
+typedef struct {
+    uint32_t request_id;
+    vss_signal_t* signal;
+    vsd_subscriber_cb_t callback;
+    vsd_timer_t timer;
+    uint64_t* received;
+    UT_hash_handle hh;
+} snapshot_request_t;
+
+static snapshot_request_t* _snapshot_requests = NULL;
+static uint32_t _snapshot_request_id = 0;
+
+// Default transport, sending frames through DSTC.
+static int _dstc_transmit(vsd_transport_t* transport,
+                          uint32_t signature,
+                          const uint8_t* data,
+                          uint16_t len)
+{
+    return dstc_vsd_signal_transmit(signature, DSTC_DYNAMIC_ARG(data, len));
+}
+
+vsd_transport_t vsd_dstc_transport = {
+    .name = "dstc",
+    .transmit = _dstc_transmit,
+    .user_data = 0
+};
+
+// Set by vsd_set_transport()
+static vsd_transport_t* _transport = &vsd_dstc_transport;
+
+// Host id written to the header of all published frames, or 0.
+// Set by the shared memory transport, see vsd_shm.c.
+uint64_t vsd_frame_origin = 0;
+
+// Make room for a string of len bytes in dst.
+static void _string_reserve(vsd_data_u* dst, uint32_t len)
+{
+    if (dst->s.allocated >= len)
+        return;
+
+    // Free old memory, if set. free(3) takes null pointer.
+    free(dst->s.data);
+
+    // Allocate new memory. Round up to nearest 2K to minimize fragmentation
+    dst->s.allocated = len | 0x7FF;
+    dst->s.data = (char*) malloc(dst->s.allocated);
+
+    if (!dst->s.data) {
+        RMC_LOG_FATAL("Failed to allocate %u bytes of memory", dst->s.allocated);
+        exit(255);
+    }
+}
+
 static int vsd_data_copy(vsd_data_u* dst,
                          vsd_data_u* src,
                          vss_data_type_e data_type)
 {
     switch(data_type) {
     case VSS_STRING:
-        if (dst->s.allocated < src->s.len) {
-            // Free old memory, if set. free(3) takes null pointer.
-            free(dst->s.data);
-
-            // Allocate new memory. Round up to nearest 2K to minimize fragmentation
-            dst->s.allocated = src->s.len | 0x7FF;
-            dst->s.data = (char*) malloc(dst->s.allocated);
-
-            if (!dst->s.data) {
-                RMC_LOG_FATAL("Failed to allocate %u bytes of memory", dst->s.allocated);
-                exit(255);
-            }
-        }
+        _string_reserve(dst, src->s.len);
         memcpy(dst->s.data, src->s.data, src->s.len);
         dst->s.len = src->s.len;
         return 0;
@@ -108,15 +303,17 @@ static int vsd_data_copy(vsd_data_u* dst,
 int vsd_string_to_data(vss_data_type_e type, char* str, vsd_data_u* res)
 {
     switch(type) {
-    case VSS_INT8: { *res = (vsd_data_u) { .i8 = (int8_t) strtol(str, 0, 10) }; return 0; }
-    case VSS_UINT8: { *res = (vsd_data_u) { .u8 = (uint8_t) strtoul(str, 0, 10) }; return 0; }
-    case VSS_INT16: { *res = (vsd_data_u) { .i16 = (int16_t) strtol(str, 0, 10) }; return 0; }
-    case VSS_UINT16: { *res = (vsd_data_u) { .u16 = (uint16_t) strtoul(str, 0, 10) }; return 0; }
-    case VSS_INT32: { *res = (vsd_data_u) { .i32 = (int32_t) strtol(str, 0, 10) }; return 0; }
-    case VSS_UINT32: { *res = (vsd_data_u) { .u32 = (uint32_t) strtoul(str, 0, 10) }; return 0; }
-    case VSS_DOUBLE: { *res = (vsd_data_u) { .d = (double) strtod(str, 0) }; return 0; }
-    case VSS_FLOAT: { *res = (vsd_data_u) { .f = (float) strtof(str, 0) }; return 0; }
-    case VSS_BOOLEAN: { *res = (vsd_data_u) { .b = (*str == '1' || *str == 't' || *str == 'T')?1:0 }; return 0; }
+    case VSS_INT8:
+    case VSS_UINT8:
+    case VSS_INT16:
+    case VSS_UINT16:
+    case VSS_INT32:
+    case VSS_UINT32:
+    case VSS_DOUBLE:
+    case VSS_FLOAT:
+    case VSS_BOOLEAN:
+        return vsd_parse_value(type, str, str + strlen(str), res);
+
     case VSS_STRING: { *res = (vsd_data_u) { .s.data = str, .s.len = strlen(str)+1 }; return 0; }
     default:
         RMC_LOG_WARNING("Illegal type: %d / %s\n", type, str);
@@ -138,6 +335,7 @@ static vsd_user_data_t* vsd_user_data(vss_signal_t* sig)
         }
         memset(sig->user_data, 0, sizeof(vsd_user_data_t));
         vsd_subscriber_list_init(&((vsd_user_data_t*) sig->user_data)->subscribers, 0, 0, 0);
+        vsd_subscriber_list_init(&((vsd_user_data_t*) sig->user_data)->change_subscribers, 0, 0, 0);
     }
     return (vsd_user_data_t*) sig->user_data;
 }
@@ -156,6 +354,123 @@ static vsd_data_u* vsd_data(vss_signal_t* sig)
     return &dt->value;
 }
 
+// Set while vsd_set_values() stores its records. Branches that would
+// otherwise be auto published right away are collected in _deferred,
+// and published once all records are in place.
+static int _deferring = 0;
+static vss_signal_t** _deferred = 0;
+static int _deferred_count = 0;
+static int _deferred_allocated = 0;
+
+static void _defer_publish(vss_signal_t* sig)
+{
+    if (_deferred_count == _deferred_allocated) {
+        _deferred_allocated = _deferred_allocated ? _deferred_allocated * 2 : 64;
+        _deferred = (vss_signal_t**) realloc(_deferred, _deferred_allocated * sizeof(vss_signal_t*));
+        if (!_deferred) {
+            RMC_LOG_FATAL("Could not allocate %d deferred publish entries", _deferred_allocated);
+            exit(255);
+        }
+    }
+    _deferred[_deferred_count++] = sig;
+}
+
+// Invoked once a new value, taken at timestamp, has been stored in sig.
+static void _value_stored(vss_signal_t* sig, uint64_t timestamp)
+{
+    vss_signal_t* current = sig;
+    vsd_user_data_t* sig_ud = vsd_user_data(sig);
+
+    sig_ud->has_value = 1;
+    sig_ud->set_locally = 1;
+    sig_ud->seq = _frame_seq;
+
+    if (_timestamp_mode != VSD_TIMESTAMP_NONE)
+        sig_ud->timestamp = timestamp;
+
+    if (vsd_value_table_mode == VSD_VALUE_TABLE_OWNER)
+        vsd_value_table_store(sig, &sig_ud->value, sig_ud->timestamp);
+
+    if (!_auto_publish_count)
+        return;
+
+    // Propagate the change upward. Any auto published branch that
+    // goes from clean to dirty will be published, either right away
+    // or once its coalesce window has passed.
+    while(current) {
+        vsd_user_data_t* ud = vsd_user_data(current);
+
+        if (++ud->dirty == 1 && ud->auto_publish) {
+            if (!ud->auto_publish->coalesce_msec) {
+                if (_deferring)
+                    _defer_publish(current);
+                else
+                    vsd_publish(current);
+            }
+            else if (!vsd_timer_is_armed(&ud->auto_publish->timer))
+                vsd_timer_start(&ud->auto_publish->timer,
+                                vsd_msec_monotonic_timestamp() +
+                                ud->auto_publish->coalesce_msec);
+        }
+        current = current->parent;
+    }
+}
+
+// Invoked by all setters once a new value has been stored in sig.
+static void _value_assigned(vss_signal_t* sig)
+{
+    _value_stored(sig, _timestamp_mode != VSD_TIMESTAMP_NONE ? vsd_timestamp_now(0) : 0);
+}
+
+// Store all values assigned so far in the value table.
+// Signals that have never been touched are skipped without
+// allocating user data for them.
+void vsd_value_table_populate(void)
+{
+    int ind = vss_get_signal_count();
+
+    if (_lazy_pending)
+        _lazy_resolve(0);
+
+    while(ind--) {
+        vss_signal_t* sig = vss_get_signal_by_index(ind);
+        vsd_user_data_t* ud = (vsd_user_data_t*) sig->user_data;
+
+        if (sig->element_type == VSS_BRANCH || !ud || !ud->has_value)
+            continue;
+
+        vsd_value_table_store(sig, &ud->value, ud->timestamp);
+    }
+}
+
+// Validate, and store a numeric or boolean value in sig.
+static inline int _assign_scalar(vss_signal_t* sig, vsd_data_u val)
+{
+    int res = vsd_validate(sig, &val);
+
+    if (res)
+        return res;
+
+    *vsd_data(sig) = val;
+    _value_assigned(sig);
+    return 0;
+}
+
+static int _copy_assigned(vss_signal_t* sig, vsd_data_u* val)
+{
+    int res = vsd_validate(sig, val);
+
+    if (res)
+        return res;
+
+    res = vsd_data_copy(vsd_data(sig), val, sig->data_type);
+
+    if (!res)
+        _value_assigned(sig);
+
+    return res;
+}
+
 static vss_signal_t* _get_signal_by_signature(uint32_t signature)
 {
     signal_hash_t* hash = 0;
@@ -192,8 +507,165 @@ static vss_signal_t* _get_signal_by_signature(uint32_t signature)
     return signal;
 }
 
+vss_signal_t* vsd_signal_by_signature(uint32_t signature)
+{
+    return _get_signal_by_signature(signature);
+}
+
+static void _path_cache_evict(uint32_t max_entries)
+{
+    // Entries are iterated in insertion order, oldest first.
+    while(HASH_COUNT(_paths) > max_entries) {
+        path_hash_t* hash = _paths;
+
+        HASH_DEL(_paths, hash);
+        free(hash);
+    }
+}
+
+// Return an entry with room for a path of len bytes.
+// If the cache is full, the oldest entry is evicted and reused if
+// large enough, so that a working set larger than the cache does not
+// turn every lookup into a malloc() and free().
+static path_hash_t* _path_cache_entry(size_t len)
+{
+    path_hash_t* hash = 0;
+
+    if (_path_cache_size && HASH_COUNT(_paths) >= _path_cache_size) {
+        hash = _paths;
+        HASH_DEL(_paths, hash);
+
+        if (hash->allocated > len)
+            return hash;
+
+        free(hash);
+    }
+
+    // Round up to reduce reallocation as entries are reused.
+    len = (len | 0x3F) + 1;
+    hash = (path_hash_t*) malloc(sizeof(path_hash_t) + len);
+    if (!hash) {
+        RMC_LOG_FATAL("Could not allocate %lu bytes", sizeof(path_hash_t) + len);
+        exit(255);
+    }
+    hash->allocated = len;
+    return hash;
+}
+
+// Resolve the len bytes at path, which need not be null terminated.
+static int _get_signal_by_path_len(const char* path, size_t len, vss_signal_t** result)
+{
+    char buf[PATH_BUF_LEN];
+    path_hash_t* hash = 0;
+    vss_signal_t* sig = 0;
+    char* copy = 0;
+    int res = 0;
+
+    HASH_FIND(hh, _paths, path, len, hash);
+    if (hash) {
+        *result = hash->signal;
+        return 0;
+    }
+
+    // Resolve a copy of path, since vss_get_signal_by_path() does not
+    // promise to leave it untouched. Only a path that resolves takes
+    // an entry, so that unknown paths never evict known ones.
+    if (len < sizeof(buf))
+        copy = buf;
+    else {
+        copy = (char*) malloc(len + 1);
+        if (!copy) {
+            RMC_LOG_FATAL("Could not allocate %lu bytes", len + 1);
+            exit(255);
+        }
+    }
+
+    memcpy(copy, path, len);
+    copy[len] = 0;
+    res = vss_get_signal_by_path(copy, &sig);
+
+    if (copy != buf)
+        free(copy);
+
+    if (res)
+        return res;
+
+    *result = sig;
+    if (!_path_cache_size)
+        return 0;
+
+    hash = _path_cache_entry(len);
+    hash->signal = sig;
+    memcpy(hash->path, path, len);
+    hash->path[len] = 0;
+    HASH_ADD_KEYPTR(hh, _paths, hash->path, len, hash);
+    return 0;
+}
+
+static int _get_signal_by_path(const char* path, vss_signal_t** result)
+{
+    if (!path)
+        return EINVAL;
+
+    return _get_signal_by_path_len(path, strlen(path), result);
+}
+
+int vsd_find_signal_by_path(vsd_context_t* ctx,
+                            const char* path,
+                            vss_signal_t** result)
+{
+    if (!result)
+        return EINVAL;
+
+    return _get_signal_by_path(path, result);
+}
+
+int vsd_set_path_cache_size(vsd_context_t* ctx, uint32_t max_entries)
+{
+    _path_cache_size = max_entries;
+    _path_cache_evict(max_entries);
+    return 0;
+}
+
+// Encode val as a LEB128 varint.
+// Returns the number of bytes used, or 0 if buf_sz is too small.
+static int _encode_varint(uint64_t val, uint8_t* buf, int buf_sz)
+{
+    int len = 0;
+
+    do {
+        if (len == buf_sz)
+            return 0;
+
+        buf[len++] = (uint8_t) ((val & 0x7F) | (val > 0x7F ? 0x80 : 0));
+        val >>= 7;
+    } while(val);
+
+    return len;
+}
+
+// Decode a LEB128 varint.
+// Returns the number of bytes consumed, or 0 if buf is truncated.
+static int _decode_varint(const uint8_t* buf, int buf_sz, uint64_t* val)
+{
+    int len = 0;
+    int shift = 0;
+
+    *val = 0;
+    while(len < buf_sz && shift < 64) {
+        *val |= (uint64_t) (buf[len] & 0x7F) << shift;
+        if (!(buf[len++] & 0x80))
+            return len;
+        shift += 7;
+    }
+
+    return 0;
+}
+
 // Encode a signal tree under self.
-static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
+// If frame->valid_only is set, signals that have never been assigned a value
+// are left out of the encoded data.
+static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len, const frame_info_t* frame)
 {
     const vsd_data_u *sig_val = 0;
     *len = 0;
@@ -203,7 +675,7 @@ static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
         while(sig->children[ind]) {
             int local_len = 0;
             // Abort recursion if we see an error.
-            rec_res = encode_signal(sig->children[ind], buf, buf_sz, &local_len);
+            rec_res = encode_signal(sig->children[ind], buf, buf_sz, &local_len, frame);
             if (rec_res != 0) {
                 RMC_LOG_WARNING("Failed to encode %s: %s",
                                 sig->children[ind]->name,
@@ -221,6 +693,9 @@ static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
     }
 
     // We are not a branch, but an actual signal
+    if (frame->valid_only && !vsd_user_data(sig)->has_value)
+        return 0;
+
     // Do we have enough space to encode signal ID?
     if (buf_sz < sizeof(sig->signature))
         return ENOMEM;
@@ -264,7 +739,7 @@ static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
         buf += _data_type_size[sig->data_type];
         buf_sz -= _data_type_size[sig->data_type];
         *len += _data_type_size[sig->data_type];
-        return 0;
+        break;
 
     case VSS_STRING:
         // Copy dynamic length string
@@ -290,7 +765,7 @@ static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
         buf_sz -= sig_val->s.len;
         RMC_LOG_DEBUG("String is %d bytes",
                       vsd_data(sig)->s.len);
-        return 0;
+        break;
 
     default:
         RMC_LOG_ERROR("Could not encode %s signal %s. Not supported",
@@ -299,23 +774,285 @@ static int encode_signal(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
         exit(255);
     }
 
-    // Not reached.
+    // Append age of value relative to the frame timestamp.
+    if (frame->flags & FRAME_SIGNAL_TIMESTAMPS) {
+        uint64_t ts = vsd_user_data(sig)->timestamp;
+        int ts_len = _encode_varint((ts < frame->timestamp)?(frame->timestamp - ts):0,
+                                    buf, buf_sz);
+
+        if (!ts_len)
+            return ENOMEM;
+
+        *len += ts_len;
+    }
+
+    vsd_stats(sig)->published++;
+    vsd_stats(sig)->bytes_encoded += *len;
+    return 0;
+}
+
+
+// Encode all signals under a branch with its registered codec.
+static int _codec_encode(vsd_codec_state_t* state, uint8_t* buf, int buf_sz, int* len)
+{
+    const vsd_codec_t* codec = state->codec;
+    int ind = 0;
+
+    if (buf_sz < codec->encoded_size)
+        return ENOMEM;
+
+    (*codec->encode)((const vsd_data_u* const*) state->values, state->signatures, buf);
+    *len = codec->encoded_size;
+
+    for(ind = 0; ind < codec->leaf_count; ++ind) {
+        vsd_traffic_stats_t* stats = vsd_stats(state->leaves[ind]);
+
+        stats->published++;
+        stats->bytes_encoded += sizeof(uint32_t) + _data_type_size[codec->data_types[ind]];
+    }
+    return 0;
+}
+
+
+// Decode a frame carrying all signals under a branch with its
+// registered codec.
+//
+// Return:
+//  0 - OK
+//  EPROTO - The frame was not encoded by a matching codec. Nothing
+//           has been decoded. Use decode_signal() instead.
+static int _codec_decode(vsd_codec_state_t* state,
+                         const uint8_t* buf, int buf_sz,
+                         vsd_signal_list_t* res_lst,
+                         const frame_info_t* frame)
+{
+    const vsd_codec_t* codec = state->codec;
+    int ind = 0;
+
+    // Strictly validated values, values compared for on change
+    // subscribers, and values of held frames that may have been
+    // overwritten since, must be checked before they are stored.
+    // Leave those to decode_signal().
+    if (buf_sz != codec->encoded_size ||
+        (frame->flags & FRAME_SIGNAL_TIMESTAMPS) ||
+        frame->changed ||
+        frame->lazy ||
+        (vsd_validation == VSD_VALIDATE_STRICT && state->constrained) ||
+        (*codec->decode)(state->values, state->signatures, buf))
+        return EPROTO;
+
+    for(ind = 0; ind < codec->leaf_count; ++ind) {
+        vss_signal_t* sig = state->leaves[ind];
+        vsd_user_data_t* ud = (vsd_user_data_t*) sig->user_data;
+        vsd_traffic_stats_t* stats = vsd_stats(sig);
+
+        ud->has_value = 1;
+        ud->set_locally = 0;
+        ud->seq = frame->seq;
+        ud->timestamp = frame->timestamp;
+        vsd_signal_list_push_tail(res_lst, sig);
+
+        if (vsd_validation == VSD_VALIDATE_PERMISSIVE)
+            vsd_limits_check(sig, &ud->value);
+
+        if (vsd_value_table_mode == VSD_VALUE_TABLE_OWNER)
+            vsd_value_table_store(sig, &ud->value, ud->timestamp);
+
+        stats->received++;
+        stats->bytes_decoded += sizeof(uint32_t) + _data_type_size[codec->data_types[ind]];
+    }
+    return 0;
+}
+
+
+// Collect the leaves under sig, depth first, into state.
+// Returns the number of leaves under sig, which may be
+// more than max_count.
+static int _codec_collect(vss_signal_t* sig, vsd_codec_state_t* state, int count, int max_count)
+{
+    int ind = 0;
+
+    if (sig->element_type != VSS_BRANCH) {
+        if (count < max_count) {
+            state->leaves[count] = sig;
+            state->values[count] = vsd_data(sig);
+            state->signatures[count] = sig->signature;
+        }
+        return count + 1;
+    }
+
+    for(ind = 0; sig->children[ind]; ++ind)
+        count = _codec_collect(sig->children[ind], state, count, max_count);
+
+    return count;
+}
+
+
+int vsd_register_codec(vsd_context_t* ctx,
+                       vss_signal_t* sig,
+                       const vsd_codec_t* codec)
+{
+    vsd_user_data_t* ud = 0;
+    vsd_codec_state_t* state = 0;
+    int count = 0;
+    int ind = 0;
+
+    if (!sig || sig->element_type != VSS_BRANCH)
+        return EINVAL;
+
+    ud = vsd_user_data(sig);
+
+    // Drop any previously registered codec.
+    if (ud->codec) {
+        free(ud->codec->leaves);
+        free(ud->codec->values);
+        free(ud->codec->signatures);
+        free(ud->codec);
+        ud->codec = 0;
+    }
+
+    if (!codec)
+        return 0;
+
+    if (!codec->encode || !codec->decode || codec->leaf_count <= 0)
+        return EINVAL;
+
+    state = (vsd_codec_state_t*) calloc(1, sizeof(vsd_codec_state_t));
+    if (state) {
+        state->leaves = (vss_signal_t**) calloc(codec->leaf_count, sizeof(vss_signal_t*));
+        state->values = (vsd_data_u**) calloc(codec->leaf_count, sizeof(vsd_data_u*));
+        state->signatures = (uint32_t*) calloc(codec->leaf_count, sizeof(uint32_t));
+    }
+
+    if (!state || !state->leaves || !state->values || !state->signatures) {
+        RMC_LOG_FATAL("Failed to allocate codec state for %d signals", codec->leaf_count);
+        exit(255);
+    }
+    state->codec = codec;
+
+    // The codec must have been generated from the same specification.
+    count = _codec_collect(sig, state, 0, codec->leaf_count);
+    if (count != codec->leaf_count) {
+        RMC_LOG_ERROR("Codec for %s expects %d signals. Found %d.",
+                      sig->uuid, codec->leaf_count, count);
+        goto mismatch;
+    }
+
+    for(ind = 0; ind < count; ++ind) {
+        if (state->leaves[ind]->data_type != codec->data_types[ind]) {
+            RMC_LOG_ERROR("Codec for %s expects signal %d, %s, to be %s. Found %s.",
+                          sig->uuid, ind, state->leaves[ind]->uuid,
+                          vss_data_type_string(codec->data_types[ind]),
+                          vss_data_type_string(state->leaves[ind]->data_type));
+            goto mismatch;
+        }
+        state->constrained |= vsd_limits_constrained(state->leaves[ind]);
+    }
+
+    ud->codec = state;
+    return 0;
+
+mismatch:
+    free(state->leaves);
+    free(state->values);
+    free(state->signatures);
+    free(state);
+    return EPROTO;
+}
+
+
+// Encode a frame header followed by the signal tree under sig.
+//
+// Return:
+//  0 - OK
+//  ENOMEM - buf_sz is too small.
+//  ENODATA - valid_only is set and no signal under sig has a value.
+static int encode_frame(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len, int valid_only)
+{
+    frame_info_t frame = { .flags = 0, .timestamp = 0, .valid_only = valid_only };
+    int hdr_len = 2;
+    int res = 0;
+
+    // Values under sig may still be waiting in held frames.
+    if (_lazy_pending)
+        _lazy_resolve(sig);
+
+    if (_timestamp_mode != VSD_TIMESTAMP_NONE) {
+        frame.flags |= FRAME_TIMESTAMP;
+        frame.timestamp = vsd_timestamp_now(0);
+        hdr_len += sizeof(frame.timestamp);
+    }
+
+    if (_timestamp_mode == VSD_TIMESTAMP_SIGNAL)
+        frame.flags |= FRAME_SIGNAL_TIMESTAMPS;
+
+    if (vsd_frame_origin) {
+        frame.flags |= FRAME_ORIGIN;
+        frame.origin = vsd_frame_origin;
+        hdr_len += sizeof(frame.origin);
+    }
+
+    if (buf_sz < hdr_len)
+        return ENOMEM;
+
+    buf[0] = FRAME_VERSION;
+    buf[1] = frame.flags;
+    if (frame.flags & FRAME_TIMESTAMP)
+        memcpy(buf + 2, &frame.timestamp, sizeof(frame.timestamp));
+
+    if (frame.flags & FRAME_ORIGIN)
+        memcpy(buf + hdr_len - sizeof(frame.origin), &frame.origin, sizeof(frame.origin));
+
+    // Specialized codecs encode all signals, without timestamps.
+    if (!valid_only &&
+        !(frame.flags & FRAME_SIGNAL_TIMESTAMPS) &&
+        sig->user_data &&
+        vsd_user_data(sig)->codec)
+        res = _codec_encode(vsd_user_data(sig)->codec, buf + hdr_len, buf_sz - hdr_len, len);
+    else
+        res = encode_signal(sig, buf + hdr_len, buf_sz - hdr_len, len, &frame);
+    if (res)
+        return res;
+
+    if (valid_only && !*len)
+        return ENODATA;
+
+    *len += hdr_len;
     return 0;
 }
 
 
+// Return non-zero if the scalar value b of the given type differs
+// from a. Values are compared as raw words, so a NaN equals itself.
+static inline int _scalar_differs(vss_data_type_e type, const vsd_data_u* a, const vsd_data_u* b)
+{
+    switch(_data_type_size[type]) {
+    case 1: return a->u8 != b->u8;
+    case 2: return a->u16 != b->u16;
+    case 4: return a->u32 != b->u32;
+    default: return memcmp(&a->d, &b->d, sizeof(double)) != 0;
+    }
+}
+
 // Decode incoming signal data and populate the local signal, and possibly
 // the tree hanging under it (if it is a branch with children).
 // The value will be stored in the signal tree hanging under
 // context.
 static int decode_signal(vsd_context_t* ctx,
                          const uint8_t* buf, int buf_sz,
-                         vsd_signal_list_t* res_lst)
+                         vsd_signal_list_t* res_lst,
+                         const frame_info_t* frame)
 {
     uint32_t signature;
     vss_signal_t* sig = 0;
 
     while(buf_sz) {
+        const uint8_t* sig_start = buf;
+        vsd_traffic_stats_t* stats = 0;
+        uint64_t timestamp = frame->timestamp;
+        int superseded = 0;
+        int rejected = 0;
+
         // Do we have enough data to decode signal signature?
         if (buf_sz < sizeof(signature))
             return ENOMEM;
@@ -329,10 +1066,12 @@ static int decode_signal(vsd_context_t* ctx,
         sig = _get_signal_by_signature(signature);
 
         // If not found then we have a signal definition mismatch between sender
-        // and receiver.
+        // and receiver. We cannot know the length of the value, so
+        // the rest of the frame is dropped.
         if (!sig) {
-            RMC_LOG_FATAL("Cannot decode signal signature 0x%X.", signature);
-            exit(255);
+            RMC_LOG_ERROR("Cannot decode signal signature 0x%X.", signature);
+            vsd_unknown_signatures++;
+            return ENOENT;
         }
 
         // Is this a signal branch?
@@ -341,6 +1080,9 @@ static int decode_signal(vsd_context_t* ctx,
             exit(255);
         }
 
+        // Newer value already in place. Only happens to held frames.
+        superseded = frame->seq <= vsd_user_data(sig)->seq;
+
         // Decode a leaf node.
         switch(sig->data_type) {
         case VSS_INT8:
@@ -352,6 +1094,7 @@ static int decode_signal(vsd_context_t* ctx,
         case VSS_DOUBLE:
         case VSS_FLOAT:
         case VSS_BOOLEAN: {
+            vsd_data_u val;
 
             // Do we have enough memory?
             if (buf_sz < _data_type_size[sig->data_type]) {
@@ -364,10 +1107,24 @@ static int decode_signal(vsd_context_t* ctx,
             }
 
             // Copy out the raw data for the signal value
-            *vsd_data(sig) = *((vsd_data_u*) buf);
+            val = *((vsd_data_u*) buf);
+            rejected = superseded || vsd_validate(sig, &val);
             buf += _data_type_size[sig->data_type];
             buf_sz -= _data_type_size[sig->data_type];
 
+            if (rejected)
+                break;
+
+            if (frame->changed &&
+                (!vsd_user_data(sig)->has_value ||
+                 vsd_user_data(sig)->set_locally ||
+                 _scalar_differs(sig->data_type, vsd_data(sig), &val)))
+                vsd_signal_list_push_tail(frame->changed, sig);
+
+            *vsd_data(sig) = val;
+            vsd_user_data(sig)->has_value = 1;
+            vsd_user_data(sig)->set_locally = 0;
+            vsd_user_data(sig)->seq = frame->seq;
             vsd_signal_list_push_tail(res_lst, sig);
             break;
         }
@@ -394,11 +1151,25 @@ static int decode_signal(vsd_context_t* ctx,
                 return ENOMEM;
             }
 
-            // Copy string payload
-            vsd_data_copy(vsd_data(sig), &val, VSS_STRING);
+            rejected = superseded || vsd_validate(sig, &val);
             buf += val.s.len;
             buf_sz -= val.s.len;
 
+            if (rejected)
+                break;
+
+            if (frame->changed &&
+                (!vsd_user_data(sig)->has_value ||
+                 vsd_user_data(sig)->set_locally ||
+                 vsd_data(sig)->s.len != val.s.len ||
+                 memcmp(vsd_data(sig)->s.data, val.s.data, val.s.len)))
+                vsd_signal_list_push_tail(frame->changed, sig);
+
+            // Copy string payload
+            vsd_data_copy(vsd_data(sig), &val, VSS_STRING);
+            vsd_user_data(sig)->has_value = 1;
+            vsd_user_data(sig)->set_locally = 0;
+            vsd_user_data(sig)->seq = frame->seq;
             vsd_signal_list_push_tail(res_lst, sig);
             break;
         }
@@ -409,11 +1180,136 @@ static int decode_signal(vsd_context_t* ctx,
                           sig->signature);
             exit(255);
         }
+
+        // Recreate the source timestamp of the value.
+        if (frame->flags & FRAME_SIGNAL_TIMESTAMPS) {
+            uint64_t age = 0;
+            int ts_len = _decode_varint(buf, buf_sz, &age);
+
+            if (!ts_len) {
+                RMC_LOG_ERROR("Could not decode timestamp of signal %s.", sig->uuid);
+                return ENOMEM;
+            }
+
+            buf += ts_len;
+            buf_sz -= ts_len;
+            timestamp = frame->timestamp - age;
+        }
+
+        // Rejected and superseded values leave the signal as it was.
+        if (!rejected) {
+            vsd_user_data(sig)->timestamp = timestamp;
+
+            if (vsd_value_table_mode == VSD_VALUE_TABLE_OWNER)
+                vsd_value_table_store(sig, vsd_data(sig), timestamp);
+        }
+
+        stats = vsd_stats(sig);
+        stats->received++;
+        stats->bytes_decoded += buf - sig_start;
     }
 
     return 0;
 }
 
+
+// Decode a frame header followed by the encoded signals.
+// The decoded header is returned in frame.
+// sig is the signal the frame was published on. If a codec is
+// registered for it, the codec is tried before decode_signal().
+// If chg_lst is not nil, the signals whose value changed are pushed
+// to it, in addition to res_lst.
+// lazy is the frame held by lazy decoding that buf comes from, if any.
+static int decode_frame(vsd_context_t* ctx,
+                        vss_signal_t* sig,
+                        const uint8_t* buf, int buf_sz,
+                        vsd_signal_list_t* res_lst,
+                        vsd_signal_list_t* chg_lst,
+                        frame_info_t* frame,
+                        const vsd_lazy_frame_t* lazy)
+{
+    int hdr_len = 2;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->changed = chg_lst;
+    frame->seq = lazy ? lazy->seq : ++_frame_seq;
+    frame->lazy = lazy ? 1 : 0;
+
+    if (buf_sz < hdr_len)
+        return ENOMEM;
+
+    if (buf[0] != FRAME_VERSION) {
+        RMC_LOG_ERROR("Frame version mismatch. My version: %d. Their version: %d",
+                      FRAME_VERSION, buf[0]);
+        return EPROTO;
+    }
+
+    frame->flags = buf[1];
+    if (frame->flags & FRAME_TIMESTAMP) {
+        if (buf_sz < hdr_len + sizeof(frame->timestamp))
+            return ENOMEM;
+
+        memcpy(&frame->timestamp, buf + hdr_len, sizeof(frame->timestamp));
+        hdr_len += sizeof(frame->timestamp);
+    }
+
+    if (frame->flags & FRAME_ORIGIN) {
+        if (buf_sz < hdr_len + sizeof(frame->origin))
+            return ENOMEM;
+
+        memcpy(&frame->origin, buf + hdr_len, sizeof(frame->origin));
+        hdr_len += sizeof(frame->origin);
+    }
+
+    if (sig->user_data && ((vsd_user_data_t*) sig->user_data)->codec &&
+        !_codec_decode(((vsd_user_data_t*) sig->user_data)->codec,
+                       buf + hdr_len, buf_sz - hdr_len, res_lst, frame))
+        return 0;
+
+    return decode_signal(ctx, buf + hdr_len, buf_sz - hdr_len, res_lst, frame);
+}
+
+
+int vsd_encode_frame(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len, int valid_only)
+{
+    return encode_frame(sig, buf, buf_sz, len, valid_only);
+}
+
+int vsd_decode_frame(vss_signal_t* sig, const uint8_t* buf, int buf_sz, vsd_signal_list_t* res_lst)
+{
+    frame_info_t frame;
+
+    return decode_frame(0, sig, buf, buf_sz, res_lst, 0, &frame, 0);
+}
+
+
+int vsd_set_timestamp_mode(vsd_context_t* ctx, int mode, clockid_t clock)
+{
+    struct timespec ts;
+
+    if (mode != VSD_TIMESTAMP_NONE &&
+        mode != VSD_TIMESTAMP_FRAME &&
+        mode != VSD_TIMESTAMP_SIGNAL)
+        return EINVAL;
+
+    // Is the clock usable?
+    if (clock_gettime(clock, &ts))
+        return errno;
+
+    _timestamp_mode = mode;
+    _timestamp_clock = clock;
+    return 0;
+}
+
+
+uint64_t vsd_timestamp_now(vsd_context_t* ctx)
+{
+    struct timespec ts;
+
+    clock_gettime(_timestamp_clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 int vsd_set_user_data(vsd_context_t* ctx, void* user_data)
 {
 
@@ -429,11 +1325,233 @@ void* vsd_get_user_data(vsd_context_t* ctx)
 
 // ----------------------
 
+static void _free_snapshot_request(snapshot_request_t* req)
+{
+    HASH_DEL(_snapshot_requests, req);
+    vsd_timer_cancel(&req->timer);
+    free(req->received);
+    free(req);
+}
+
+// Forget any outstanding snapshot requests for the given subscriber
+// so that a late reply does not invoke a removed callback.
+static void _drop_snapshot_requests(vss_signal_t* sig, vsd_subscriber_cb_t callback)
+{
+    snapshot_request_t* req = 0;
+    snapshot_request_t* tmp = 0;
+
+    HASH_ITER(hh, _snapshot_requests, req, tmp) {
+        if (req->signal == sig && req->callback == callback)
+            _free_snapshot_request(req);
+    }
+}
+
+// Number of VSD_SUBSCRIBE_ON_CHANGE subscribers. Values are only
+// compared with the stored ones while this is non-zero.
+static uint32_t _change_subscriber_count = 0;
+
+// Subscription made with vsd_subscribe_ctx(). Subscriptions live in
+// the _subs slab and are chained per signal through their indices,
+// which, unlike pointers, survive the slab being reallocated.
+typedef struct {
+    vsd_subscriber_ctx_cb_t callback; // Nil once unsubscribed.
+    void* user_data;
+    vss_signal_t* sig;
+    uint32_t next;
+    uint32_t prev;
+    // Next free slot, or next unsubscribed one waiting for _sweep_subs().
+    uint32_t next_free;
+    // Bumped when the slot is released, so that handles to
+    // earlier subscriptions in the slot no longer match.
+    uint32_t generation;
+    uint8_t on_change;
+} subscription_t;
+
+// Slot 0 is never used, so that index 0 can terminate the lists.
+static subscription_t* _subs = 0;
+static uint32_t _subs_allocated = 0;
+static uint32_t _subs_used = 1;
+static uint32_t _subs_free = 0;
+
+// Subscriptions removed during dispatch, unlinked once it is done.
+static uint32_t _subs_removed = 0;
+
+// Greater than zero while vsd_receive_frame() runs subscription
+// callbacks. Callbacks may receive frames themselves, through an
+// inline loopback transport.
+static int _subs_dispatch_depth = 0;
+
+static uint32_t _alloc_sub(void)
+{
+    uint32_t ind = _subs_free;
+
+    if (ind) {
+        _subs_free = _subs[ind].next_free;
+        return ind;
+    }
+
+    if (_subs_used >= _subs_allocated) {
+        uint32_t allocated = _subs_allocated ? _subs_allocated * 2 : 64;
+        subscription_t* subs = realloc(_subs, allocated * sizeof(subscription_t));
+
+        if (!subs) {
+            RMC_LOG_FATAL("Failed to allocate %ld bytes.", allocated * sizeof(subscription_t));
+            exit(255);
+        }
+        memset(subs + _subs_allocated, 0,
+               (allocated - _subs_allocated) * sizeof(subscription_t));
+        _subs = subs;
+        _subs_allocated = allocated;
+    }
+    return _subs_used++;
+}
+
+// Unlink a subscription from its signal and return its slot to the free list.
+static void _release_sub(uint32_t ind)
+{
+    subscription_t* sub = &_subs[ind];
+    vsd_user_data_t* ud = vsd_user_data(sub->sig);
+
+    if (sub->prev)
+        _subs[sub->prev].next = sub->next;
+    else
+        ud->first_sub = sub->next;
+
+    if (sub->next)
+        _subs[sub->next].prev = sub->prev;
+    else
+        ud->last_sub = sub->prev;
+
+    sub->sig = 0;
+    sub->user_data = 0;
+    sub->next_free = _subs_free;
+    _subs_free = ind;
+}
+
+static void _sweep_subs(void)
+{
+    while(_subs_removed) {
+        uint32_t ind = _subs_removed;
+
+        _subs_removed = _subs[ind].next_free;
+        _release_sub(ind);
+    }
+}
+
+int vsd_subscribe_ctx(vsd_context_t* ctx,
+                      vss_signal_t* sig,
+                      vsd_subscriber_ctx_cb_t callback,
+                      void* user_data,
+                      uint32_t flags,
+                      vsd_subscription_t* handle)
+{
+    vsd_user_data_t* ud = 0;
+    subscription_t* sub = 0;
+    uint32_t ind = 0;
+
+    if (!sig || !callback || !handle || (flags & ~VSD_SUBSCRIBE_ON_CHANGE))
+        return EINVAL;
+
+    ud = vsd_user_data(sig);
+    ind = _alloc_sub();
+    sub = &_subs[ind];
+
+    sub->callback = callback;
+    sub->user_data = user_data;
+    sub->sig = sig;
+    sub->on_change = (flags & VSD_SUBSCRIBE_ON_CHANGE) ? 1 : 0;
+    sub->next = 0;
+    sub->prev = ud->last_sub;
+    sub->next_free = 0;
+
+    if (ud->last_sub)
+        _subs[ud->last_sub].next = ind;
+    else
+        ud->first_sub = ind;
+    ud->last_sub = ind;
+
+    if (sub->on_change) {
+        ud->change_subs++;
+        _change_subscriber_count++;
+    }
+
+    *handle = ((uint64_t) sub->generation << 32) | ind;
+    vsd_interest_changed();
+    return 0;
+}
+
+int vsd_unsubscribe_handle(vsd_context_t* ctx, vsd_subscription_t handle)
+{
+    uint32_t ind = (uint32_t) handle;
+    subscription_t* sub = 0;
+
+    if (!ind || ind >= _subs_used)
+        return ESRCH;
+
+    sub = &_subs[ind];
+    if (!sub->callback || sub->generation != (uint32_t) (handle >> 32))
+        return ESRCH;
+
+    if (sub->on_change) {
+        vsd_user_data(sub->sig)->change_subs--;
+        _change_subscriber_count--;
+    }
+
+    sub->callback = 0;
+    sub->generation++;
+    vsd_interest_changed();
+
+    // A callback may be unsubscribing while the list is being walked
+    // by vsd_receive_frame(). Leave the slot linked until it is done.
+    if (_subs_dispatch_depth) {
+        sub->next_free = _subs_removed;
+        _subs_removed = ind;
+        return 0;
+    }
+
+    _release_sub(ind);
+    return 0;
+}
+
 int vsd_subscribe(vsd_context_t* ctx,
                   vss_signal_t* sig,
                   vsd_subscriber_cb_t callback)
 {
     vsd_subscriber_list_push_tail(vsd_subscribers(sig), callback);
+    vsd_interest_changed();
+    return 0;
+}
+
+int vsd_subscribe_ext(vsd_context_t* ctx,
+                      vss_signal_t* sig,
+                      vsd_subscriber_cb_t callback,
+                      uint32_t flags)
+{
+    int res = 0;
+
+    if (!sig || !callback ||
+        (flags & ~(VSD_SUBSCRIBE_SNAPSHOT | VSD_SUBSCRIBE_CONFLATE | VSD_SUBSCRIBE_ON_CHANGE)))
+        return EINVAL;
+
+    // Conflated delivery does not track which values changed.
+    if ((flags & VSD_SUBSCRIBE_CONFLATE) && (flags & VSD_SUBSCRIBE_ON_CHANGE))
+        return EINVAL;
+
+    if (flags & VSD_SUBSCRIBE_CONFLATE)
+        res = vsd_conflate_subscribe(sig, callback);
+    else if (flags & VSD_SUBSCRIBE_ON_CHANGE) {
+        vsd_subscriber_list_push_tail(&vsd_user_data(sig)->change_subscribers, callback);
+        _change_subscriber_count++;
+        vsd_interest_changed();
+    } else
+        res = vsd_subscribe(ctx, sig, callback);
+
+    if (res)
+        return res;
+
+    if (flags & VSD_SUBSCRIBE_SNAPSHOT)
+        return vsd_request_snapshot(ctx, sig, callback);
+
     return 0;
 }
 
@@ -448,71 +1566,468 @@ int vsd_unsubscribe(vsd_context_t* ctx,
                     vss_signal_t* sig,
                     vsd_subscriber_cb_t callback)
 {
-    vsd_subscriber_node_t* node = 0;
+    vsd_subscriber_node_t* node = 0;
+
+    node = vsd_subscriber_list_find_node(vsd_subscribers(sig),
+                                         callback,
+                                         _subscriber_compare, 0);
+
+    // Not a regular subscriber. Try on change and conflating subscriptions.
+    if (!node) {
+        node = vsd_subscriber_list_find_node(&vsd_user_data(sig)->change_subscribers,
+                                             callback,
+                                             _subscriber_compare, 0);
+        if (node) {
+            vsd_subscriber_list_delete(node);
+            _change_subscriber_count--;
+            _drop_snapshot_requests(sig, callback);
+            vsd_interest_changed();
+            return 0;
+        }
+
+        if (vsd_conflate_unsubscribe(sig, callback))
+            return ESRCH; // No such subscriber.
+
+        _drop_snapshot_requests(sig, callback);
+        return 0;
+    }
+
+    vsd_subscriber_list_delete(node);
+    _drop_snapshot_requests(sig, callback);
+    vsd_interest_changed();
+    return 0;
+}
+
+
+// Encode the frame published by vsd_publish() into buf.
+// len is left at 0 if the publish was skipped or held.
+static int _encode_publish(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len)
+{
+    int res = 0;
+
+    switch(vsd_interest_filter(sig)) {
+    case VSD_INTEREST_SKIP:
+        // No node subscribes to anything the frame would carry.
+        vsd_user_data(sig)->dirty = 0;
+        vsd_stats(sig)->skipped_publishes++;
+        return 0;
+
+    case VSD_INTEREST_HOLD:
+        // Published with the latest values once the period has passed.
+        vsd_stats(sig)->held_publishes++;
+        return 0;
+    }
+
+    VSD_LATENCY_START(encode_start);
+
+    res = encode_frame(sig, buf, buf_sz, len, 0);
+    if (res) {
+        RMC_LOG_ERROR("Could not publish signal %s: %s",
+                      sig->uuid, strerror(res));
+        if (res == ENOMEM)
+            vsd_error_stats(sig)->oversize_frames++;
+
+        // Auto publishing is only armed as dirty leaves 0. Let the
+        // next set try again.
+        vsd_user_data(sig)->dirty = 0;
+        return res;
+    }
+
+    // Leaf signals were counted by encode_signal().
+    if (sig->element_type == VSS_BRANCH) {
+        vsd_stats(sig)->published++;
+        vsd_stats(sig)->bytes_encoded += *len;
+    }
+
+    VSD_LATENCY_RECORD(sig, VSD_LATENCY_ENCODE, encode_start);
+
+    vsd_user_data(sig)->dirty = 0;
+
+    RMC_LOG_INFO("Sending signal%s: %d bytes payload",
+                 sig->uuid, *len);
+    return 0;
+}
+
+
+// Send out all signals under sig as an atomic update
+int vsd_publish(vss_signal_t* sig)
+{
+    uint8_t buf[0xFF00];
+    int len = 0;
+    int res = 0;
+
+    // A loopback thread may be delivering frames. Leave the lock
+    // before transmitting, since a threaded loopback blocks while
+    // its queue is full.
+    if (vsd_loopback_threads) {
+        pthread_mutex_lock(&vsd_loopback_lock);
+        res = _encode_publish(sig, buf, sizeof(buf), &len);
+        pthread_mutex_unlock(&vsd_loopback_lock);
+    } else
+        res = _encode_publish(sig, buf, sizeof(buf), &len);
+
+    if (res || !len)
+        return res;
+
+    // Use the four first bytes of the subtree signature for the signal (or signal tree)
+    // we are transmitting. If the receiver's corresponding signautre
+    // does not match it means that the specs used for the subtree differ between
+    // the pubhlisher and the receiver.
+    return (*_transport->transmit)(_transport, sig->signature, buf, len);
+}
+
+
+int vsd_set_transport(vsd_context_t* ctx, vsd_transport_t* transport)
+{
+    if (transport && !transport->transmit)
+        return EINVAL;
+
+    _transport = transport?transport:&vsd_dstc_transport;
+    RMC_LOG_DEBUG("Using %s transport", _transport->name);
+    return 0;
+}
+
+
+vsd_transport_t* vsd_get_transport(vsd_context_t* ctx)
+{
+    return _transport;
+}
+
+
+// Coalesce window for an auto published branch has passed.
+static void _auto_publish_fire(vsd_timer_t* timer, int64_t now_usec)
+{
+    vsd_auto_publish_t* ap = (vsd_auto_publish_t*) timer->user_data;
+
+    // Published manually while we were waiting?
+    if (!vsd_user_data(ap->sig)->dirty)
+        return;
+
+    vsd_publish(ap->sig);
+}
+
+
+int vsd_auto_publish(vsd_context_t* ctx,
+                     vss_signal_t* sig,
+                     uint32_t coalesce_msec)
+{
+    vsd_user_data_t* ud = 0;
+
+    if (!sig)
+        return EINVAL;
+
+    ud = vsd_user_data(sig);
+
+    // Already registered? Just update the window.
+    if (ud->auto_publish) {
+        ud->auto_publish->coalesce_msec = coalesce_msec;
+        return 0;
+    }
+
+    ud->auto_publish = (vsd_auto_publish_t*) malloc(sizeof(vsd_auto_publish_t));
+    if (!ud->auto_publish) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", sizeof(vsd_auto_publish_t));
+        exit(255);
+    }
+
+    ud->auto_publish->sig = sig;
+    ud->auto_publish->coalesce_msec = coalesce_msec;
+    vsd_timer_init(&ud->auto_publish->timer, _auto_publish_fire, ud->auto_publish);
+
+    // Counters have not been maintained while no branch was
+    // registered. Start out clean.
+    ud->dirty = 0;
+    ++_auto_publish_count;
+    return 0;
+}
+
+
+int vsd_auto_publish_cancel(vsd_context_t* ctx, vss_signal_t* sig)
+{
+    vsd_user_data_t* ud = 0;
+
+    if (!sig)
+        return EINVAL;
+
+    ud = vsd_user_data(sig);
+
+    if (!ud->auto_publish)
+        return ESRCH;
+
+    vsd_timer_cancel(&ud->auto_publish->timer);
+    free(ud->auto_publish);
+    ud->auto_publish = 0;
+    --_auto_publish_count;
+    return 0;
+}
+
+
+// Passed to _invoke_subscriber() by vsd_signal_transmit()
+typedef struct {
+    vss_signal_t* sig;          // Root of the received frame.
+    vsd_signal_list_t* res_lst; // Decoded signals.
+} dispatch_t;
+
+// Return non-zero if sig or any of its ancestors has on change subscribers.
+static int _has_change_subscribers(vss_signal_t* sig)
+{
+    if (!_change_subscriber_count)
+        return 0;
+
+    while(sig) {
+        if (sig->user_data &&
+            (((vsd_user_data_t*) sig->user_data)->change_subs ||
+             vsd_subscriber_list_size(&((vsd_user_data_t*) sig->user_data)->change_subscribers)))
+            return 1;
+
+        sig = sig->parent;
+    }
+    return 0;
+}
+
+static uint8_t _invoke_subscriber(vsd_subscriber_node_t* node, void* user_data)
+{
+    dispatch_t *dispatch = (dispatch_t*) user_data;
+
+    VSD_LATENCY_START(callback_start);
+    (*node->data)(0, dispatch->res_lst);
+    VSD_LATENCY_RECORD(dispatch->sig, VSD_LATENCY_CALLBACK, callback_start);
+    return 1;
+}
+
+// Invoke the vsd_subscribe_ctx() subscriptions of sig and its
+// ancestors. Regular subscriptions get res_lst, on change ones get
+// chg_lst if it holds any signals.
+static void _invoke_subs(vsd_context_t* ctx,
+                         vss_signal_t* sig,
+                         vsd_signal_list_t* res_lst,
+                         vsd_signal_list_t* chg_lst)
+{
+    vss_signal_t* current = sig;
+    int changed = vsd_signal_list_size(chg_lst) > 0;
+
+    _subs_dispatch_depth++;
+    while(current) {
+        uint32_t ind = current->user_data ?
+            ((vsd_user_data_t*) current->user_data)->first_sub : 0;
+
+        while(ind) {
+            // _subs may be reallocated by a callback subscribing.
+            // Do not hold on to pointers into it across calls.
+            subscription_t* sub = &_subs[ind];
+
+            if (sub->callback && (!sub->on_change || changed)) {
+                VSD_LATENCY_START(callback_start);
+                (*sub->callback)(ctx, sub->on_change ? chg_lst : res_lst, sub->user_data);
+                VSD_LATENCY_RECORD(sig, VSD_LATENCY_CALLBACK, callback_start);
+            }
+            ind = _subs[ind].next;
+        }
+        current = current->parent;
+    }
+    _subs_dispatch_depth--;
+
+    if (!_subs_dispatch_depth && _subs_removed)
+        _sweep_subs();
+}
+
+int vsd_has_subscribers(vss_signal_t* sig)
+{
+    vsd_user_data_t* ud = (vsd_user_data_t*) sig->user_data;
+
+    return ud &&
+        (ud->first_sub ||
+         vsd_subscriber_list_size(&ud->subscribers) ||
+         vsd_subscriber_list_size(&ud->change_subscribers));
+}
+
+// Return non-zero if a frame received on sig is handed to any
+// subscriber, and so has to be decoded on arrival.
+static int _has_interest(vss_signal_t* sig)
+{
+    vss_signal_t* current = sig;
+
+    if (vsd_pattern_count > vsd_rate_limited_count ||
+        vsd_value_table_mode == VSD_VALUE_TABLE_OWNER)
+        return 1;
+
+    while(current) {
+        if (vsd_has_subscribers(current))
+            return 1;
+
+        current = current->parent;
+    }
+
+    // Rate limited subscriptions only need the frame once their
+    // period has passed.
+    return vsd_rate_limited_count && vsd_pattern_due(sig);
+}
+
+// Decode a held frame and release it.
+static void _lazy_decode_frame(vsd_lazy_frame_t* lazy)
+{
+    vsd_signal_list_t res_lst;
+    frame_info_t frame;
+    int res = 0;
+
+    vsd_signal_list_init(&res_lst, 0, 0, 0);
+    res = decode_frame(0, lazy->sig, lazy->data, lazy->len, &res_lst, 0, &frame, lazy);
+
+    if (res) {
+        RMC_LOG_ERROR("Could not decode held signal %s tree: %s",
+                      lazy->sig->uuid, strerror(res));
+        vsd_error_stats(lazy->sig)->decode_errors++;
+    } else if (lazy->sig->element_type == VSS_BRANCH)
+        vsd_stats(lazy->sig)->bytes_decoded += lazy->len;
+
+    vsd_signal_list_empty(&res_lst);
+    lazy->len = 0;
+    _lazy_pending--;
+}
+
+// Hold a copy of a frame received on sig, in place of any frame
+// already held for it.
+static void _lazy_hold(vss_signal_t* sig, const uint8_t* data, uint32_t len)
+{
+    vsd_user_data_t* ud = vsd_user_data(sig);
+    vsd_lazy_frame_t* lazy = ud->lazy;
+
+    if (!lazy) {
+        lazy = (vsd_lazy_frame_t*) calloc(1, sizeof(vsd_lazy_frame_t));
+        if (!lazy) {
+            RMC_LOG_FATAL("Failed to allocate %ld bytes.", sizeof(vsd_lazy_frame_t));
+            exit(255);
+        }
+
+        if (_lazy_frame_count == _lazy_frame_allocated) {
+            _lazy_frame_allocated = _lazy_frame_allocated ? _lazy_frame_allocated * 2 : 64;
+            _lazy_frames = (vsd_lazy_frame_t**) realloc(_lazy_frames,
+                                                        _lazy_frame_allocated * sizeof(vsd_lazy_frame_t*));
+            if (!_lazy_frames) {
+                RMC_LOG_FATAL("Could not allocate %d held frame entries", _lazy_frame_allocated);
+                exit(255);
+            }
+        }
+
+        lazy->sig = sig;
+        ud->lazy = lazy;
+        _lazy_frames[_lazy_frame_count++] = lazy;
+    }
+
+    // Values rejected from the new frame leave the ones of the
+    // replaced frame in place.
+    if (lazy->len && vsd_validation == VSD_VALIDATE_STRICT)
+        _lazy_decode_frame(lazy);
+
+    if (lazy->allocated < len) {
+        lazy->data = (uint8_t*) realloc(lazy->data, len);
+        if (!lazy->data) {
+            RMC_LOG_FATAL("Failed to allocate %u bytes.", len);
+            exit(255);
+        }
+        lazy->allocated = len;
+    }
+
+    if (!lazy->len)
+        _lazy_pending++;
+
+    memcpy(lazy->data, data, len);
+    lazy->len = len;
+    lazy->seq = ++_frame_seq;
+}
+
+int vsd_signal_related(vss_signal_t* a, vss_signal_t* b)
+{
+    vss_signal_t* current = 0;
 
-    node = vsd_subscriber_list_find_node(vsd_subscribers(sig),
-                                         callback,
-                                         _subscriber_compare, 0);
+    for(current = b; current; current = current->parent)
+        if (current == a)
+            return 1;
 
-    if (!node)
-        return ESRCH; // No such subscriber.
+    for(current = a->parent; current; current = current->parent)
+        if (current == b)
+            return 1;
 
-    vsd_subscriber_list_delete(node);
     return 0;
 }
 
-
-// Send out all signals under sig as an atomic update
-int vsd_publish(vss_signal_t* sig)
+// Decode the held frames that carry values for signals under sig,
+// oldest first. All held frames are decoded if sig is nil.
+static void _lazy_resolve(vss_signal_t* sig)
 {
-    uint8_t buf[0xFF00];
-    int len = 0;
-    int res = 0;
-
-    res = encode_signal(sig, buf, sizeof(buf), &len);
-    if (res) {
-        RMC_LOG_ERROR("Could not publish signal %s: %s",
-                      sig->uuid, strerror(res));
-        return res;
-    }
+    while(_lazy_pending) {
+        vsd_lazy_frame_t* oldest = 0;
+        uint32_t ind = 0;
+
+        if (sig && sig->element_type != VSS_BRANCH) {
+            // A leaf is only carried by frames on itself and its
+            // ancestors. Frames older than its value can be skipped.
+            uint64_t seq = vsd_user_data(sig)->seq;
+            vss_signal_t* current = 0;
+
+            for(current = sig; current; current = current->parent) {
+                vsd_lazy_frame_t* lazy = current->user_data ?
+                    ((vsd_user_data_t*) current->user_data)->lazy : 0;
+
+                if (lazy && lazy->len && lazy->seq > seq &&
+                    (!oldest || lazy->seq < oldest->seq))
+                    oldest = lazy;
+            }
+        } else
+            for(ind = 0; ind < _lazy_frame_count; ++ind) {
+                vsd_lazy_frame_t* lazy = _lazy_frames[ind];
+
+                if (lazy->len &&
+                    (!oldest || lazy->seq < oldest->seq) &&
+                    (!sig || vsd_signal_related(sig, lazy->sig)))
+                    oldest = lazy;
+            }
 
-    RMC_LOG_INFO("Sending signal%s: %d bytes payload",
-                 sig->uuid, len);
+        if (!oldest)
+            return;
 
-    // Use the four first bytes of the subtree signature for the signal (or signal tree)
-    // we are transmitting. If the receiver's corresponding signautre
-    // does not match it means that the specs used for the subtree differ between
-    // the pubhlisher and the receiver.
-    return dstc_vsd_signal_transmit(sig->signature, DSTC_DYNAMIC_ARG(buf, len));
+        _lazy_decode_frame(oldest);
+    }
 }
 
-
-static uint8_t _invoke_subscriber(vsd_subscriber_node_t* node, void* user_data)
+void vsd_lazy_resolve(vss_signal_t* sig)
 {
-    vsd_signal_list_t *res_lst = (vsd_signal_list_t*) user_data;
-
-    (*node->data)(0, res_lst);
-    return 1;
+    if (_lazy_pending)
+        _lazy_resolve(sig);
 }
 
+int vsd_set_lazy_decode(vsd_context_t* ctx, int enable)
+{
+    _lazy_decode = enable;
+
+    if (!enable && _lazy_pending)
+        _lazy_resolve(0);
 
+    return 0;
+}
 
 
 // Receive and deceode incoming signal, followed by invoking all callbacks.
-// This function is invoked by DSTC as a result of a remote node
-// calling vsd_transmit() through dstc_publish_signal() above.
-void vsd_signal_transmit(uint32_t vss_signature, dstc_dynamic_data_t dynarg)
+int vsd_receive_frame(vsd_context_t* ctx,
+                      uint32_t vss_signature,
+                      const uint8_t* data,
+                      uint16_t len)
 {
     int res = 0;
     vss_signal_t* current = 0;
     vss_signal_t* sig = 0;
     vsd_signal_list_t res_lst;
+    vsd_signal_list_t chg_lst;
+    int track_changes = 0;
+    frame_info_t frame;
+    dispatch_t dispatch;
 
     sig = _get_signal_by_signature(vss_signature);
     if (!sig) {
-        RMC_LOG_ERROR("Could not resovle index %d to a signal\n",
-                      sig, strerror(res));
-        return;
+        RMC_LOG_ERROR("Could not resolve signature 0x%X to a signal\n",
+                      vss_signature);
+        vsd_unknown_signatures++;
+        return ENOENT;
     }
 
 
@@ -527,24 +2042,288 @@ void vsd_signal_transmit(uint32_t vss_signature, dstc_dynamic_data_t dynarg)
         exit(255);
     }
 
+    // Nobody is handed the frame. Decode it once its values are asked for.
+    if (_lazy_decode && len && !_has_interest(sig)) {
+        _lazy_hold(sig, data, len);
+        vsd_stats(sig)->lazy_frames++;
+        if (sig->element_type == VSS_BRANCH)
+            vsd_stats(sig)->received++;
+
+        if (vsd_rate_limited_count)
+            vsd_pattern_held(sig);
+        return 0;
+    }
+
     vsd_signal_list_init(&res_lst, 0, 0, 0);
+    vsd_signal_list_init(&chg_lst, 0, 0, 0);
+    track_changes = _has_change_subscribers(sig);
+
+    // Changes are detected against the stored values, which
+    // may still be waiting in held frames.
+    if (track_changes && _lazy_pending)
+        _lazy_resolve(sig);
 
-    res = decode_signal(0, dynarg.data, dynarg.length, &res_lst);
+    VSD_LATENCY_START(decode_start);
+    res = decode_frame(ctx, sig, data, len, &res_lst,
+                       track_changes ? &chg_lst : 0, &frame, 0);
 
     if (res) {
         RMC_LOG_ERROR("Could not decode incoming signal %s tree: %s",
                       sig->uuid, strerror(res));
-        return;
+        vsd_error_stats(sig)->decode_errors++;
+        vsd_error_stats(sig)->dropped_deliveries++;
+        vsd_signal_list_empty(&res_lst);
+        vsd_signal_list_empty(&chg_lst);
+        return res;
+    }
+
+    // Leaf signals were counted by decode_signal().
+    if (sig->element_type == VSS_BRANCH) {
+        vsd_stats(sig)->received++;
+        vsd_stats(sig)->bytes_decoded += len;
+    }
+    VSD_LATENCY_RECORD(sig, VSD_LATENCY_DECODE, decode_start);
+
+#ifdef VSD_INSTRUMENTATION
+    // Time from publish to now, if the publisher provided a timestamp.
+    // Only meaningful if publisher and subscriber share a clock.
+    if (frame.flags & FRAME_TIMESTAMP) {
+        uint64_t now = vsd_timestamp_now(0);
+
+        vsd_latency_record(sig, VSD_LATENCY_TRANSPORT,
+                           (now > frame.timestamp)?(now - frame.timestamp):0);
     }
+#endif
 
     // Traverse signal tree, as provided in the root id argument,
     // upward and invoke subscribers.
+    dispatch.sig = sig;
+    dispatch.res_lst = &res_lst;
+
+    VSD_LATENCY_START(dispatch_start);
     current = sig;
     while(current) {
         vsd_subscriber_list_for_each(vsd_subscribers(current),
-                                     _invoke_subscriber, &res_lst);
+                                     _invoke_subscriber, &dispatch);
         current = current->parent;
     }
+
+    // On change subscribers only get the changed signals, if any.
+    if (vsd_signal_list_size(&chg_lst)) {
+        dispatch.res_lst = &chg_lst;
+        current = sig;
+        while(current) {
+            vsd_subscriber_list_for_each(&vsd_user_data(current)->change_subscribers,
+                                         _invoke_subscriber, &dispatch);
+            current = current->parent;
+        }
+    }
+
+    if (_subs_used > 1)
+        _invoke_subs(ctx, sig, &res_lst, &chg_lst);
+
+    if (vsd_pattern_count)
+        vsd_pattern_dispatch(sig, &res_lst);
+
+    VSD_LATENCY_RECORD(sig, VSD_LATENCY_DISPATCH, dispatch_start);
+
+    vsd_signal_list_empty(&res_lst);
+    vsd_signal_list_empty(&chg_lst);
+    return 0;
+}
+
+
+// Return 1 if the frame in buf was published on this host.
+static int _frame_is_local(const uint8_t* buf, int buf_sz)
+{
+    int offset = 2;
+    uint64_t origin = 0;
+
+    if (buf_sz < offset || buf[0] != FRAME_VERSION || !(buf[1] & FRAME_ORIGIN))
+        return 0;
+
+    if (buf[1] & FRAME_TIMESTAMP)
+        offset += sizeof(uint64_t);
+
+    if (buf_sz < offset + sizeof(origin))
+        return 0;
+
+    memcpy(&origin, buf + offset, sizeof(origin));
+    return origin == vsd_frame_origin;
+}
+
+
+// Invoked by DSTC as a result of a remote node calling
+// vsd_publish() with the default transport.
+void vsd_signal_transmit(uint32_t vss_signature, dstc_dynamic_data_t dynarg)
+{
+    // Frames multicast by publishers on this host have already
+    // been delivered through shared memory.
+    if (vsd_frame_origin && _frame_is_local(dynarg.data, dynarg.length))
+        return;
+
+    vsd_receive_frame(0, vss_signature, dynarg.data, dynarg.length);
+}
+
+
+// Deliver all signals received in replies to a snapshot request,
+// and free it.
+static void _snapshot_expire(vsd_timer_t* timer, int64_t now_usec)
+{
+    snapshot_request_t* req = (snapshot_request_t*) timer->user_data;
+    vsd_subscriber_cb_t callback = req->callback;
+    int words = (vss_get_signal_count() + 63) / 64;
+    vsd_signal_list_t lst;
+    int ind = 0;
+
+    vsd_signal_list_init(&lst, 0, 0, 0);
+    for(ind = 0; ind < words; ++ind) {
+        uint64_t word = req->received[ind];
+
+        while(word) {
+            vsd_signal_list_push_tail(&lst, vss_get_signal_by_index((ind << 6) + __builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+
+    // Freed first, in case the callback unsubscribes.
+    _free_snapshot_request(req);
+
+    if (vsd_signal_list_size(&lst))
+        (*callback)(0, &lst);
+
+    vsd_signal_list_empty(&lst);
+}
+
+static uint8_t _mark_received(vsd_signal_node_t* node, void* user_data)
+{
+    uint64_t* received = (uint64_t*) user_data;
+    int index = node->data->index;
+
+    if (index >= 0 && index < vss_get_signal_count())
+        received[index >> 6] |= (uint64_t) 1 << (index & 63);
+
+    return 1;
+}
+
+// Ask the network for the current values of all signals under sig.
+int vsd_request_snapshot(vsd_context_t* ctx,
+                         vss_signal_t* sig,
+                         vsd_subscriber_cb_t callback)
+{
+    snapshot_request_t* req = 0;
+    int words = (vss_get_signal_count() + 63) / 64;
+
+    // Seed request ids with our pid to keep them apart from the
+    // ids used by other nodes.
+    if (!_snapshot_request_id)
+        _snapshot_request_id = ((uint32_t) getpid() << 16) ^
+            (uint32_t) dstc_msec_monotonic_timestamp();
+
+    req = (snapshot_request_t*) malloc(sizeof(snapshot_request_t));
+    if (!req) {
+        RMC_LOG_FATAL("Could not allocate %d bytes", sizeof(snapshot_request_t));
+        exit(255);
+    }
+
+    req->received = (uint64_t*) calloc(words ? words : 1, sizeof(uint64_t));
+    if (!req->received) {
+        RMC_LOG_FATAL("Could not allocate %d bitset words", words);
+        exit(255);
+    }
+
+    req->request_id = ++_snapshot_request_id;
+    req->signal = sig;
+    req->callback = callback;
+    HASH_ADD_INT(_snapshot_requests, request_id, req);
+
+    // Replies are collected until the window closes, whether or
+    // not any arrive.
+    vsd_timer_init(&req->timer, _snapshot_expire, req);
+    vsd_timer_start(&req->timer, vsd_msec_monotonic_timestamp() + VSD_SNAPSHOT_WINDOW_MSEC);
+
+    RMC_LOG_DEBUG("Requesting snapshot of %s with request id 0x%X",
+                  sig->uuid, req->request_id);
+
+    return dstc_vsd_snapshot_request(req->request_id, sig->signature);
+}
+
+
+// Invoked by DSTC when a node calls vsd_request_snapshot().
+// If we hold values for any signal under the requested signal,
+// reply with a single frame containing those values.
+void vsd_snapshot_request(uint32_t request_id, uint32_t vss_signature)
+{
+    uint8_t buf[0xFF00];
+    snapshot_request_t* req = 0;
+    vss_signal_t* sig = 0;
+    int len = 0;
+    int res = 0;
+
+    // Is this our own request looped back to us?
+    HASH_FIND_INT(_snapshot_requests, &request_id, req);
+    if (req)
+        return;
+
+    sig = _get_signal_by_signature(vss_signature);
+
+    // Unknown signals are not an error here, since we
+    // may simply be running a different spec version.
+    if (!sig)
+        return;
+
+    res = encode_frame(sig, buf, sizeof(buf), &len, 1);
+
+    // Nothing to report.
+    if (res == ENODATA)
+        return;
+
+    if (res) {
+        RMC_LOG_ERROR("Could not encode snapshot of signal %s: %s",
+                      sig->uuid, strerror(res));
+        return;
+    }
+
+    RMC_LOG_DEBUG("Replying to snapshot request 0x%X for %s: %d bytes payload",
+                  request_id, sig->uuid, len);
+
+    dstc_vsd_snapshot_reply(request_id, vss_signature, DSTC_DYNAMIC_ARG(buf, len));
+}
+
+
+// Invoked by DSTC when a node replies to a snapshot request.
+// Replies to requests made by other nodes, or arriving after the
+// window of our own request has closed, are ignored.
+void vsd_snapshot_reply(uint32_t request_id,
+                        uint32_t vss_signature,
+                        dstc_dynamic_data_t dynarg)
+{
+    snapshot_request_t* req = 0;
+    vsd_signal_list_t res_lst;
+    frame_info_t frame;
+    int res = 0;
+
+    HASH_FIND_INT(_snapshot_requests, &request_id, req);
+    if (!req)
+        return;
+
+    if (req->signal->signature != vss_signature) {
+        RMC_LOG_ERROR("Snapshot signature mismatch for %s. My signature: 0x%X. Their signature: 0x%X",
+                      req->signal->uuid, req->signal->signature, vss_signature);
+        return;
+    }
+
+    vsd_signal_list_init(&res_lst, 0, 0, 0);
+    res = decode_frame(0, req->signal, dynarg.data, dynarg.length, &res_lst, 0, &frame, 0);
+
+    // Replies from nodes owning different subtrees are merged,
+    // and delivered together when the window closes.
+    if (res)
+        RMC_LOG_ERROR("Could not decode snapshot of signal %s tree: %s",
+                      req->signal->uuid, strerror(res));
+    else
+        vsd_signal_list_for_each(&res_lst, _mark_received, req->received);
+
     vsd_signal_list_empty(&res_lst);
 }
 
@@ -561,30 +2340,53 @@ int vsd_get_value(vss_signal_t* sig,
         return EINVAL;
     }
 
+    // Decode any held frame carrying a newer value.
+    if (_lazy_pending)
+        _lazy_resolve(sig);
+
+    // Refresh our copy from the table maintained by another process.
+    if (vsd_value_table_mode == VSD_VALUE_TABLE_CLIENT) {
+        int res = vsd_value_table_load(sig, vsd_data(sig), &vsd_user_data(sig)->timestamp);
+
+        if (res)
+            return res;
+    }
+
     *result = *vsd_data(sig);
     return 0;
 }
 
+int vsd_get_value_ts(vss_signal_t* sig,
+                     vsd_data_u *result,
+                     uint64_t* timestamp)
+{
+    int res = vsd_get_value(sig, result);
+
+    if (res)
+        return res;
+
+    *timestamp = vsd_user_data(sig)->timestamp;
+    return 0;
+}
+
 
 
 // -----
 int vsd_set_value_by_signal_boolean(vsd_context_t* context, vss_signal_t* sig, uint8_t val)
 {
-    vsd_data(sig)->b = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .b = val });
 }
 
 
-int vsd_set_value_by_path_boolean(vsd_context_t* context, char* path, uint8_t val)
+int vsd_set_value_by_path_boolean(vsd_context_t* context, const char* path, uint8_t val)
 {
     vss_signal_t*  sig  = 0;
-    int res =vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->b = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .b = val });
 }
 
 
@@ -595,28 +2397,24 @@ int vsd_set_value_by_index_boolean(vsd_context_t* context, int index, uint8_t va
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->b = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .b = val });
 }
 
 
 int vsd_set_value_by_signal_int8(vsd_context_t* context, vss_signal_t* sig, int8_t val)
 {
-    vsd_data(sig)->i8 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i8 = val });
 }
 
-int vsd_set_value_by_path_int8(vsd_context_t* context, char* path, int8_t val)
+int vsd_set_value_by_path_int8(vsd_context_t* context, const char* path, int8_t val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->i8 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i8 = val });
 }
 
 int vsd_set_value_by_index_int8(vsd_context_t* context, int index, int8_t val)
@@ -626,27 +2424,23 @@ int vsd_set_value_by_index_int8(vsd_context_t* context, int index, int8_t val)
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->i8 = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i8 = val });
 }
 
 int vsd_set_value_by_signal_uint8(vsd_context_t* context, vss_signal_t* sig, uint8_t val)
 {
-    vsd_data(sig)->u8 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u8 = val });
 }
 
-int vsd_set_value_by_path_uint8(vsd_context_t* context, char* path, uint8_t val)
+int vsd_set_value_by_path_uint8(vsd_context_t* context, const char* path, uint8_t val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->u8 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u8 = val });
 }
 
 int vsd_set_value_by_index_uint8(vsd_context_t* context, int index, uint8_t val)
@@ -656,28 +2450,24 @@ int vsd_set_value_by_index_uint8(vsd_context_t* context, int index, uint8_t val)
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->u8 = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u8 = val });
 }
 
 
 int vsd_set_value_by_signal_int16(vsd_context_t* context, vss_signal_t* sig, int16_t val)
 {
-    vsd_data(sig)->i16 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i16 = val });
 }
 
-int vsd_set_value_by_path_int16(vsd_context_t* context, char* path, int16_t val)
+int vsd_set_value_by_path_int16(vsd_context_t* context, const char* path, int16_t val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->i16 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i16 = val });
 }
 
 int vsd_set_value_by_index_int16(vsd_context_t* context, int index, int16_t val)
@@ -687,28 +2477,24 @@ int vsd_set_value_by_index_int16(vsd_context_t* context, int index, int16_t val)
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->i16 = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i16 = val });
 }
 
 
 int vsd_set_value_by_signal_uint16(vsd_context_t* context, vss_signal_t* sig, uint16_t val)
 {
-    vsd_data(sig)->u16 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u16 = val });
 }
 
-int vsd_set_value_by_path_uint16(vsd_context_t* context, char* path, uint16_t val)
+int vsd_set_value_by_path_uint16(vsd_context_t* context, const char* path, uint16_t val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->u16 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u16 = val });
 }
 
 int vsd_set_value_by_index_uint16(vsd_context_t* context, int index, uint16_t val)
@@ -718,28 +2504,24 @@ int vsd_set_value_by_index_uint16(vsd_context_t* context, int index, uint16_t va
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->u16 = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u16 = val });
 }
 
 
 int vsd_set_value_by_signal_int32(vsd_context_t* context, vss_signal_t* sig, int32_t val)
 {
-    vsd_data(sig)->i32 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i32 = val });
 }
 
-int vsd_set_value_by_path_int32(vsd_context_t* context, char* path, int32_t val)
+int vsd_set_value_by_path_int32(vsd_context_t* context, const char* path, int32_t val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->i32 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i32 = val });
 }
 
 int vsd_set_value_by_index_int32(vsd_context_t* context, int index, int32_t val)
@@ -749,28 +2531,24 @@ int vsd_set_value_by_index_int32(vsd_context_t* context, int index, int32_t val)
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->i32 = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .i32 = val });
 }
 
 
 int vsd_set_value_by_signal_uint32(vsd_context_t* context, vss_signal_t* sig, uint32_t val)
 {
-    vsd_data(sig)->u32 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u32 = val });
 }
 
-int vsd_set_value_by_path_uint32(vsd_context_t* context, char* path, uint32_t val)
+int vsd_set_value_by_path_uint32(vsd_context_t* context, const char* path, uint32_t val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->u32 = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u32 = val });
 }
 
 int vsd_set_value_by_index_uint32(vsd_context_t* context, int index, uint32_t val)
@@ -780,28 +2558,24 @@ int vsd_set_value_by_index_uint32(vsd_context_t* context, int index, uint32_t va
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->u32 = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .u32 = val });
 }
 
 
 int vsd_set_value_by_signal_float(vsd_context_t* context, vss_signal_t* sig, float val)
 {
-    vsd_data(sig)->f = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .f = val });
 }
 
-int vsd_set_value_by_path_float(vsd_context_t* context, char* path, float val)
+int vsd_set_value_by_path_float(vsd_context_t* context, const char* path, float val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->f = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .f = val });
 }
 
 int vsd_set_value_by_index_float(vsd_context_t* context, int index, float val)
@@ -811,28 +2585,24 @@ int vsd_set_value_by_index_float(vsd_context_t* context, int index, float val)
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->f = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .f = val });
 }
 
 
 int vsd_set_value_by_signal_double(vsd_context_t* context, vss_signal_t* sig, double val)
 {
-    vsd_data(sig)->d = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .d = val });
 }
 
-int vsd_set_value_by_path_double(vsd_context_t* context, char* path, double val)
+int vsd_set_value_by_path_double(vsd_context_t* context, const char* path, double val)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
 
     if (res)
         return res;
 
-    vsd_data(sig)->d = val;
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .d = val });
 }
 
 int vsd_set_value_by_index_double(vsd_context_t* context, int index, double val)
@@ -842,9 +2612,7 @@ int vsd_set_value_by_index_double(vsd_context_t* context, int index, double val)
     if (!sig)
         return ENOENT;
 
-    vsd_data(sig)->d = val;
-
-    return 0;
+    return _assign_scalar(sig, (vsd_data_u) { .d = val });
 }
 
 
@@ -858,16 +2626,14 @@ int vsd_set_value_by_signal_string(vsd_context_t* context, vss_signal_t* sig, ch
     if (res)
         return res;
 
-    return vsd_data_copy(vsd_data(sig),
-                         &val,
-                         sig->data_type);
+    return _copy_assigned(sig, &val);
 
 }
 
-int vsd_set_value_by_path_string(vsd_context_t* context, char* path, char* data)
+int vsd_set_value_by_path_string(vsd_context_t* context, const char* path, char* data)
 {
     vss_signal_t*  sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
     vsd_data_u val;
 
     if (res)
@@ -875,10 +2641,14 @@ int vsd_set_value_by_path_string(vsd_context_t* context, char* path, char* data)
 
     res = vsd_string_to_data(sig->data_type, data, &val);
 
+    if (!res)
+        res = vsd_validate(sig, &val);
+
     if (res)
         return res;
 
     *vsd_data(sig) = val;
+    _value_assigned(sig);
 
     return 0;
 }
@@ -894,11 +2664,12 @@ int vsd_set_value_by_index_string(vsd_context_t* context, int index, char* data)
     if (res)
         return res;
 
-
+    res = vsd_validate(sig, &val);
     if (res)
         return res;
 
     *vsd_data(sig) = val;
+    _value_assigned(sig);
 
     return 0;
 }
@@ -914,13 +2685,13 @@ int vsd_set_value_by_signal_convert(vsd_context_t* context, vss_signal_t* sig, c
     if (res)
         return res;
 
-    return vsd_data_copy(vsd_data(sig), &val, sig->data_type);
+    return _copy_assigned(sig, &val);
 }
 
-int vsd_set_value_by_path_convert(vsd_context_t* context, char* path, char* value)
+int vsd_set_value_by_path_convert(vsd_context_t* context, const char* path, char* value)
 {
     vss_signal_t* sig = 0;
-    int res = vss_get_signal_by_path(path, &sig);
+    int res = _get_signal_by_path(path, &sig);
     vsd_data_u val;
 
     if (res)
@@ -931,7 +2702,7 @@ int vsd_set_value_by_path_convert(vsd_context_t* context, char* path, char* valu
     if (res)
         return res;
 
-    return vsd_data_copy(vsd_data(sig), &val, sig->data_type);
+    return _copy_assigned(sig, &val);
 }
 
 int vsd_set_value_by_index_convert(vsd_context_t* context, int index, char* value)
@@ -948,5 +2719,208 @@ int vsd_set_value_by_index_convert(vsd_context_t* context, int index, char* valu
     if (res)
         return res;
 
-    return vsd_data_copy(vsd_data(sig), &val, sig->data_type);
+    return _copy_assigned(sig, &val);
+}
+
+// Assign the text in [str, end), which is not null terminated, to sig.
+static int _assign_text(vss_signal_t* sig, const char* str, const char* end)
+{
+    vsd_data_u* dst = 0;
+    vsd_data_u val;
+    size_t len = end - str + 1;
+    int res = 0;
+
+    if (sig->data_type != VSS_STRING) {
+        res = vsd_parse_value(sig->data_type, str, end, &val);
+        if (res)
+            return res;
+
+        return _copy_assigned(sig, &val);
+    }
+
+    // Does not fit the 16 bit length of an encoded string.
+    if (len > UINT16_MAX)
+        return E2BIG;
+
+    val = (vsd_data_u) { .s.data = (char*) str, .s.len = len };
+    res = vsd_validate(sig, &val);
+    if (res)
+        return res;
+
+    // Copy straight into the value store, adding the terminator.
+    dst = vsd_data(sig);
+    _string_reserve(dst, len);
+    memcpy(dst->s.data, str, len - 1);
+    dst->s.data[len - 1] = 0;
+    dst->s.len = len;
+    _value_assigned(sig);
+    return 0;
+}
+
+int vsd_set_values_from_text(vsd_context_t* ctx,
+                             const char* text,
+                             size_t len,
+                             uint32_t* applied)
+{
+    const char* end = text + len;
+    uint32_t count = 0;
+    int first_err = 0;
+
+    if (!text)
+        return EINVAL;
+
+    while(text < end) {
+        const char* eol = (const char*) memchr(text, '\n', end - text);
+        const char* line_end = eol ? eol : end;
+        const char* colon = 0;
+        vss_signal_t* sig = 0;
+        int res = 0;
+
+        if (line_end > text && line_end[-1] == '\r')
+            line_end--;
+
+        if (line_end > text) {
+            colon = (const char*) memchr(text, ':', line_end - text);
+
+            if (!colon)
+                res = EINVAL;
+            else
+                res = _get_signal_by_path_len(text, colon - text, &sig);
+
+            if (!res)
+                res = _assign_text(sig, colon + 1, line_end);
+
+            if (!res)
+                count++;
+            else if (!first_err)
+                first_err = res;
+        }
+
+        text = eol ? eol + 1 : end;
+    }
+
+    if (applied)
+        *applied = count;
+
+    return first_err;
+}
+
+
+// Check that rec can be stored in the signal it refers to.
+static inline int _check_record(const vsd_set_record_t* rec, int signal_count)
+{
+    vss_signal_t* sig = 0;
+
+    if ((unsigned) rec->index >= (unsigned) signal_count)
+        return ENOENT;
+
+    sig = vss_get_signal_by_index(rec->index);
+
+    if (sig->element_type == VSS_BRANCH ||
+        rec->data_type != sig->data_type ||
+        (rec->data_type == VSS_STRING && (!rec->value.s.data || !rec->value.s.len)))
+        return EINVAL;
+
+    // Permissive validation clamps the stored value instead.
+    if (vsd_validation == VSD_VALIDATE_STRICT) {
+        vsd_data_u val = rec->value;
+
+        return vsd_limits_check(sig, &val);
+    }
+
+    return 0;
+}
+
+static inline void _store_record(const vsd_set_record_t* rec, uint64_t timestamp)
+{
+    vss_signal_t* sig = vss_get_signal_by_index(rec->index);
+    vsd_user_data_t* ud = vsd_user_data(sig);
+
+    if (rec->data_type == VSS_STRING)
+        vsd_data_copy(&ud->value, (vsd_data_u*) &rec->value, VSS_STRING);
+    else
+        ud->value = rec->value;
+
+    if (vsd_validation == VSD_VALIDATE_PERMISSIVE)
+        vsd_limits_check(sig, &ud->value);
+
+    _value_stored(sig, timestamp);
+}
+
+int vsd_set_values(vsd_context_t* ctx,
+                   const vsd_set_record_t* records,
+                   int count,
+                   uint32_t flags,
+                   uint32_t* applied)
+{
+    int signal_count = vss_get_signal_count();
+    uint64_t timestamp = 0;
+    vss_signal_t** deferred = 0;
+    int deferred_count = 0;
+    int deferred_allocated = 0;
+    uint32_t stored = 0;
+    int first_err = 0;
+    int ind = 0;
+
+    if (applied)
+        *applied = 0;
+
+    if (!records || count < 0)
+        return EINVAL;
+
+    // All records share a single timestamp.
+    if (_timestamp_mode != VSD_TIMESTAMP_NONE)
+        timestamp = vsd_timestamp_now(0);
+
+    if (flags & VSD_SET_ATOMIC) {
+        // Validate everything before the first value is touched.
+        for (ind = 0; ind < count; ++ind) {
+            first_err = _check_record(&records[ind], signal_count);
+            if (first_err)
+                return first_err;
+        }
+
+        _deferring = 1;
+        for (ind = 0; ind < count; ++ind)
+            _store_record(&records[ind], timestamp);
+
+        stored = count;
+    } else {
+        _deferring = 1;
+        for (ind = 0; ind < count; ++ind) {
+            int res = _check_record(&records[ind], signal_count);
+
+            if (!res) {
+                _store_record(&records[ind], timestamp);
+                stored++;
+            } else if (!first_err)
+                first_err = res;
+        }
+    }
+    _deferring = 0;
+
+    // Publish the auto published branches touched by the records,
+    // each once with all of its new values. Subscribers called by
+    // vsd_publish() may set values themselves, so the list is
+    // detached while we walk it.
+    deferred = _deferred;
+    deferred_count = _deferred_count;
+    deferred_allocated = _deferred_allocated;
+    _deferred = 0;
+    _deferred_count = 0;
+    _deferred_allocated = 0;
+
+    for (ind = 0; ind < deferred_count; ++ind)
+        vsd_publish(deferred[ind]);
+
+    if (!_deferred) {
+        _deferred = deferred;
+        _deferred_allocated = deferred_allocated;
+    } else
+        free(deferred);
+
+    if (applied)
+        *applied = stored;
+
+    return first_err;
 }
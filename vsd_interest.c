@@ -0,0 +1,477 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Interest announcements, and publishing filtered by them
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dstc.h>
+#include <rmc_log.h>
+
+DSTC_CLIENT(vsd_interest_announce, uint32_t,, uint32_t,, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_SERVER(vsd_interest_announce, uint32_t,, uint32_t,, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+
+// Each node using VSD_INTEREST_ANNOUNCE multicasts a bitset over
+// signal indices, with a bit set for every signal it subscribes to or
+// has declared an interest in. Rate limited subscriptions are instead
+// sent as a list of signal indices and periods after the bitset. The
+// announcement is sent when it changes, when asked for, and every
+// VSD_INTEREST_INTERVAL_MSEC, so that nodes that have gone away can be
+// forgotten. Each announcement carries the signature of the root
+// signal, and those from nodes built from another specification,
+// whose bitset and indices would mean other signals, are ignored.
+//
+// Nodes using VSD_INTEREST_FILTER keep the latest announcement of
+// each node. From those and their own, they derive the period each
+// signal may be published at. A frame published on a signal is of use
+// to a subscription on the signal itself or one of its ancestors,
+// which is handed the frame, or on a signal under it, since the frame
+// carries its value. The period is 0 if any such subscription is a
+// regular one, the shortest of their periods if all are rate limited,
+// and NOT_INTERESTED if there are none.
+//
+
+// The receivers are asked to announce their interest right away.
+#define ANNOUNCE_SOLICIT 0x01
+
+// Announcements not renewed for this long are dropped.
+#define NODE_TIMEOUT_MSEC (3 * VSD_INTEREST_INTERVAL_MSEC)
+
+// Rate limited subscriptions announced with their period. Any more
+// are announced in the bitset, as regular subscriptions.
+#define MAX_RATES 256
+
+#define NOT_INTERESTED UINT32_MAX
+
+// Latest announcement of a remote node, a bitset of _words words
+// followed by rate_count rates.
+typedef struct {
+    uint32_t node_id;
+    int64_t seen_msec;
+    uint64_t* bits;
+    int len;
+    int rate_count;
+} interest_node_t;
+
+// Rate limiting of publishes on a signal.
+typedef struct {
+    vss_signal_t* sig;
+    int64_t published_msec;
+    vsd_timer_t timer;
+} interest_signal_t;
+
+// Set by vsd_set_interest_mode().
+uint32_t vsd_interest_mode = 0;
+
+// Random id telling our own announcements apart from others.
+static uint32_t _node_id = 0;
+
+// Signature of the root signal, announced to detect nodes using
+// another specification.
+static uint32_t _signature = 0;
+
+// Number of signals, and of words in each bitset.
+static int _signal_count = 0;
+static int _words = 0;
+
+// Signals subscribed to locally, followed by the rates of _local_rates
+// rate limited subscriptions, and signals given to vsd_set_interest().
+// Rebuilt before each announcement.
+static uint64_t* _local = 0;
+static int _local_rates = 0;
+static uint64_t* _declared = 0;
+
+// Union of all bitsets, and the resulting period of each signal.
+static uint64_t* _union = 0;
+static uint32_t* _period = 0;
+static interest_signal_t* _signals = 0;
+
+// Latest announcement of each remote node.
+static interest_node_t* _nodes = 0;
+static int _node_count = 0;
+static int _node_allocated = 0;
+
+static vsd_timer_t _timer;
+static int _solicit = 0;
+
+static inline void _set_bit(uint64_t* bits, int index)
+{
+    bits[index >> 6] |= (uint64_t) 1 << (index & 63);
+}
+
+static inline int _test_bit(const uint64_t* bits, int index)
+{
+    return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+static uint64_t* _alloc_bits(int words)
+{
+    uint64_t* bits = (uint64_t*) calloc(words ? words : 1, sizeof(uint64_t));
+
+    if (!bits) {
+        RMC_LOG_FATAL("Failed to allocate %d bitset words.", words);
+        exit(255);
+    }
+    return bits;
+}
+
+static void _interest_fire(vsd_timer_t* timer, int64_t now_usec);
+static void _publish_fire(vsd_timer_t* timer, int64_t now_usec);
+
+static void _init(void)
+{
+    int ind = 0;
+
+    if (_local)
+        return;
+
+    _signal_count = vss_get_signal_count();
+    _signature = _signal_count ? vss_get_signal_by_index(0)->signature : 0;
+    _words = (_signal_count + 63) / 64;
+    _local = _alloc_bits(_words + MAX_RATES * sizeof(vsd_interest_rate_t) / sizeof(uint64_t));
+    _declared = _alloc_bits(_words);
+    _union = _alloc_bits(_words);
+    _period = (uint32_t*) calloc(_signal_count ? _signal_count : 1, sizeof(uint32_t));
+    _signals = (interest_signal_t*) calloc(_signal_count ? _signal_count : 1, sizeof(interest_signal_t));
+    if (!_period || !_signals) {
+        RMC_LOG_FATAL("Failed to allocate interest of %d signals.", _signal_count);
+        exit(255);
+    }
+
+    for(ind = 0; ind < _signal_count; ++ind) {
+        _period[ind] = NOT_INTERESTED;
+        _signals[ind].sig = vss_get_signal_by_index(ind);
+        vsd_timer_init(&_signals[ind].timer, _publish_fire, &_signals[ind]);
+    }
+
+    _node_id = ((uint32_t) getpid() << 16) ^ (uint32_t) vsd_usec_monotonic_timestamp();
+    vsd_timer_init(&_timer, _interest_fire, 0);
+}
+
+
+// Rebuild the bitset of the signals subscribed to locally.
+static void _build_local(void)
+{
+    int ind = 0;
+
+    memcpy(_local, _declared, _words * sizeof(uint64_t));
+
+    for(ind = 0; ind < _signal_count; ++ind)
+        if (vsd_has_subscribers(vss_get_signal_by_index(ind)))
+            _set_bit(_local, ind);
+
+    _local_rates = 0;
+    if (vsd_pattern_count)
+        _local_rates = vsd_pattern_interest(_local,
+                                            (vsd_interest_rate_t*) (_local + _words),
+                                            MAX_RATES);
+}
+
+
+// Lower the period of sig and all signals under it to period_msec.
+static void _limit_subtree(vss_signal_t* sig, uint32_t period_msec)
+{
+    int ind = 0;
+
+    if (sig->index >= 0 && sig->index < _signal_count &&
+        period_msec < _period[sig->index])
+        _period[sig->index] = period_msec;
+
+    for(ind = 0; sig->children && sig->children[ind]; ++ind)
+        _limit_subtree(sig->children[ind], period_msec);
+}
+
+// Lower the periods of the signals whose frames carry the signal
+// with the given index, or are handed to its subscribers.
+static void _limit(uint32_t index, uint32_t period_msec)
+{
+    vss_signal_t* sig = 0;
+
+    if (index >= _signal_count)
+        return;
+
+    sig = vss_get_signal_by_index(index);
+    _limit_subtree(sig, period_msec);
+
+    for(sig = sig->parent; sig; sig = sig->parent)
+        if (sig->index >= 0 && sig->index < _signal_count &&
+            period_msec < _period[sig->index])
+            _period[sig->index] = period_msec;
+}
+
+static void _limit_rates(const vsd_interest_rate_t* rates, int count)
+{
+    int ind = 0;
+
+    for(ind = 0; ind < count; ++ind)
+        _limit(rates[ind].index, rates[ind].period_msec);
+}
+
+// Recompute the period of each signal from all announcements.
+static void _update(void)
+{
+    int ind = 0;
+    int node = 0;
+
+    memcpy(_union, _local, _words * sizeof(uint64_t));
+    for(node = 0; node < _node_count; ++node)
+        for(ind = 0; ind < _words; ++ind)
+            _union[ind] |= _nodes[node].bits[ind];
+
+    for(ind = 0; ind < _signal_count; ++ind)
+        _period[ind] = NOT_INTERESTED;
+
+    for(ind = 0; ind < _signal_count; ++ind) {
+        vss_signal_t* sig = 0;
+
+        if (!_test_bit(_union, ind))
+            continue;
+
+        // Frames published on the signal or any ancestor carry it.
+        for(sig = vss_get_signal_by_index(ind); sig; sig = sig->parent)
+            if (sig->index >= 0 && sig->index < _signal_count)
+                _period[sig->index] = 0;
+    }
+
+    // Frames published under a subscribed signal are handed to
+    // its subscribers.
+    for(ind = 0; ind < _signal_count; ++ind) {
+        vss_signal_t* sig = 0;
+
+        if (!_period[ind])
+            continue;
+
+        for(sig = vss_get_signal_by_index(ind)->parent; sig; sig = sig->parent)
+            if (sig->index >= 0 && sig->index < _signal_count &&
+                _test_bit(_union, sig->index)) {
+                _period[ind] = 0;
+                break;
+            }
+    }
+
+    _limit_rates((vsd_interest_rate_t*) (_local + _words), _local_rates);
+    for(node = 0; node < _node_count; ++node)
+        _limit_rates((vsd_interest_rate_t*) (_nodes[node].bits + _words),
+                     _nodes[node].rate_count);
+}
+
+
+static void _announce(uint32_t flags)
+{
+    int len = _words * sizeof(uint64_t) + _local_rates * sizeof(vsd_interest_rate_t);
+    int res = dstc_vsd_interest_announce(_node_id, _signature, flags,
+                                         DSTC_DYNAMIC_ARG(_local, len));
+
+    if (res)
+        RMC_LOG_WARNING("Could not announce interest: %s", strerror(res));
+}
+
+
+// Announce our interest, drop nodes not heard from in a while, and
+// come back in VSD_INTEREST_INTERVAL_MSEC.
+static void _interest_fire(vsd_timer_t* timer, int64_t now_usec)
+{
+    int64_t now = now_usec / 1000;
+    int node = 0;
+
+    _build_local();
+
+    if ((vsd_interest_mode & VSD_INTEREST_ANNOUNCE) || _solicit)
+        _announce(_solicit ? ANNOUNCE_SOLICIT : 0);
+
+    _solicit = 0;
+
+    while(node < _node_count) {
+        if (now - _nodes[node].seen_msec > NODE_TIMEOUT_MSEC) {
+            free(_nodes[node].bits);
+            _nodes[node] = _nodes[--_node_count];
+            continue;
+        }
+        ++node;
+    }
+
+    _update();
+    vsd_timer_start(&_timer, now + VSD_INTEREST_INTERVAL_MSEC);
+}
+
+
+void vsd_interest_changed(void)
+{
+    if (!vsd_interest_mode)
+        return;
+
+    // Announce on the next vsd_process_timers(), once, however many
+    // subscriptions are changed until then.
+    vsd_timer_start(&_timer, vsd_msec_monotonic_timestamp());
+}
+
+
+// Publish a signal held by vsd_interest_filter().
+static void _publish_fire(vsd_timer_t* timer, int64_t now_usec)
+{
+    interest_signal_t* entry = (interest_signal_t*) timer->user_data;
+
+    vsd_publish(entry->sig);
+}
+
+
+int vsd_interest_filter(vss_signal_t* sig)
+{
+    interest_signal_t* entry = 0;
+    uint32_t period = 0;
+    int64_t now = 0;
+
+    if (!(vsd_interest_mode & VSD_INTEREST_FILTER) ||
+        sig->index < 0 || sig->index >= _signal_count)
+        return VSD_INTEREST_PUBLISH;
+
+    period = _period[sig->index];
+    if (period == NOT_INTERESTED)
+        return VSD_INTEREST_SKIP;
+
+    if (!period)
+        return VSD_INTEREST_PUBLISH;
+
+    // Hold the publish until the period has passed, and then
+    // publish the values current at that time.
+    entry = &_signals[sig->index];
+    if (vsd_timer_is_armed(&entry->timer))
+        return VSD_INTEREST_HOLD;
+
+    now = vsd_msec_monotonic_timestamp();
+    if (now - entry->published_msec < period) {
+        vsd_timer_start(&entry->timer, entry->published_msec + period);
+        return VSD_INTEREST_HOLD;
+    }
+
+    entry->published_msec = now;
+    return VSD_INTEREST_PUBLISH;
+}
+
+
+// Invoked by DSTC when a node announces its interest.
+void vsd_interest_announce(uint32_t node_id,
+                           uint32_t signature,
+                           uint32_t flags,
+                           dstc_dynamic_data_t dynarg)
+{
+    interest_node_t* node = 0;
+    int rate_len = dynarg.length - _words * sizeof(uint64_t);
+    int ind = 0;
+
+    if (!vsd_interest_mode || node_id == _node_id)
+        return;
+
+    if (signature != _signature) {
+        RMC_LOG_WARNING("Interest announcement of node 0x%X has signature 0x%X. Expected 0x%X. Specification mismatch?",
+                        node_id, signature, _signature);
+        return;
+    }
+
+    if ((flags & ANNOUNCE_SOLICIT) && (vsd_interest_mode & VSD_INTEREST_ANNOUNCE))
+        vsd_interest_changed();
+
+    if (!(vsd_interest_mode & VSD_INTEREST_FILTER))
+        return;
+
+    if (rate_len < 0 || rate_len % sizeof(vsd_interest_rate_t)) {
+        RMC_LOG_WARNING("Interest announcement of node 0x%X is %d bytes. Expected %zu, plus rates. Specification mismatch?",
+                        node_id, dynarg.length, _words * sizeof(uint64_t));
+        return;
+    }
+
+    for(ind = 0; ind < _node_count; ++ind)
+        if (_nodes[ind].node_id == node_id)
+            break;
+
+    if (ind == _node_count) {
+        if (_node_count == _node_allocated) {
+            _node_allocated = _node_allocated ? _node_allocated * 2 : 16;
+            _nodes = (interest_node_t*) realloc(_nodes, _node_allocated * sizeof(interest_node_t));
+            if (!_nodes) {
+                RMC_LOG_FATAL("Could not allocate %d interest nodes", _node_allocated);
+                exit(255);
+            }
+        }
+
+        _nodes[_node_count].node_id = node_id;
+        _nodes[_node_count].bits = 0;
+        _nodes[_node_count].len = 0;
+        ++_node_count;
+    }
+
+    node = &_nodes[ind];
+    node->seen_msec = vsd_msec_monotonic_timestamp();
+
+    // Unchanged. Nothing to recompute.
+    if (node->len == dynarg.length && !memcmp(node->bits, dynarg.data, dynarg.length))
+        return;
+
+    if (node->len != dynarg.length) {
+        free(node->bits);
+        node->bits = _alloc_bits(dynarg.length / sizeof(uint64_t));
+        node->len = dynarg.length;
+        node->rate_count = rate_len / sizeof(vsd_interest_rate_t);
+    }
+
+    memcpy(node->bits, dynarg.data, dynarg.length);
+    _update();
+}
+
+
+int vsd_set_interest_mode(vsd_context_t* ctx, uint32_t flags)
+{
+    if (flags & ~(VSD_INTEREST_ANNOUNCE | VSD_INTEREST_FILTER))
+        return EINVAL;
+
+    _init();
+
+    // Ask everyone for their interest, rather than wait for
+    // the next round of announcements.
+    if ((flags & VSD_INTEREST_FILTER) && !(vsd_interest_mode & VSD_INTEREST_FILTER))
+        _solicit = 1;
+
+    vsd_interest_mode = flags;
+
+    if (!flags) {
+        int ind = 0;
+
+        vsd_timer_cancel(&_timer);
+        for(ind = 0; ind < _signal_count; ++ind)
+            vsd_timer_cancel(&_signals[ind].timer);
+        return 0;
+    }
+
+    // Local subscribers count right away, remote ones as they answer.
+    _build_local();
+    _update();
+    vsd_interest_changed();
+    return 0;
+}
+
+
+int vsd_set_interest(vsd_context_t* ctx, vss_signal_t* sig, int interested)
+{
+    if (!sig)
+        return EINVAL;
+
+    _init();
+
+    if (sig->index < 0 || sig->index >= _signal_count)
+        return ENOENT;
+
+    if (interested)
+        _set_bit(_declared, sig->index);
+    else
+        _declared[sig->index >> 6] &= ~((uint64_t) 1 << (sig->index & 63));
+
+    vsd_interest_changed();
+    return 0;
+}
@@ -0,0 +1,313 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Declarations shared between the VSD translation units.
+// This file is not installed.
+//
+
+#ifndef __VSD_INTERNAL_H__
+#define __VSD_INTERNAL_H__
+#include "vehicle_signal_distribution.h"
+#include <time.h>
+#include <pthread.h>
+
+// Monotonic clock used by all VSD timing.
+static inline int64_t vsd_usec_monotonic_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline int64_t vsd_msec_monotonic_timestamp(void)
+{
+    return vsd_usec_monotonic_timestamp() / 1000;
+}
+
+static inline uint64_t vsd_nsec_monotonic_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// Latency instrumentation, implemented in vsd_latency.c
+//
+// The VSD_LATENCY_* macros compile to nothing unless the library is
+// built with VSD_INSTRUMENTATION defined.
+//
+extern int vsd_histogram_bucket(uint64_t nsec);
+
+#ifdef VSD_INSTRUMENTATION
+extern void vsd_latency_record(vss_signal_t* sig, int stage, uint64_t nsec);
+
+#define VSD_LATENCY_START(var) uint64_t var = vsd_nsec_monotonic_timestamp()
+#define VSD_LATENCY_RECORD(sig, stage, start)                           \
+    vsd_latency_record(sig, stage, vsd_nsec_monotonic_timestamp() - (start))
+#else
+#define VSD_LATENCY_START(var)
+#define VSD_LATENCY_RECORD(sig, stage, start)
+#endif
+
+//
+// Traffic statistics, implemented in vsd_stats.c
+//
+// The counters of vsd_signal_stats_t updated as frames are published
+// and received occupy a cache line of their own for each signal, so
+// that updates to one signal never contend with updates to another.
+// The error counters are kept in a separate table, without padding.
+// vsd_get_signal_stats() and vsd_get_stats() combine the two.
+//
+typedef struct {
+    uint64_t published;
+    uint64_t received;
+    uint64_t bytes_encoded;
+    uint64_t bytes_decoded;
+    uint64_t lazy_frames;
+    uint64_t skipped_publishes;
+    uint64_t held_publishes;
+} __attribute__((aligned(64))) vsd_traffic_stats_t;
+
+_Static_assert(sizeof(vsd_traffic_stats_t) == 64,
+               "Traffic counters must fit in a single cache line");
+
+typedef struct {
+    uint64_t decode_errors;
+    uint64_t oversize_frames;
+    uint64_t dropped_deliveries;
+    uint64_t invalid_values;
+} vsd_error_stats_t;
+
+extern vsd_traffic_stats_t* vsd_stats_table;
+extern vsd_error_stats_t* vsd_error_stats_table;
+extern int vsd_stats_table_size;
+extern uint64_t vsd_unknown_signatures;
+extern vsd_traffic_stats_t* vsd_stats_alloc(vss_signal_t* sig);
+
+// Error counters of sig.
+extern vsd_error_stats_t* vsd_error_stats(vss_signal_t* sig);
+
+static inline vsd_traffic_stats_t* vsd_stats(vss_signal_t* sig)
+{
+    if (sig->index >= 0 && sig->index < vsd_stats_table_size)
+        return &vsd_stats_table[sig->index];
+
+    return vsd_stats_alloc(sig);
+}
+
+//
+// Timer wheel, implemented in vsd_timer.c
+//
+// Timers are embedded in the structure owning them and are linked
+// directly into the wheel slots, so that starting and cancelling a
+// timer is O(1) and never allocates memory.
+//
+typedef struct _vsd_timer_t vsd_timer_t;
+typedef void (*vsd_timer_cb_t)(vsd_timer_t* timer, int64_t now_usec);
+
+struct _vsd_timer_t {
+    vsd_timer_t* next;
+    vsd_timer_t* prev;
+    int64_t expire_msec;
+    vsd_timer_cb_t callback;
+    void* user_data;
+};
+
+// Prepare timer for use.
+extern void vsd_timer_init(vsd_timer_t* timer, vsd_timer_cb_t callback, void* user_data);
+
+// Arm timer to fire at the given absolute monotonic time.
+// An already armed timer is rescheduled.
+extern void vsd_timer_start(vsd_timer_t* timer, int64_t expire_msec);
+
+// Disarm a timer. A no-op if timer is not armed.
+extern void vsd_timer_cancel(vsd_timer_t* timer);
+
+static inline int vsd_timer_is_armed(vsd_timer_t* timer)
+{
+    return timer->prev != 0;
+}
+
+//
+// Transports, implemented in vsd.c
+//
+
+// The default DSTC transport.
+extern vsd_transport_t vsd_dstc_transport;
+
+// Resolve the signature of a frame to the signal it was published on.
+// Returns nil if no signal has the signature.
+extern vss_signal_t* vsd_signal_by_signature(uint32_t signature);
+
+// Encode a frame carrying the signal tree under sig into buf.
+// Returns ENOMEM if buf_sz is too small, or ENODATA if valid_only is
+// set and no signal under sig has a value.
+extern int vsd_encode_frame(vss_signal_t* sig, uint8_t* buf, int buf_sz, int* len, int valid_only);
+
+// Decode a frame published on sig, storing the values it carries
+// and pushing their signals to res_lst, without invoking any
+// subscriber.
+extern int vsd_decode_frame(vss_signal_t* sig, const uint8_t* buf, int buf_sz, vsd_signal_list_t* res_lst);
+
+// Returns non-zero if sig itself, not counting its ancestors, has
+// any subscriber.
+extern int vsd_has_subscribers(vss_signal_t* sig);
+
+// Returns non-zero if a is b, or an ancestor or descendant of b.
+extern int vsd_signal_related(vss_signal_t* a, vss_signal_t* b);
+
+// Decode the frames held by lazy decoding that carry values for
+// signals under sig. See vsd_set_lazy_decode().
+extern void vsd_lazy_resolve(vss_signal_t* sig);
+
+// Host id carried in the header of published frames, or 0 to
+// leave it out. Received DSTC frames carrying our own host id are
+// dropped, since they have already been delivered through shared
+// memory.
+extern uint64_t vsd_frame_origin;
+
+//
+// Threaded loopback delivery, implemented in vsd_loopback.c
+//
+
+// Number of threaded loopback transports. While it is non-zero,
+// vsd_publish() holds vsd_loopback_lock while it encodes a frame, and
+// loopback threads hold it while they deliver one, so that the two
+// never touch the signal tree at the same time. The lock is recursive
+// since subscribers may publish.
+extern int vsd_loopback_threads;
+extern pthread_mutex_t vsd_loopback_lock;
+
+//
+// Interest announcements, implemented in vsd_interest.c
+//
+
+// Flags given to vsd_set_interest_mode().
+extern uint32_t vsd_interest_mode;
+
+// Called when a subscription is added or removed. Schedules an
+// announcement of the new set of subscribed signals.
+extern void vsd_interest_changed(void);
+
+// Maximum delivery rate asked for by a rate limited subscription to
+// the signal with the given index. Announced after the bitset.
+typedef struct {
+    uint32_t index;
+    uint32_t period_msec;
+} vsd_interest_rate_t;
+
+// Returned by vsd_interest_filter().
+#define VSD_INTEREST_PUBLISH 0
+// No node is interested in any signal a frame on sig would carry.
+#define VSD_INTEREST_SKIP 1
+// All interested nodes have asked for a lower rate. The publish is
+// made by a timer once the period has passed.
+#define VSD_INTEREST_HOLD 2
+
+// Decide what vsd_publish() does with sig. Always returns
+// VSD_INTEREST_PUBLISH unless VSD_INTEREST_FILTER is active.
+extern int vsd_interest_filter(vss_signal_t* sig);
+
+//
+// Shared memory value table, implemented in vsd_value_table.c
+//
+#define VSD_VALUE_TABLE_NONE 0
+// We created the table and store every value assigned in it.
+#define VSD_VALUE_TABLE_OWNER 1
+// We read values from a table owned by another process.
+#define VSD_VALUE_TABLE_CLIENT 2
+
+extern int vsd_value_table_mode;
+
+extern void vsd_value_table_store(vss_signal_t* sig, const vsd_data_u* val, uint64_t timestamp);
+
+// Returns 0, ESTALE if the owner has closed the table, or EAGAIN if
+// the entry was being written throughout all read attempts.
+extern int vsd_value_table_load(vss_signal_t* sig, vsd_data_u* val, uint64_t* timestamp);
+
+// Implemented in vsd.c. Stores all values assigned so far.
+extern void vsd_value_table_populate(void);
+
+//
+// Pattern and conflating subscriptions, implemented in vsd_pattern.c
+//
+
+// Number of active pattern subscriptions.
+extern uint32_t vsd_pattern_count;
+
+// Invoke all pattern subscribers matching a signal in res_lst,
+// decoded from a frame published on sig.
+extern void vsd_pattern_dispatch(vss_signal_t* sig, vsd_signal_list_t* res_lst);
+
+// Add or remove a VSD_SUBSCRIBE_CONFLATE subscription to the
+// signals under sig. Unsubscribing returns ESRCH if there is none.
+extern int vsd_conflate_subscribe(vss_signal_t* sig, vsd_subscriber_cb_t callback);
+extern int vsd_conflate_unsubscribe(vss_signal_t* sig, vsd_subscriber_cb_t callback);
+
+// Number of active rate limited subscriptions, also counted in
+// vsd_pattern_count.
+extern uint32_t vsd_rate_limited_count;
+
+// Set the bits of all signals matched by a pattern or conflating
+// subscription in bits, which spans all signal indices. Rate limited
+// subscriptions are stored in rates instead, up to max_rates, with the
+// rest set in bits. Returns the number of rates stored.
+extern int vsd_pattern_interest(uint64_t* bits, vsd_interest_rate_t* rates, int max_rates);
+
+// Returns non-zero if a rate limited subscription on sig, or on an
+// ancestor or descendant of it, is due for delivery, so that a frame
+// received on sig has to be decoded on arrival.
+extern int vsd_pattern_due(vss_signal_t* sig);
+
+// Called for a frame received on sig and held undecoded. Rate limited
+// subscriptions it carries values for deliver them once their period
+// has passed.
+extern void vsd_pattern_held(vss_signal_t* sig);
+
+//
+// Parsing of signal values from text, implemented in vsd_parse.c
+//
+// Each call parses the number at str, which need not be null
+// terminated, and stops at end or at the first character that is not
+// part of the number. The result is the same as from strtol(3) or
+// strtod(3) in the C locale. Returns a pointer past the last
+// character parsed.
+//
+extern const char* vsd_parse_int(const char* str, const char* end, int64_t* result);
+extern const char* vsd_parse_double(const char* str, const char* end, double* result);
+extern const char* vsd_parse_float(const char* str, const char* end, float* result);
+
+// Parse a value of type in [str, end) into res.
+// Returns EINVAL if type is not numeric or boolean.
+extern int vsd_parse_value(vss_data_type_e type, const char* str, const char* end, vsd_data_u* res);
+
+//
+// Value validation, implemented in vsd_limits.c
+//
+
+// Policy set by vsd_set_validation().
+extern int vsd_validation;
+
+// Check val against the limits of sig given by the specification.
+// With VSD_VALIDATE_PERMISSIVE, out of range numbers are clamped in
+// place and 0 is returned. With VSD_VALIDATE_STRICT, ERANGE is
+// returned for numbers out of range, and EINVAL for values that are
+// not enumerated.
+extern int vsd_limits_check(vss_signal_t* sig, vsd_data_u* val);
+
+// Non-zero if the specification sets any limit for sig.
+extern int vsd_limits_constrained(vss_signal_t* sig);
+
+static inline int vsd_validate(vss_signal_t* sig, vsd_data_u* val)
+{
+    return vsd_validation ? vsd_limits_check(sig, val) : 0;
+}
+
+#endif // __VSD_INTERNAL_H__
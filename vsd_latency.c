@@ -0,0 +1,300 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Latency histograms
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <rmc_log.h>
+
+// Histograms are log-linear, in the style of HDR histograms.  Values
+// below 2^VSD_HISTOGRAM_SUB_BITS get a bucket each. Above that, each
+// power of two is split into 2^VSD_HISTOGRAM_SUB_BITS equally wide
+// buckets, giving a relative error of at most 12.5%.
+#define SUB_COUNT (1 << VSD_HISTOGRAM_SUB_BITS)
+#define SUB_MASK (SUB_COUNT - 1)
+
+int vsd_histogram_bucket(uint64_t nsec)
+{
+    int msb = 0;
+    int ind = 0;
+
+    if (nsec < SUB_COUNT)
+        return (int) nsec;
+
+    msb = 63 - __builtin_clzll(nsec);
+    ind = (msb - VSD_HISTOGRAM_SUB_BITS + 1) * SUB_COUNT +
+        (int) ((nsec >> (msb - VSD_HISTOGRAM_SUB_BITS)) & SUB_MASK);
+
+    return (ind < VSD_HISTOGRAM_BUCKETS) ? ind : VSD_HISTOGRAM_BUCKETS - 1;
+}
+
+
+uint64_t vsd_histogram_bucket_lower(int bucket)
+{
+    int msb = 0;
+
+    if (bucket < SUB_COUNT)
+        return (uint64_t) bucket;
+
+    msb = bucket / SUB_COUNT + VSD_HISTOGRAM_SUB_BITS - 1;
+    return (uint64_t) (SUB_COUNT | (bucket & SUB_MASK)) << (msb - VSD_HISTOGRAM_SUB_BITS);
+}
+
+
+uint64_t vsd_histogram_percentile(const vsd_histogram_t* hist, double percentile)
+{
+    uint64_t target = 0;
+    uint64_t acc = 0;
+    int ind = 0;
+
+    if (!hist->count)
+        return 0;
+
+    target = (uint64_t) (hist->count * percentile / 100.0);
+    if (target >= hist->count)
+        return hist->max_nsec;
+
+    for(ind = 0; ind < VSD_HISTOGRAM_BUCKETS; ++ind) {
+        acc += hist->buckets[ind];
+        if (acc > target)
+            return vsd_histogram_bucket_lower(ind);
+    }
+
+    return hist->max_nsec;
+}
+
+
+#ifdef VSD_INSTRUMENTATION
+
+// Latencies are recorded by the thread publishing a frame, and by the
+// thread receiving it, which is another one with a threaded loopback
+// transport. Each recording thread has a shard of its own, which only
+// that thread writes to, so that recording never contends for a cache
+// line with another thread. vsd_get_latency_histogram() merges the
+// shards of all threads.
+//
+// Shards are never freed, so that the latencies recorded by a thread
+// that has exited are still reported.
+
+// Histograms for all stages, allocated the first time a thread
+// records a latency for a signal.
+typedef struct {
+    vsd_histogram_t stage[VSD_LATENCY_STAGE_COUNT];
+    // Reset generation of the signal when last cleared. Entries of an
+    // older generation are left out of the merge, and are cleared by
+    // their thread before it records into them again.
+    uint32_t generation;
+} vsd_latency_t;
+
+// Latencies recorded by one thread, indexed by signal index.
+typedef struct _latency_shard_t {
+    struct _latency_shard_t* next;
+    vsd_latency_t** table;
+} latency_shard_t;
+
+// All shards. Added to with a compare and swap, and never removed from.
+static latency_shard_t* _shards = 0;
+
+// The shard of the calling thread.
+static __thread latency_shard_t* _shard = 0;
+
+// Reset generation of each signal, incremented by
+// vsd_reset_latency_histograms(). Allocated by the first thread
+// recording a latency, and installed with a compare and swap.
+static uint32_t* _generations = 0;
+
+// Install ptr in *slot unless another thread got there first.
+// Returns the pointer in *slot.
+static void* _install(void** slot, void* ptr)
+{
+    void* current = 0;
+
+    if (__atomic_compare_exchange_n(slot, &current, ptr, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return ptr;
+
+    free(ptr);
+    return current;
+}
+
+static void* _alloc(size_t size)
+{
+    void* ptr = calloc(1, size);
+
+    if (!ptr) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", size);
+        exit(255);
+    }
+    return ptr;
+}
+
+// Only the owning thread writes to a shard, so a load and a store
+// suffice. They are atomic so that a merge never sees a torn value.
+static inline void _store(uint64_t* counter, uint64_t val)
+{
+    __atomic_store_n(counter, val, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t _load(const uint64_t* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Min starts out above any sample, so that the first sample sets it.
+static void _latency_clear(vsd_latency_t* lat, uint32_t generation)
+{
+    int stage = 0;
+    int ind = 0;
+
+    for(stage = 0; stage < VSD_LATENCY_STAGE_COUNT; ++stage) {
+        vsd_histogram_t* hist = &lat->stage[stage];
+
+        _store(&hist->count, 0);
+        _store(&hist->sum_nsec, 0);
+        _store(&hist->min_nsec, UINT64_MAX);
+        _store(&hist->max_nsec, 0);
+        for(ind = 0; ind < VSD_HISTOGRAM_BUCKETS; ++ind)
+            _store(&hist->buckets[ind], 0);
+    }
+    __atomic_store_n(&lat->generation, generation, __ATOMIC_RELEASE);
+}
+
+static latency_shard_t* _shard_create(int count)
+{
+    latency_shard_t* shard = (latency_shard_t*) _alloc(sizeof(latency_shard_t));
+
+    shard->table = (vsd_latency_t**) _alloc(count * sizeof(vsd_latency_t*));
+    shard->next = __atomic_load_n(&_shards, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&_shards, &shard->next, shard, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    return shard;
+}
+
+void vsd_latency_record(vss_signal_t* sig, int stage, uint64_t nsec)
+{
+    int count = vss_get_signal_count();
+    uint32_t* generations = __atomic_load_n(&_generations, __ATOMIC_ACQUIRE);
+    uint32_t generation = 0;
+    vsd_latency_t* lat = 0;
+    vsd_histogram_t* hist = 0;
+
+    if (sig->index < 0 || sig->index >= count)
+        return;
+
+    if (!generations)
+        generations = (uint32_t*) _install((void**) &_generations,
+                                           _alloc(count * sizeof(uint32_t)));
+
+    if (!_shard)
+        _shard = _shard_create(count);
+
+    generation = __atomic_load_n(&generations[sig->index], __ATOMIC_RELAXED);
+    lat = _shard->table[sig->index];
+    if (!lat) {
+        lat = (vsd_latency_t*) _alloc(sizeof(vsd_latency_t));
+        _latency_clear(lat, generation);
+        __atomic_store_n(&_shard->table[sig->index], lat, __ATOMIC_RELEASE);
+    } else if (lat->generation != generation)
+        _latency_clear(lat, generation);
+
+    hist = &lat->stage[stage];
+    _store(&hist->buckets[vsd_histogram_bucket(nsec)],
+           _load(&hist->buckets[vsd_histogram_bucket(nsec)]) + 1);
+    _store(&hist->sum_nsec, _load(&hist->sum_nsec) + nsec);
+    _store(&hist->count, _load(&hist->count) + 1);
+
+    if (nsec < _load(&hist->min_nsec))
+        _store(&hist->min_nsec, nsec);
+
+    if (nsec > _load(&hist->max_nsec))
+        _store(&hist->max_nsec, nsec);
+}
+
+
+// The merge may be off by the samples being recorded while it runs.
+int vsd_get_latency_histogram(vss_signal_t* sig, int stage, vsd_histogram_t* result)
+{
+    uint32_t* generations = __atomic_load_n(&_generations, __ATOMIC_ACQUIRE);
+    latency_shard_t* shard = __atomic_load_n(&_shards, __ATOMIC_ACQUIRE);
+    uint32_t generation = 0;
+    int ind = 0;
+
+    if (!sig || !result || stage < 0 || stage >= VSD_LATENCY_STAGE_COUNT)
+        return EINVAL;
+
+    memset(result, 0, sizeof(*result));
+    if (!generations || sig->index < 0 || sig->index >= vss_get_signal_count())
+        return 0;
+
+    generation = __atomic_load_n(&generations[sig->index], __ATOMIC_RELAXED);
+    result->min_nsec = UINT64_MAX;
+
+    for(; shard; shard = shard->next) {
+        vsd_latency_t* lat = __atomic_load_n(&shard->table[sig->index], __ATOMIC_ACQUIRE);
+        vsd_histogram_t* hist = 0;
+        uint64_t val = 0;
+
+        if (!lat || __atomic_load_n(&lat->generation, __ATOMIC_ACQUIRE) != generation)
+            continue;
+
+        hist = &lat->stage[stage];
+        result->count += _load(&hist->count);
+        result->sum_nsec += _load(&hist->sum_nsec);
+
+        val = _load(&hist->min_nsec);
+        if (val < result->min_nsec)
+            result->min_nsec = val;
+
+        val = _load(&hist->max_nsec);
+        if (val > result->max_nsec)
+            result->max_nsec = val;
+
+        for(ind = 0; ind < VSD_HISTOGRAM_BUCKETS; ++ind)
+            result->buckets[ind] += _load(&hist->buckets[ind]);
+    }
+
+    // Nothing recorded since the histograms were reset.
+    if (result->min_nsec == UINT64_MAX)
+        result->min_nsec = 0;
+
+    return 0;
+}
+
+
+// Shards are cleared by their own threads, which notice the new
+// generation the next time they record a latency for sig.
+int vsd_reset_latency_histograms(vss_signal_t* sig)
+{
+    uint32_t* generations = __atomic_load_n(&_generations, __ATOMIC_ACQUIRE);
+
+    if (!sig)
+        return EINVAL;
+
+    if (generations && sig->index >= 0 && sig->index < vss_get_signal_count())
+        __atomic_fetch_add(&generations[sig->index], 1, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+#else // VSD_INSTRUMENTATION
+
+int vsd_get_latency_histogram(vss_signal_t* sig, int stage, vsd_histogram_t* result)
+{
+    return ENOTSUP;
+}
+
+int vsd_reset_latency_histograms(vss_signal_t* sig)
+{
+    return ENOTSUP;
+}
+
+#endif // VSD_INSTRUMENTATION
@@ -0,0 +1,414 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Validation of signal values against the min, max and enum
+// constraints of the specification.
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <rmc_log.h>
+
+// The constraints of each signal are compiled once into a flat table
+// indexed by signal, so that a check is a table load and a couple of
+// compares rather than a walk through vss_signal_t.
+//
+// Integer ranges are checked with a single unsigned compare of
+// value - min against max - min. Enumerated integers with all values
+// in 0-63 are checked against a bitmap. Unconstrained signals get
+// the full range of their type and an all ones bitmap, so the same
+// checks apply to all of them.
+//
+
+// Kinds of limits.
+#define LIMIT_NONE 0       // Booleans, and signals outside the table.
+#define LIMIT_INT 1        // Range, and enum bitmap.
+#define LIMIT_INT_LIST 2   // Range, and enum values in the pool.
+#define LIMIT_FLOAT 3
+#define LIMIT_DOUBLE 4
+#define LIMIT_STRING 5     // Enum strings in the pool, if any.
+
+typedef struct {
+    union {
+        struct {
+            int64_t min;
+            uint64_t span;   // max - min
+        } i;
+        struct {
+            double min;
+            double max;
+        } d;
+    };
+    uint64_t enum_bits;
+    uint32_t enum_first;
+    uint16_t enum_count;
+    uint8_t kind;
+    uint8_t bits;            // Width of integer type.
+    uint8_t is_signed;
+    uint8_t constrained;
+} vsd_limit_t;
+
+typedef struct {
+    union {
+        int64_t i;
+        const char* s;
+    };
+    uint32_t len;            // Of string, excluding null terminator.
+} vsd_enum_value_t;
+
+int vsd_validation = VSD_VALIDATE_NONE;
+
+static vsd_limit_t* _limits = 0;
+static int _limit_count = 0;
+
+static vsd_enum_value_t* _enum_pool = 0;
+static uint32_t _enum_pool_count = 0;
+static uint32_t _enum_pool_allocated = 0;
+
+static uint32_t _enum_add(void)
+{
+    if (_enum_pool_count == _enum_pool_allocated) {
+        _enum_pool_allocated = _enum_pool_allocated ? _enum_pool_allocated * 2 : 256;
+        _enum_pool = (vsd_enum_value_t*) realloc(_enum_pool, _enum_pool_allocated * sizeof(vsd_enum_value_t));
+        if (!_enum_pool) {
+            RMC_LOG_FATAL("Failed to allocate %u enum values.", _enum_pool_allocated);
+            exit(255);
+        }
+    }
+    return _enum_pool_count++;
+}
+
+// Specifications carry no flag telling a zero bound from a missing
+// one. A zero bound is treated as missing, except for a zero minimum
+// paired with a non-zero maximum (0 - 100).
+static void _compile_int(vss_signal_t* sig, vsd_limit_t* lim, int64_t min, int64_t max)
+{
+    int64_t type_min = 0;
+    int64_t type_max = 0;
+    int64_t enum_min = INT64_MAX;
+    int64_t enum_max = INT64_MIN;
+    uint64_t bits = 0;
+    int ind = 0;
+
+    switch(sig->data_type) {
+    case VSS_INT8: type_min = INT8_MIN; type_max = INT8_MAX; lim->bits = 8; lim->is_signed = 1; break;
+    case VSS_UINT8: type_max = UINT8_MAX; lim->bits = 8; break;
+    case VSS_INT16: type_min = INT16_MIN; type_max = INT16_MAX; lim->bits = 16; lim->is_signed = 1; break;
+    case VSS_UINT16: type_max = UINT16_MAX; lim->bits = 16; break;
+    case VSS_INT32: type_min = INT32_MIN; type_max = INT32_MAX; lim->bits = 32; lim->is_signed = 1; break;
+    default: type_max = UINT32_MAX; lim->bits = 32; break;
+    }
+
+    if (min || max)
+        lim->constrained = 1;
+
+    if (!min && !max)
+        min = type_min;
+    else if (!min && max < 0)
+        min = type_min;
+
+    if (!max)
+        max = type_max;
+
+    if (min < type_min)
+        min = type_min;
+
+    if (max > type_max)
+        max = type_max;
+
+    lim->kind = LIMIT_INT;
+    lim->enum_bits = ~0ULL;
+
+    // Enumerated integers.
+    for(ind = 0; ind < VSS_MAX_ENUM && sig->enum_values[ind]; ++ind) {
+        const char* str = sig->enum_values[ind];
+        uint32_t pos = _enum_add();
+        int64_t val = 0;
+
+        vsd_parse_int(str, str + strlen(str), &val);
+        _enum_pool[pos].i = val;
+        _enum_pool[pos].len = 0;
+
+        if (!ind) {
+            lim->enum_first = pos;
+            bits = 0;
+        }
+
+        lim->enum_count++;
+        if (val < enum_min) enum_min = val;
+        if (val > enum_max) enum_max = val;
+        if (val >= 0 && val < 64)
+            bits |= 1ULL << val;
+    }
+
+    if (lim->enum_count) {
+        lim->constrained = 1;
+
+        // Nothing outside the enumerated values can be legal.
+        if (enum_min > min)
+            min = enum_min;
+
+        if (enum_max < max)
+            max = enum_max;
+
+        if (enum_min >= 0 && enum_max < 64)
+            lim->enum_bits = bits;
+        else
+            lim->kind = LIMIT_INT_LIST;
+    }
+
+    // An empty range, as in an enum entirely outside min - max.
+    if (max < min)
+        max = min;
+
+    lim->i.min = min;
+    lim->i.span = (uint64_t) max - (uint64_t) min;
+}
+
+static void _compile_float(vss_signal_t* sig, vsd_limit_t* lim, double min, double max)
+{
+    lim->kind = sig->data_type == VSS_FLOAT ? LIMIT_FLOAT : LIMIT_DOUBLE;
+    lim->constrained = min != 0 || max != 0;
+
+    if (!min && (!max || max < 0))
+        min = -INFINITY;
+
+    if (!max)
+        max = INFINITY;
+
+    lim->d.min = min;
+    lim->d.max = max;
+}
+
+static void _compile_string(vss_signal_t* sig, vsd_limit_t* lim)
+{
+    int ind = 0;
+
+    lim->kind = LIMIT_STRING;
+    lim->enum_bits = ~0ULL;
+
+    for(ind = 0; ind < VSS_MAX_ENUM && sig->enum_values[ind]; ++ind) {
+        uint32_t pos = _enum_add();
+
+        _enum_pool[pos].s = sig->enum_values[ind];
+        _enum_pool[pos].len = strlen(sig->enum_values[ind]);
+
+        if (!ind) {
+            lim->enum_first = pos;
+            lim->enum_bits = 0;
+        }
+
+        // Quick reject on length.
+        lim->enum_bits |= 1ULL << (_enum_pool[pos].len & 63);
+        lim->enum_count++;
+    }
+
+    lim->constrained = lim->enum_count != 0;
+}
+
+static void _compile(void)
+{
+    int count = vss_get_signal_count();
+    int ind = 0;
+
+    _limits = (vsd_limit_t*) calloc(count, sizeof(vsd_limit_t));
+    if (!_limits) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", count * sizeof(vsd_limit_t));
+        exit(255);
+    }
+    _limit_count = count;
+
+    for(ind = 0; ind < count; ++ind) {
+        vss_signal_t* sig = vss_get_signal_by_index(ind);
+        vsd_limit_t* lim = &_limits[ind];
+
+        if (sig->element_type == VSS_BRANCH)
+            continue;
+
+        switch(sig->data_type) {
+        case VSS_INT8: _compile_int(sig, lim, sig->min_val.i8, sig->max_val.i8); break;
+        case VSS_UINT8: _compile_int(sig, lim, sig->min_val.u8, sig->max_val.u8); break;
+        case VSS_INT16: _compile_int(sig, lim, sig->min_val.i16, sig->max_val.i16); break;
+        case VSS_UINT16: _compile_int(sig, lim, sig->min_val.u16, sig->max_val.u16); break;
+        case VSS_INT32: _compile_int(sig, lim, sig->min_val.i32, sig->max_val.i32); break;
+        case VSS_UINT32: _compile_int(sig, lim, sig->min_val.u32, sig->max_val.u32); break;
+        case VSS_FLOAT: _compile_float(sig, lim, sig->min_val.f, sig->max_val.f); break;
+        case VSS_DOUBLE: _compile_float(sig, lim, sig->min_val.d, sig->max_val.d); break;
+        case VSS_STRING: _compile_string(sig, lim); break;
+        default: break;
+        }
+    }
+
+    RMC_LOG_DEBUG("Compiled limits of %d signals. %u enum values.", count, _enum_pool_count);
+}
+
+// Store an integer in the width of the signal.
+static void _store_int(const vsd_limit_t* lim, vsd_data_u* val, int64_t ival)
+{
+    switch(lim->bits) {
+    case 8: val->u8 = (uint8_t) ival; break;
+    case 16: val->u16 = (uint16_t) ival; break;
+    default: val->u32 = (uint32_t) ival; break;
+    }
+}
+
+// Load an integer of the width of the signal.
+static inline int64_t _load_int(const vsd_limit_t* lim, const vsd_data_u* val)
+{
+    uint64_t raw = val->u32;
+    int shift = 64 - lim->bits;
+
+    return lim->is_signed ?
+        (int64_t) (raw << shift) >> shift :
+        (int64_t) ((raw << shift) >> shift);
+}
+
+static int _check_int(const vsd_limit_t* lim, int64_t ival)
+{
+    uint32_t ind = 0;
+
+    if ((uint64_t) ival - (uint64_t) lim->i.min > lim->i.span)
+        return ERANGE;
+
+    if (lim->kind == LIMIT_INT)
+        return ((lim->enum_bits >> (ival & 63)) & 1) ? 0 : EINVAL;
+
+    for(ind = lim->enum_first; ind < lim->enum_first + lim->enum_count; ++ind)
+        if (_enum_pool[ind].i == ival)
+            return 0;
+
+    return EINVAL;
+}
+
+static inline int _check_double(const vsd_limit_t* lim, double dval)
+{
+    // NaN compares false on both sides, and passes.
+    return (!(dval < lim->d.min) & !(dval > lim->d.max)) ? 0 : ERANGE;
+}
+
+static int _check_string(const vsd_limit_t* lim, const vsd_data_u* val)
+{
+    // len includes the null terminator. The string itself is not
+    // necessarily terminated.
+    uint32_t len = val->s.len ? val->s.len - 1 : 0;
+    uint32_t ind = 0;
+
+    if (!((lim->enum_bits >> (len & 63)) & 1))
+        return EINVAL;
+
+    if (!lim->enum_count)
+        return 0;
+
+    for(ind = lim->enum_first; ind < lim->enum_first + lim->enum_count; ++ind)
+        if (_enum_pool[ind].len == len && !memcmp(_enum_pool[ind].s, val->s.data, len))
+            return 0;
+
+    return EINVAL;
+}
+
+// Move an out of range value to the nearest bound.
+static void _clamp(const vsd_limit_t* lim, vsd_data_u* val)
+{
+    switch(lim->kind) {
+    case LIMIT_INT:
+    case LIMIT_INT_LIST: {
+        int64_t ival = _load_int(lim, val);
+
+        _store_int(lim, val, ival < lim->i.min ? lim->i.min : lim->i.min + (int64_t) lim->i.span);
+        break;
+    }
+
+    case LIMIT_FLOAT:
+        val->f = (float) (val->f < lim->d.min ? lim->d.min : lim->d.max);
+        break;
+
+    case LIMIT_DOUBLE:
+        val->d = val->d < lim->d.min ? lim->d.min : lim->d.max;
+        break;
+    }
+}
+
+
+int vsd_limits_check(vss_signal_t* sig, vsd_data_u* val)
+{
+    const vsd_limit_t* lim = 0;
+    int res = 0;
+
+    if (!_limits)
+        _compile();
+
+    // Signals added after the table was compiled are not checked.
+    if ((unsigned) sig->index >= (unsigned) _limit_count)
+        return 0;
+
+    lim = &_limits[sig->index];
+
+    switch(lim->kind) {
+    case LIMIT_INT:
+    case LIMIT_INT_LIST:
+        res = _check_int(lim, _load_int(lim, val));
+        break;
+
+    case LIMIT_FLOAT:
+        res = _check_double(lim, val->f);
+        break;
+
+    case LIMIT_DOUBLE:
+        res = _check_double(lim, val->d);
+        break;
+
+    case LIMIT_STRING:
+        res = _check_string(lim, val);
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (!res)
+        return 0;
+
+    vsd_error_stats(sig)->invalid_values++;
+
+    if (vsd_validation == VSD_VALIDATE_STRICT)
+        return res;
+
+    // Enumerated values cannot be clamped, and are let through.
+    if (res == ERANGE)
+        _clamp(lim, val);
+
+    return 0;
+}
+
+
+int vsd_limits_constrained(vss_signal_t* sig)
+{
+    if (!_limits)
+        _compile();
+
+    if ((unsigned) sig->index >= (unsigned) _limit_count)
+        return 0;
+
+    return _limits[sig->index].constrained;
+}
+
+
+int vsd_set_validation(vsd_context_t* ctx, int policy)
+{
+    if (policy != VSD_VALIDATE_NONE &&
+        policy != VSD_VALIDATE_PERMISSIVE &&
+        policy != VSD_VALIDATE_STRICT)
+        return EINVAL;
+
+    if (policy != VSD_VALIDATE_NONE && !_limits)
+        _compile();
+
+    vsd_validation = policy;
+    return 0;
+}
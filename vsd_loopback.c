@@ -0,0 +1,255 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// In-process loopback transport
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <rmc_log.h>
+
+// A frame queued for delivery by the loopback thread.
+typedef struct _loopback_frame_t {
+    struct _loopback_frame_t* next;
+    uint32_t signature;
+    uint16_t len;
+    uint8_t data[];
+} loopback_frame_t;
+
+typedef struct {
+    // Must be first, since vsd_transport_t pointers are cast
+    // back to vsd_loopback_t.
+    vsd_transport_t transport;
+    uint32_t flags;
+
+    // Threaded delivery only. The queue is protected by lock.
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      // Signalled when a frame is added, or on stop.
+    pthread_cond_t delivered;   // Signalled when a frame has been delivered.
+    loopback_frame_t* head;
+    loopback_frame_t* tail;
+    int queue_length;
+    // Set while the thread is delivering a frame taken off the queue.
+    int busy;
+    int stop;
+} vsd_loopback_t;
+
+int vsd_loopback_threads = 0;
+pthread_mutex_t vsd_loopback_lock;
+
+static pthread_once_t _lock_once = PTHREAD_ONCE_INIT;
+
+static void _lock_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&vsd_loopback_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+
+static int _loopback_transmit(vsd_transport_t* transport,
+                              uint32_t signature,
+                              const uint8_t* data,
+                              uint16_t len);
+
+static vsd_loopback_t* _loopback(vsd_transport_t* transport)
+{
+    if (!transport || transport->transmit != _loopback_transmit)
+        return 0;
+
+    return (vsd_loopback_t*) transport;
+}
+
+
+static int _loopback_transmit(vsd_transport_t* transport,
+                              uint32_t signature,
+                              const uint8_t* data,
+                              uint16_t len)
+{
+    vsd_loopback_t* lb = (vsd_loopback_t*) transport;
+    loopback_frame_t* frame = 0;
+
+    // Deliver directly from within vsd_publish().
+    if (!(lb->flags & VSD_LOOPBACK_THREAD))
+        return vsd_receive_frame(0, signature, data, len);
+
+    // data is only valid during this call. Take a copy.
+    frame = (loopback_frame_t*) malloc(sizeof(loopback_frame_t) + len);
+    if (!frame) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", sizeof(loopback_frame_t) + len);
+        exit(255);
+    }
+
+    frame->next = 0;
+    frame->signature = signature;
+    frame->len = len;
+    memcpy(frame->data, data, len);
+
+    pthread_mutex_lock(&lb->lock);
+
+    // Block the publisher while the queue is full. A subscriber
+    // publishing from the loopback thread would wait for itself, so
+    // its frames are queued past the limit, after those already
+    // queued.
+    while(lb->queue_length >= VSD_LOOPBACK_QUEUE_LENGTH &&
+          !pthread_equal(pthread_self(), lb->thread))
+        pthread_cond_wait(&lb->delivered, &lb->lock);
+
+    if (lb->tail)
+        lb->tail->next = frame;
+    else
+        lb->head = frame;
+
+    lb->tail = frame;
+    lb->queue_length++;
+    pthread_cond_signal(&lb->queued);
+    pthread_mutex_unlock(&lb->lock);
+    return 0;
+}
+
+
+static void* _loopback_thread(void* arg)
+{
+    vsd_loopback_t* lb = (vsd_loopback_t*) arg;
+
+    pthread_mutex_lock(&lb->lock);
+    while(1) {
+        loopback_frame_t* frame = 0;
+
+        // Deliver all queued frames before stopping.
+        while(!lb->head && !lb->stop)
+            pthread_cond_wait(&lb->queued, &lb->lock);
+
+        if (!lb->head)
+            break;
+
+        frame = lb->head;
+        lb->head = frame->next;
+        if (!lb->head)
+            lb->tail = 0;
+
+        lb->queue_length--;
+        lb->busy = 1;
+
+        // Do not hold the lock while subscribers run, since they
+        // may publish.
+        pthread_mutex_unlock(&lb->lock);
+        pthread_mutex_lock(&vsd_loopback_lock);
+        vsd_receive_frame(0, frame->signature, frame->data, frame->len);
+        pthread_mutex_unlock(&vsd_loopback_lock);
+        free(frame);
+        pthread_mutex_lock(&lb->lock);
+
+        lb->busy = 0;
+        pthread_cond_broadcast(&lb->delivered);
+    }
+    pthread_mutex_unlock(&lb->lock);
+    return 0;
+}
+
+
+int vsd_loopback_create(vsd_context_t* ctx,
+                        uint32_t flags,
+                        vsd_transport_t** result)
+{
+    vsd_loopback_t* lb = 0;
+    int res = 0;
+
+    if (!result)
+        return EINVAL;
+
+    lb = (vsd_loopback_t*) malloc(sizeof(vsd_loopback_t));
+    if (!lb) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", sizeof(vsd_loopback_t));
+        exit(255);
+    }
+
+    memset(lb, 0, sizeof(*lb));
+    lb->transport.name = "loopback";
+    lb->transport.transmit = _loopback_transmit;
+    lb->flags = flags;
+
+    if (flags & VSD_LOOPBACK_THREAD) {
+        pthread_once(&_lock_once, _lock_init);
+        pthread_mutex_init(&lb->lock, 0);
+        pthread_cond_init(&lb->queued, 0);
+        pthread_cond_init(&lb->delivered, 0);
+
+        res = pthread_create(&lb->thread, 0, _loopback_thread, lb);
+        if (res) {
+            RMC_LOG_ERROR("Could not create loopback thread: %s", strerror(res));
+            pthread_cond_destroy(&lb->delivered);
+            pthread_cond_destroy(&lb->queued);
+            pthread_mutex_destroy(&lb->lock);
+            free(lb);
+            return res;
+        }
+        vsd_loopback_threads++;
+    }
+
+    *result = &lb->transport;
+    return 0;
+}
+
+
+int vsd_loopback_flush(vsd_transport_t* transport)
+{
+    vsd_loopback_t* lb = _loopback(transport);
+
+    if (!lb)
+        return EINVAL;
+
+    if (!(lb->flags & VSD_LOOPBACK_THREAD))
+        return 0;
+
+    // Flushing from a subscriber would wait for itself.
+    if (pthread_equal(pthread_self(), lb->thread))
+        return EDEADLK;
+
+    pthread_mutex_lock(&lb->lock);
+    while(lb->head || lb->busy)
+        pthread_cond_wait(&lb->delivered, &lb->lock);
+    pthread_mutex_unlock(&lb->lock);
+    return 0;
+}
+
+
+int vsd_loopback_destroy(vsd_transport_t* transport)
+{
+    vsd_loopback_t* lb = _loopback(transport);
+
+    if (!lb)
+        return EINVAL;
+
+    if (vsd_get_transport(0) == transport)
+        return EBUSY;
+
+    if (lb->flags & VSD_LOOPBACK_THREAD) {
+        if (pthread_equal(pthread_self(), lb->thread))
+            return EDEADLK;
+
+        pthread_mutex_lock(&lb->lock);
+        lb->stop = 1;
+        pthread_cond_signal(&lb->queued);
+        pthread_mutex_unlock(&lb->lock);
+
+        pthread_join(lb->thread, 0);
+        vsd_loopback_threads--;
+        pthread_cond_destroy(&lb->delivered);
+        pthread_cond_destroy(&lb->queued);
+        pthread_mutex_destroy(&lb->lock);
+    }
+
+    free(lb);
+    return 0;
+}
@@ -0,0 +1,373 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Locale independent parsing of numeric signal values
+//
+#define _GNU_SOURCE
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <errno.h>
+#include <pthread.h>
+#include <rmc_log.h>
+
+// Integers are parsed by hand. Eight digits at a time are validated
+// and converted with a few 64 bit operations (SWAR) where the input
+// allows it.
+//
+// Decimal numbers with at most 19 significant digits and a small
+// enough exponent are converted exactly with a single multiplication
+// or division, following Clinger's fast path. All other numbers,
+// and inf, nan and hex floats, are handed to strtod_l() with the C
+// locale, so that results always match strtod() in the C locale.
+//
+
+// Maximum number of decimal digits held by a uint64_t without overflow.
+#define MAX_DIGITS 19
+
+// Input handed to strtod_l() is copied to a buffer on the stack of
+// this size, or to the heap if it is longer.
+#define FALLBACK_BUF_LEN 128
+
+static const double _pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+
+static const float _pow10f[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+static locale_t _c_locale = 0;
+static pthread_once_t _c_locale_once = PTHREAD_ONCE_INIT;
+
+static inline int _is_digit(char c)
+{
+    return (unsigned) (c - '0') < 10;
+}
+
+static inline int _is_space(char c)
+{
+    return c == ' ' || (unsigned) (c - '\t') < 5;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Return non-zero if all eight bytes of chunk are ASCII digits.
+static inline int _is_8_digits(uint64_t chunk)
+{
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+        0x3333333333333333ULL;
+}
+
+// Return the value of the eight ASCII digits in chunk, first digit
+// in the lowest byte.
+static inline uint32_t _parse_8_digits(uint64_t chunk)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    return (uint32_t) ((((chunk & mask) * mul1) +
+                        (((chunk >> 16) & mask) * mul2)) >> 32);
+}
+#endif
+
+// Accumulate the digits at str into *mantissa, up to MAX_DIGITS
+// digits in total as counted by *digits. Further digits are skipped,
+// and counted in *dropped.
+// Returns a pointer to the first non-digit.
+static const char* _digits(const char* str, const char* end,
+                           uint64_t* mantissa, int* digits, int* dropped)
+{
+    uint64_t mant = *mantissa;
+    int count = *digits;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while(end - str >= 8 && count + 8 <= MAX_DIGITS) {
+        uint64_t chunk = 0;
+
+        memcpy(&chunk, str, sizeof(chunk));
+        if (!_is_8_digits(chunk))
+            break;
+
+        mant = mant * 100000000 + _parse_8_digits(chunk);
+        count += 8;
+        str += 8;
+    }
+#endif
+
+    while(str < end && _is_digit(*str) && count < MAX_DIGITS) {
+        mant = mant * 10 + (*str - '0');
+        count++;
+        str++;
+    }
+
+    while(str < end && _is_digit(*str)) {
+        (*dropped)++;
+        str++;
+    }
+
+    *mantissa = mant;
+    *digits = count;
+    return str;
+}
+
+
+const char* vsd_parse_int(const char* str, const char* end, int64_t* result)
+{
+    const char* start = 0;
+    uint64_t mant = 0;
+    int digits = 0;
+    int dropped = 0;
+    int neg = 0;
+
+    while(str < end && _is_space(*str))
+        str++;
+
+    if (str < end && (*str == '-' || *str == '+'))
+        neg = *str++ == '-';
+
+    // Leading zeros do not count towards the digit limit.
+    start = str;
+    while(str < end && *str == '0')
+        str++;
+
+    str = _digits(str, end, &mant, &digits, &dropped);
+
+    // No digits. Same as strtol().
+    if (str == start) {
+        *result = 0;
+        return str;
+    }
+
+    // Saturate on overflow, as strtol() does.
+    if (dropped || mant > (uint64_t) INT64_MAX + neg)
+        *result = neg ? INT64_MIN : INT64_MAX;
+    else
+        *result = neg ? (int64_t) (0 - mant) : (int64_t) mant;
+
+    return str;
+}
+
+
+// Parse the number at str into its sign, significant digits and
+// decimal exponent. Returns 0 if the fast path cannot be taken.
+static int _decimal(const char* str, const char* end,
+                    int* neg, uint64_t* mantissa, int* exponent, const char** stop)
+{
+    const char* digits_start = 0;
+    uint64_t mant = 0;
+    int digits = 0;
+    int dropped = 0;
+    int exp = 0;
+    int any = 0;
+
+    while(str < end && _is_space(*str))
+        str++;
+
+    *neg = 0;
+    if (str < end && (*str == '-' || *str == '+'))
+        *neg = *str++ == '-';
+
+    // Integer part.
+    digits_start = str;
+    while(str < end && *str == '0')
+        str++;
+
+    str = _digits(str, end, &mant, &digits, &dropped);
+    any = str != digits_start;
+
+    // Hex float.
+    if (str < end && (*str == 'x' || *str == 'X'))
+        return 0;
+
+    // Fraction.
+    if (!dropped && str < end && *str == '.') {
+        const char* frac_start = ++str;
+        const char* frac = 0;
+
+        // Zeros right after the point only move the exponent.
+        if (!mant)
+            while(str < end && *str == '0')
+                str++;
+
+        frac = str;
+        str = _digits(str, end, &mant, &digits, &dropped);
+        exp -= (frac - frac_start) + (str - frac) - dropped;
+        any = any || str != frac_start;
+    }
+
+    // Too many significant digits, or not a decimal number (inf, nan, 0x).
+    if (dropped || !any)
+        return 0;
+
+    // Exponent.
+    if (str < end && (*str == 'e' || *str == 'E')) {
+        const char* exp_start = str++;
+        int exp_neg = 0;
+        int exp_val = 0;
+
+        if (str < end && (*str == '-' || *str == '+'))
+            exp_neg = *str++ == '-';
+
+        if (str == end || !_is_digit(*str))
+            // Not an exponent, as in "1e". Stop before the 'e'.
+            str = exp_start;
+        else {
+            while(str < end && _is_digit(*str)) {
+                // Out of range either way. Let strtod_l() sort it out.
+                if (exp_val > 10000)
+                    return 0;
+
+                exp_val = exp_val * 10 + (*str++ - '0');
+            }
+            exp += exp_neg ? -exp_val : exp_val;
+        }
+    }
+
+    *mantissa = mant;
+    *exponent = exp;
+    *stop = str;
+    return 1;
+}
+
+
+static void _c_locale_init(void)
+{
+    _c_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+    if (!_c_locale) {
+        RMC_LOG_FATAL("Could not create C locale");
+        exit(255);
+    }
+}
+
+
+// Hand a number to strtod_l(), for the cases the fast path does not cover.
+static const char* _fallback(const char* str, const char* end, double* dbl, float* flt)
+{
+    char stack_buf[FALLBACK_BUF_LEN];
+    char* buf = stack_buf;
+    size_t len = end - str;
+    char* stop = 0;
+
+    // Parsing may run on several threads.
+    pthread_once(&_c_locale_once, _c_locale_init);
+
+    // str is not necessarily null terminated.
+    if (len >= sizeof(stack_buf)) {
+        buf = (char*) malloc(len + 1);
+        if (!buf) {
+            RMC_LOG_FATAL("Failed to allocate %lu bytes.", len + 1);
+            exit(255);
+        }
+    }
+
+    memcpy(buf, str, len);
+    buf[len] = 0;
+
+    if (dbl)
+        *dbl = strtod_l(buf, &stop, _c_locale);
+    else
+        *flt = strtof_l(buf, &stop, _c_locale);
+
+    str += stop - buf;
+    if (buf != stack_buf)
+        free(buf);
+
+    return str;
+}
+
+
+const char* vsd_parse_double(const char* str, const char* end, double* result)
+{
+    const char* stop = 0;
+    uint64_t mant = 0;
+    int exp = 0;
+    int neg = 0;
+    double val = 0;
+
+    if (!_decimal(str, end, &neg, &mant, &exp, &stop) ||
+        mant > (1ULL << 53) ||
+        exp < -22 || exp > 22)
+        return _fallback(str, end, result, 0);
+
+    // Both mant and 10^|exp| are exact doubles, so the result is
+    // correctly rounded.
+    val = (double) mant;
+    val = exp < 0 ? val / _pow10[-exp] : val * _pow10[exp];
+    *result = neg ? -val : val;
+    return stop;
+}
+
+
+const char* vsd_parse_float(const char* str, const char* end, float* result)
+{
+    const char* stop = 0;
+    uint64_t mant = 0;
+    int exp = 0;
+    int neg = 0;
+    float val = 0;
+
+    if (!_decimal(str, end, &neg, &mant, &exp, &stop) ||
+        mant > (1ULL << 24) ||
+        exp < -10 || exp > 10)
+        return _fallback(str, end, 0, result);
+
+    val = (float) mant;
+    val = exp < 0 ? val / _pow10f[-exp] : val * _pow10f[exp];
+    *result = neg ? -val : val;
+    return stop;
+}
+
+
+int vsd_parse_value(vss_data_type_e type, const char* str, const char* end, vsd_data_u* res)
+{
+    int64_t ival = 0;
+
+    switch(type) {
+    case VSS_INT8:
+    case VSS_INT16:
+    case VSS_INT32:
+    case VSS_UINT8:
+    case VSS_UINT16:
+    case VSS_UINT32:
+        vsd_parse_int(str, end, &ival);
+        break;
+
+    case VSS_DOUBLE:
+        *res = vsd_data_u_nil;
+        vsd_parse_double(str, end, &res->d);
+        return 0;
+
+    case VSS_FLOAT:
+        *res = vsd_data_u_nil;
+        vsd_parse_float(str, end, &res->f);
+        return 0;
+
+    case VSS_BOOLEAN:
+        *res = (vsd_data_u) { .b = (str < end && (*str == '1' || *str == 't' || *str == 'T'))?1:0 };
+        return 0;
+
+    default:
+        return EINVAL;
+    }
+
+    switch(type) {
+    case VSS_INT8: *res = (vsd_data_u) { .i8 = (int8_t) ival }; break;
+    case VSS_UINT8: *res = (vsd_data_u) { .u8 = (uint8_t) ival }; break;
+    case VSS_INT16: *res = (vsd_data_u) { .i16 = (int16_t) ival }; break;
+    case VSS_UINT16: *res = (vsd_data_u) { .u16 = (uint16_t) ival }; break;
+    case VSS_INT32: *res = (vsd_data_u) { .i32 = (int32_t) ival }; break;
+    default: *res = (vsd_data_u) { .u32 = (uint32_t) ival }; break;
+    }
+    return 0;
+}
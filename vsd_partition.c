@@ -0,0 +1,195 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Routing of published frames to transports by branch
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dstc.h>
+#include <rmc_log.h>
+
+// One DSTC endpoint per partition. The servers are declared by the
+// receiving nodes themselves, through VSD_PARTITION_SERVER().
+DSTC_CLIENT(vsd_partition_transmit_0, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_1, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_2, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_3, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_4, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_5, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_6, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+DSTC_CLIENT(vsd_partition_transmit_7, uint32_t,, DSTC_DECL_DYNAMIC_ARG )
+
+typedef struct {
+    // Must be first, since vsd_transport_t pointers are cast
+    // back to vsd_partition_t.
+    vsd_transport_t transport;
+    vsd_transport_t* fallback;
+
+    // Indexed by signal index. Transport given to vsd_partition_assign()
+    // for the signal, and the one frames published on the signal are
+    // sent through, inherited from the nearest assigned ancestor.
+    vsd_transport_t** assigned;
+    vsd_transport_t** routes;
+    int signal_count;
+} vsd_partition_t;
+
+
+static int _partition_transmit(vsd_transport_t* transport,
+                               uint32_t signature,
+                               const uint8_t* data,
+                               uint16_t len);
+
+static vsd_partition_t* _partition(vsd_transport_t* transport)
+{
+    if (!transport || transport->transmit != _partition_transmit)
+        return 0;
+
+    return (vsd_partition_t*) transport;
+}
+
+
+static int _partition_transmit(vsd_transport_t* transport,
+                               uint32_t signature,
+                               const uint8_t* data,
+                               uint16_t len)
+{
+    vsd_partition_t* part = (vsd_partition_t*) transport;
+    vss_signal_t* sig = vsd_signal_by_signature(signature);
+    vsd_transport_t* target = 0;
+
+    if (sig && sig->index >= 0 && sig->index < part->signal_count)
+        target = part->routes[sig->index];
+
+    if (!target)
+        target = part->fallback;
+
+    return (*target->transmit)(target, signature, data, len);
+}
+
+
+int vsd_partition_create(vsd_context_t* ctx,
+                         vsd_transport_t* fallback,
+                         vsd_transport_t** result)
+{
+    vsd_partition_t* part = 0;
+    int count = vss_get_signal_count();
+
+    if (!result || (fallback && !fallback->transmit))
+        return EINVAL;
+
+    part = (vsd_partition_t*) malloc(sizeof(vsd_partition_t));
+    if (!part) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", sizeof(vsd_partition_t));
+        exit(255);
+    }
+
+    memset(part, 0, sizeof(*part));
+    part->assigned = (vsd_transport_t**) calloc(count, sizeof(vsd_transport_t*));
+    part->routes = (vsd_transport_t**) calloc(count, sizeof(vsd_transport_t*));
+    if (count && (!part->assigned || !part->routes)) {
+        RMC_LOG_FATAL("Failed to allocate routes for %d signals.", count);
+        exit(255);
+    }
+
+    part->transport.name = "partition";
+    part->transport.transmit = _partition_transmit;
+    part->fallback = fallback ? fallback : &vsd_dstc_transport;
+    part->signal_count = count;
+
+    *result = &part->transport;
+    return 0;
+}
+
+
+int vsd_partition_assign(vsd_transport_t* transport,
+                         vss_signal_t* sig,
+                         vsd_transport_t* target)
+{
+    vsd_partition_t* part = _partition(transport);
+    int ind = 0;
+
+    if (!part || !sig || target == transport || (target && !target->transmit))
+        return EINVAL;
+
+    if (sig->index < 0 || sig->index >= part->signal_count)
+        return ENOENT;
+
+    part->assigned[sig->index] = target;
+
+    // Assignments are rare. Resolve the route of every signal now,
+    // so that transmit is a single lookup.
+    for(ind = 0; ind < part->signal_count; ++ind) {
+        vss_signal_t* current = vss_get_signal_by_index(ind);
+
+        part->routes[ind] = 0;
+        while(current) {
+            if (current->index >= 0 && current->index < part->signal_count &&
+                part->assigned[current->index]) {
+                part->routes[ind] = part->assigned[current->index];
+                break;
+            }
+            current = current->parent;
+        }
+    }
+    return 0;
+}
+
+
+int vsd_partition_destroy(vsd_transport_t* transport)
+{
+    vsd_partition_t* part = _partition(transport);
+
+    if (!part)
+        return EINVAL;
+
+    free(part->assigned);
+    free(part->routes);
+    free(part);
+    return 0;
+}
+
+
+// DSTC endpoint transports, one per partition.
+
+#define PARTITION_TRANSMIT(n)                                           \
+    static int _dstc_partition_transmit_##n(vsd_transport_t* transport, \
+                                            uint32_t signature,         \
+                                            const uint8_t* data,        \
+                                            uint16_t len)               \
+    {                                                                   \
+        return dstc_vsd_partition_transmit_##n(signature, DSTC_DYNAMIC_ARG(data, len)); \
+    }
+
+PARTITION_TRANSMIT(0)
+PARTITION_TRANSMIT(1)
+PARTITION_TRANSMIT(2)
+PARTITION_TRANSMIT(3)
+PARTITION_TRANSMIT(4)
+PARTITION_TRANSMIT(5)
+PARTITION_TRANSMIT(6)
+PARTITION_TRANSMIT(7)
+
+static vsd_transport_t _dstc_partitions[VSD_PARTITION_COUNT] = {
+    { .name = "dstc-partition-0", .transmit = _dstc_partition_transmit_0 },
+    { .name = "dstc-partition-1", .transmit = _dstc_partition_transmit_1 },
+    { .name = "dstc-partition-2", .transmit = _dstc_partition_transmit_2 },
+    { .name = "dstc-partition-3", .transmit = _dstc_partition_transmit_3 },
+    { .name = "dstc-partition-4", .transmit = _dstc_partition_transmit_4 },
+    { .name = "dstc-partition-5", .transmit = _dstc_partition_transmit_5 },
+    { .name = "dstc-partition-6", .transmit = _dstc_partition_transmit_6 },
+    { .name = "dstc-partition-7", .transmit = _dstc_partition_transmit_7 },
+};
+
+vsd_transport_t* vsd_dstc_partition(int partition)
+{
+    if (partition < 0 || partition >= VSD_PARTITION_COUNT)
+        return 0;
+
+    return &_dstc_partitions[partition];
+}
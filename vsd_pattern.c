@@ -0,0 +1,756 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Pattern subscriptions, and conflating subscriptions
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <rmc_log.h>
+
+// Each pattern subscription is compiled into a bitset over signal
+// indices, with a bit set for every leaf signal matched by any of its
+// patterns. Only the range of words holding set bits is stored.
+//
+// A received frame is turned into a bitset of its decoded signals.
+// Each word of the full bitset has a list of the subscriptions with
+// bits set in it, so matching a frame only visits the subscriptions
+// that have bits in the words set by the frame. How many
+// subscriptions there are elsewhere in the tree, or how many signals
+// their patterns match, does not matter.
+//
+// Conflating subscriptions, made with VSD_SUBSCRIBE_CONFLATE, use the
+// same bitsets. Instead of invoking the callback, matching signals of
+// a frame are ORed into a pending bitset, which is turned into a
+// single signal list by vsd_deliver_conflated().
+//
+// Rate limited subscriptions are conflating subscriptions delivered
+// by a timer instead. The timer is armed when a signal becomes
+// pending within the period of the previous delivery, and otherwise
+// the pending signals are delivered at once.
+//
+typedef struct _pattern_sub_t {
+    struct _pattern_sub_t* next;
+    vsd_subscriber_cb_t callback;
+    // Branch subscribed to by a conflating subscription.
+    vss_signal_t* sig;
+    // Signals received, but not yet delivered, by a conflating
+    // subscription. Same word range as bits. Nil for plain pattern
+    // subscriptions.
+    uint64_t* pending;
+    int has_pending;
+    // Minimum time between deliveries of a rate limited
+    // subscription, or 0.
+    uint32_t period_msec;
+    int64_t delivered_msec;
+    vsd_timer_t timer;
+    // Set when frames held undecoded are pending. They are decoded
+    // before delivery.
+    int stale;
+    // Dispatch that last matched the subscription. Keeps it from being
+    // matched once for each word it shares with a frame.
+    uint64_t dispatch_seq;
+    // Range of words in bits, as word indices into the full bitset.
+    int first_word;
+    int last_word;
+    uint64_t bits[];
+} pattern_sub_t;
+
+static pattern_sub_t* _pattern_subs = 0;
+
+// Subscriptions with bits set in one word of the full bitset.
+typedef struct {
+    pattern_sub_t** subs;
+    int count;
+    int allocated;
+} word_index_t;
+
+// One entry for each word of the full bitset.
+static word_index_t* _word_index = 0;
+
+// Number of active pattern and conflating subscriptions.
+uint32_t vsd_pattern_count = 0;
+uint32_t vsd_rate_limited_count = 0;
+
+// Bitset of the signals decoded from a frame being dispatched.
+// Only the words between first and last can be non-zero.
+typedef struct {
+    uint64_t* bits;
+    int first;
+    int last;
+} frame_bits_t;
+
+// Reused by all non-nested dispatches. Cleared after each frame.
+static uint64_t* _frame_bits = 0;
+static int _frame_words = 0;
+
+// Subscriptions matched by a frame, reused by all non-nested
+// dispatches.
+static pattern_sub_t** _matched = 0;
+static int _matched_allocated = 0;
+static uint64_t _dispatch_seq = 0;
+
+// Number of dispatches in progress. Above 0 if a subscriber causes a
+// frame to be received from within its callback, for example by
+// publishing through an inline loopback transport.
+static int _dispatch_depth = 0;
+
+// Set when vsd_unsubscribe_pattern() is called from a callback.
+// The subscriptions are only freed once dispatch is done.
+static int _unsubscribed = 0;
+
+static inline void _set_bit(uint64_t* bits, int index)
+{
+    bits[index >> 6] |= (uint64_t) 1 << (index & 63);
+}
+
+
+// Set the bits of all leaf signals in the tree under sig.
+static void _set_subtree(uint64_t* bits, vss_signal_t* sig)
+{
+    int ind = 0;
+
+    if (sig->element_type != VSS_BRANCH) {
+        _set_bit(bits, sig->index);
+        return;
+    }
+
+    for(ind = 0; sig->children && sig->children[ind]; ++ind)
+        _set_subtree(bits, sig->children[ind]);
+}
+
+
+// Match the first component of pattern against sig, and the remaining
+// components against its descendants. Returns the number of matches.
+static int _match(uint64_t* bits, vss_signal_t* sig, const char* pattern)
+{
+    const char* end = strchr(pattern, '.');
+    int len = end ? end - pattern : strlen(pattern);
+    int res = 0;
+    int ind = 0;
+
+    if (!(len == 1 && pattern[0] == '*') &&
+        (strncmp(sig->name, pattern, len) || sig->name[len]))
+        return 0;
+
+    // Last component. Subscribe to sig and everything below it.
+    if (!end) {
+        _set_subtree(bits, sig);
+        return 1;
+    }
+
+    for(ind = 0; sig->children && sig->children[ind]; ++ind)
+        res += _match(bits, sig->children[ind], end + 1);
+
+    return res;
+}
+
+
+static uint64_t* _alloc_bits(int words)
+{
+    uint64_t* bits = (uint64_t*) calloc(words, sizeof(uint64_t));
+
+    if (!bits) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", words * sizeof(uint64_t));
+        exit(255);
+    }
+    return bits;
+}
+
+
+// Add sub to the index of each word it has bits set in.
+static void _index_add(pattern_sub_t* sub)
+{
+    int ind = 0;
+
+    for(ind = 0; ind <= sub->last_word - sub->first_word; ++ind) {
+        word_index_t* entry = &_word_index[sub->first_word + ind];
+
+        if (!sub->bits[ind])
+            continue;
+
+        if (entry->count == entry->allocated) {
+            entry->allocated = entry->allocated ? entry->allocated * 2 : 4;
+            entry->subs = (pattern_sub_t**) realloc(entry->subs,
+                                                    entry->allocated * sizeof(pattern_sub_t*));
+            if (!entry->subs) {
+                RMC_LOG_FATAL("Failed to allocate %lu bytes.",
+                              entry->allocated * sizeof(pattern_sub_t*));
+                exit(255);
+            }
+        }
+        entry->subs[entry->count++] = sub;
+    }
+}
+
+
+static void _index_remove(pattern_sub_t* sub)
+{
+    int ind = 0;
+
+    for(ind = 0; ind <= sub->last_word - sub->first_word; ++ind) {
+        word_index_t* entry = &_word_index[sub->first_word + ind];
+        int pos = 0;
+
+        if (!sub->bits[ind])
+            continue;
+
+        for(pos = 0; pos < entry->count; ++pos)
+            if (entry->subs[pos] == sub) {
+                entry->subs[pos] = entry->subs[--entry->count];
+                break;
+            }
+    }
+}
+
+
+static void _rate_fire(vsd_timer_t* timer, int64_t now_usec);
+
+// Add a subscription for the signals set in bits, which spans words
+// words, and free bits. If sig is not nil, the subscription conflates,
+// and is delivered at most every period_msec if that is not 0.
+static int _add_sub(uint64_t* bits, int words, vsd_subscriber_cb_t callback,
+                    vss_signal_t* sig, uint32_t period_msec)
+{
+    pattern_sub_t* sub = 0;
+    int first = 0;
+    int last = 0;
+    int count = 0;
+
+    // Find the range of words with bits set.
+    first = 0;
+    while(first < words && !bits[first])
+        first++;
+
+    last = words - 1;
+    while(last >= first && !bits[last])
+        last--;
+
+    if (first > last) {
+        free(bits);
+        return ENOENT;
+    }
+
+    // Conflating subscriptions keep their pending bits after the mask.
+    count = last - first + 1;
+    sub = (pattern_sub_t*) calloc(1, sizeof(pattern_sub_t) +
+                                  (sig ? 2 : 1) * count * sizeof(uint64_t));
+    if (!sub) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.",
+                      sizeof(pattern_sub_t) + (sig ? 2 : 1) * count * sizeof(uint64_t));
+        exit(255);
+    }
+
+    sub->callback = callback;
+    sub->sig = sig;
+    sub->pending = sig ? sub->bits + count : 0;
+    sub->period_msec = period_msec;
+    vsd_timer_init(&sub->timer, _rate_fire, sub);
+    sub->first_word = first;
+    sub->last_word = last;
+    memcpy(sub->bits, bits + first, count * sizeof(uint64_t));
+    free(bits);
+
+    if (!_frame_bits) {
+        _frame_bits = _alloc_bits(words);
+        _frame_words = words;
+        _word_index = (word_index_t*) calloc(words, sizeof(word_index_t));
+        if (!_word_index) {
+            RMC_LOG_FATAL("Failed to allocate %lu bytes.", words * sizeof(word_index_t));
+            exit(255);
+        }
+    }
+
+    sub->next = _pattern_subs;
+    _pattern_subs = sub;
+    _index_add(sub);
+    vsd_pattern_count++;
+    if (period_msec)
+        vsd_rate_limited_count++;
+
+    vsd_interest_changed();
+    return 0;
+}
+
+
+int vsd_subscribe_paths(vsd_context_t* ctx,
+                        const char** patterns,
+                        int pattern_count,
+                        vsd_subscriber_cb_t callback)
+{
+    int words = (vss_get_signal_count() + 63) / 64;
+    vss_signal_t* root = vss_get_signal_by_index(0);
+    uint64_t* bits = 0;
+    int ind = 0;
+
+    if (!patterns || pattern_count <= 0 || !callback || !root)
+        return EINVAL;
+
+    // Walk up to the root of the tree.
+    while(root->parent)
+        root = root->parent;
+
+    bits = _alloc_bits(words);
+
+    for(ind = 0; ind < pattern_count; ++ind) {
+        if (!patterns[ind] || !*patterns[ind]) {
+            free(bits);
+            return EINVAL;
+        }
+
+        if (!_match(bits, root, patterns[ind]))
+            RMC_LOG_WARNING("Pattern %s matches no signals", patterns[ind]);
+    }
+
+    return _add_sub(bits, words, callback, 0, 0);
+}
+
+
+int vsd_conflate_subscribe(vss_signal_t* sig, vsd_subscriber_cb_t callback)
+{
+    int words = (vss_get_signal_count() + 63) / 64;
+    uint64_t* bits = _alloc_bits(words);
+
+    _set_subtree(bits, sig);
+    return _add_sub(bits, words, callback, sig, 0);
+}
+
+
+int vsd_subscribe_rate_limited(vsd_context_t* ctx,
+                               vss_signal_t* sig,
+                               vsd_subscriber_cb_t callback,
+                               uint32_t period_msec)
+{
+    int words = (vss_get_signal_count() + 63) / 64;
+    uint64_t* bits = 0;
+
+    if (!sig || !callback || !period_msec)
+        return EINVAL;
+
+    bits = _alloc_bits(words);
+    _set_subtree(bits, sig);
+    return _add_sub(bits, words, callback, sig, period_msec);
+}
+
+
+int vsd_subscribe_pattern(vsd_context_t* ctx,
+                          const char* pattern,
+                          vsd_subscriber_cb_t callback)
+{
+    return vsd_subscribe_paths(ctx, &pattern, 1, callback);
+}
+
+
+// Free all subscriptions that were unsubscribed during dispatch.
+static void _sweep(void)
+{
+    pattern_sub_t** prev = &_pattern_subs;
+
+    while(*prev) {
+        pattern_sub_t* sub = *prev;
+
+        if (sub->callback) {
+            prev = &sub->next;
+            continue;
+        }
+
+        *prev = sub->next;
+        _index_remove(sub);
+        free(sub);
+    }
+    _unsubscribed = 0;
+}
+
+
+int vsd_unsubscribe_pattern(vsd_context_t* ctx,
+                            vsd_subscriber_cb_t callback)
+{
+    pattern_sub_t* sub = _pattern_subs;
+    int found = 0;
+
+    if (!callback)
+        return EINVAL;
+
+    // Clear the callbacks, leaving the subscriptions in the list
+    // in case a dispatch is iterating over it.
+    while(sub) {
+        if (sub->callback == callback && !sub->sig) {
+            sub->callback = 0;
+            vsd_pattern_count--;
+            found = 1;
+        }
+        sub = sub->next;
+    }
+
+    if (!found)
+        return ESRCH;
+
+    vsd_interest_changed();
+
+    if (_dispatch_depth)
+        _unsubscribed = 1;
+    else
+        _sweep();
+
+    return 0;
+}
+
+
+int vsd_conflate_unsubscribe(vss_signal_t* sig, vsd_subscriber_cb_t callback)
+{
+    pattern_sub_t* sub = _pattern_subs;
+
+    while(sub) {
+        if (sub->callback == callback && sub->sig == sig) {
+            sub->callback = 0;
+            vsd_pattern_count--;
+            if (sub->period_msec) {
+                vsd_timer_cancel(&sub->timer);
+                vsd_rate_limited_count--;
+            }
+            vsd_interest_changed();
+
+            if (_dispatch_depth)
+                _unsubscribed = 1;
+            else
+                _sweep();
+
+            return 0;
+        }
+        sub = sub->next;
+    }
+
+    return ESRCH;
+}
+
+
+int vsd_pattern_interest(uint64_t* bits, vsd_interest_rate_t* rates, int max_rates)
+{
+    pattern_sub_t* sub = _pattern_subs;
+    int count = 0;
+
+    while(sub) {
+        int ind = 0;
+
+        if (!sub->callback) {
+            sub = sub->next;
+            continue;
+        }
+
+        if (sub->period_msec && count < max_rates) {
+            rates[count].index = sub->sig->index;
+            rates[count].period_msec = sub->period_msec;
+            count++;
+        } else
+            for(ind = 0; ind <= sub->last_word - sub->first_word; ++ind)
+                bits[sub->first_word + ind] |= sub->bits[ind];
+
+        sub = sub->next;
+    }
+    return count;
+}
+
+
+static uint8_t _mark_decoded(vsd_signal_node_t* node, void* user_data)
+{
+    frame_bits_t* frame = (frame_bits_t*) user_data;
+    int index = node->data->index;
+    int word = index >> 6;
+
+    if (index < 0 || word >= _frame_words)
+        return 1;
+
+    _set_bit(frame->bits, index);
+
+    if (word < frame->first)
+        frame->first = word;
+
+    if (word > frame->last)
+        frame->last = word;
+
+    return 1;
+}
+
+
+// Add the signals in frame that are set in sub to its pending bits.
+static void _mark_pending(frame_bits_t* frame, pattern_sub_t* sub)
+{
+    int first = sub->first_word > frame->first ? sub->first_word : frame->first;
+    int last = sub->last_word < frame->last ? sub->last_word : frame->last;
+    const uint64_t* fbits = frame->bits + first;
+    const uint64_t* sbits = sub->bits + (first - sub->first_word);
+    uint64_t* pbits = sub->pending + (first - sub->first_word);
+    uint64_t res = 0;
+    int ind = 0;
+
+    for(ind = 0; ind <= last - first; ++ind) {
+        pbits[ind] |= fbits[ind] & sbits[ind];
+        res |= fbits[ind] & sbits[ind];
+    }
+
+    if (res)
+        sub->has_pending = 1;
+}
+
+
+// Build a list of all pending signals of sub, and clear them.
+static void _take_pending(pattern_sub_t* sub, vsd_signal_list_t* lst)
+{
+    int ind = 0;
+
+    for(ind = 0; ind <= sub->last_word - sub->first_word; ++ind) {
+        uint64_t word = sub->pending[ind];
+
+        while(word) {
+            int index = ((sub->first_word + ind) << 6) + __builtin_ctzll(word);
+
+            vsd_signal_list_push_tail(lst, vss_get_signal_by_index(index));
+            word &= word - 1;
+        }
+        sub->pending[ind] = 0;
+    }
+    sub->has_pending = 0;
+}
+
+
+// Invoke the callback of a conflating subscription with all its
+// pending signals. Must be called with _dispatch_depth raised.
+static void _deliver(vsd_context_t* ctx, pattern_sub_t* sub)
+{
+    vsd_signal_list_t lst;
+
+    if (sub->stale) {
+        sub->stale = 0;
+        vsd_lazy_resolve(sub->sig);
+    }
+
+    // Cleared before the callback, so that anything it
+    // receives is delivered next time.
+    vsd_signal_list_init(&lst, 0, 0, 0);
+    _take_pending(sub, &lst);
+
+    VSD_LATENCY_START(callback_start);
+    (*sub->callback)(ctx, &lst);
+    VSD_LATENCY_RECORD(sub->sig, VSD_LATENCY_CALLBACK, callback_start);
+
+    vsd_signal_list_empty(&lst);
+}
+
+
+// Deliver a rate limited subscription with pending signals now, if
+// its period has passed, or else once it has.
+static void _rate_limit(pattern_sub_t* sub, int64_t now_msec)
+{
+    if (vsd_timer_is_armed(&sub->timer))
+        return;
+
+    if (now_msec - sub->delivered_msec < sub->period_msec) {
+        vsd_timer_start(&sub->timer, sub->delivered_msec + sub->period_msec);
+        return;
+    }
+
+    sub->delivered_msec = now_msec;
+    _deliver(0, sub);
+}
+
+
+static void _rate_fire(vsd_timer_t* timer, int64_t now_usec)
+{
+    pattern_sub_t* sub = (pattern_sub_t*) timer->user_data;
+
+    if (!sub->callback || !sub->has_pending)
+        return;
+
+    _dispatch_depth++;
+    sub->delivered_msec = now_usec / 1000;
+    _deliver(0, sub);
+    _dispatch_depth--;
+
+    if (!_dispatch_depth && _unsubscribed)
+        _sweep();
+}
+
+
+int vsd_pattern_due(vss_signal_t* sig)
+{
+    pattern_sub_t* sub = _pattern_subs;
+    int64_t now = 0;
+
+    while(sub) {
+        if (sub->callback && sub->period_msec &&
+            !vsd_timer_is_armed(&sub->timer) &&
+            vsd_signal_related(sub->sig, sig)) {
+            if (!now)
+                now = vsd_msec_monotonic_timestamp();
+
+            if (now - sub->delivered_msec >= sub->period_msec)
+                return 1;
+        }
+        sub = sub->next;
+    }
+    return 0;
+}
+
+
+void vsd_pattern_held(vss_signal_t* sig)
+{
+    pattern_sub_t* sub = _pattern_subs;
+
+    while(sub) {
+        if (sub->callback && sub->period_msec &&
+            vsd_signal_related(sub->sig, sig)) {
+            // Which signals the frame carries is only known once it
+            // is decoded. Deliver all of them.
+            memcpy(sub->pending, sub->bits,
+                   (sub->last_word - sub->first_word + 1) * sizeof(uint64_t));
+            sub->has_pending = 1;
+            sub->stale = 1;
+
+            // vsd_pattern_due() said the period has not passed.
+            if (!vsd_timer_is_armed(&sub->timer))
+                vsd_timer_start(&sub->timer, sub->delivered_msec + sub->period_msec);
+        }
+        sub = sub->next;
+    }
+}
+
+
+// Store the subscriptions with bits set in frame in matched, each
+// once. Returns their number, which is at most vsd_pattern_count.
+static int _match_frame(frame_bits_t* frame, pattern_sub_t** matched)
+{
+    int count = 0;
+    int word = 0;
+
+    _dispatch_seq++;
+    for(word = frame->first; word <= frame->last; ++word) {
+        word_index_t* entry = &_word_index[word];
+        uint64_t fbits = frame->bits[word];
+        int ind = 0;
+
+        if (!fbits)
+            continue;
+
+        for(ind = 0; ind < entry->count; ++ind) {
+            pattern_sub_t* sub = entry->subs[ind];
+
+            if (!sub->callback || sub->dispatch_seq == _dispatch_seq ||
+                !(fbits & sub->bits[word - sub->first_word]))
+                continue;
+
+            sub->dispatch_seq = _dispatch_seq;
+            matched[count++] = sub;
+        }
+    }
+    return count;
+}
+
+
+void vsd_pattern_dispatch(vss_signal_t* sig, vsd_signal_list_t* res_lst)
+{
+    pattern_sub_t** matched = 0;
+    frame_bits_t frame;
+    int64_t now = 0;
+    int count = 0;
+    int ind = 0;
+
+    // A nested dispatch cannot reuse the bitset, or the matched
+    // subscriptions, of the frame still being dispatched further up
+    // the stack.
+    if (_dispatch_depth) {
+        frame.bits = _alloc_bits(_frame_words);
+        matched = (pattern_sub_t**) malloc((vsd_pattern_count ? vsd_pattern_count : 1) *
+                                           sizeof(pattern_sub_t*));
+    } else {
+        if (_matched_allocated < vsd_pattern_count) {
+            _matched_allocated = vsd_pattern_count;
+            _matched = (pattern_sub_t**) realloc(_matched, _matched_allocated * sizeof(pattern_sub_t*));
+        }
+        frame.bits = _frame_bits;
+        matched = _matched;
+    }
+
+    if (!matched) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", vsd_pattern_count * sizeof(pattern_sub_t*));
+        exit(255);
+    }
+
+    frame.first = _frame_words;
+    frame.last = -1;
+
+    _dispatch_depth++;
+    vsd_signal_list_for_each(res_lst, _mark_decoded, &frame);
+
+    // All matches are found before any callback runs, since a
+    // callback may subscribe or dispatch another frame.
+    count = _match_frame(&frame, matched);
+
+    for(ind = 0; ind < count; ++ind) {
+        pattern_sub_t* sub = matched[ind];
+
+        // Unsubscribed by an earlier callback.
+        if (!sub->callback)
+            continue;
+
+        if (sub->pending) {
+            _mark_pending(&frame, sub);
+
+            if (sub->period_msec && sub->has_pending) {
+                if (!now)
+                    now = vsd_msec_monotonic_timestamp();
+
+                _rate_limit(sub, now);
+            }
+            continue;
+        }
+
+        VSD_LATENCY_START(callback_start);
+        (*sub->callback)(0, res_lst);
+        VSD_LATENCY_RECORD(sig, VSD_LATENCY_CALLBACK, callback_start);
+    }
+    _dispatch_depth--;
+
+    if (frame.bits != _frame_bits) {
+        free(frame.bits);
+        free(matched);
+    } else
+        for(ind = frame.first; ind <= frame.last; ++ind)
+            frame.bits[ind] = 0;
+
+    if (!_dispatch_depth && _unsubscribed)
+        _sweep();
+}
+
+
+int vsd_deliver_conflated(vsd_context_t* ctx, vsd_subscriber_cb_t callback)
+{
+    pattern_sub_t* sub = _pattern_subs;
+    int found = 0;
+
+    _dispatch_depth++;
+    while(sub) {
+        // Rate limited subscriptions are delivered by their timer.
+        if (!sub->pending || !sub->callback || sub->period_msec ||
+            (callback && sub->callback != callback)) {
+            sub = sub->next;
+            continue;
+        }
+
+        found = 1;
+        if (sub->has_pending)
+            _deliver(ctx, sub);
+
+        sub = sub->next;
+    }
+    _dispatch_depth--;
+
+    if (!_dispatch_depth && _unsubscribed)
+        _sweep();
+
+    return (callback && !found) ? ESRCH : 0;
+}
@@ -0,0 +1,620 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Shared memory transport for publishers and subscribers on the same host
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <rmc_log.h>
+
+// Each publishing process owns a ring in a shared memory object of
+// its own, named after its pid. Processes find each other's rings
+// through a registry object shared by all VSD processes on the host.
+//
+// A ring is a byte buffer holding variable length records. The owner
+// is the only writer, and never waits for readers. If a reader falls
+// more than a ring behind, the records it has not yet read are
+// overwritten, and the reader skips ahead to the oldest intact record.
+//
+// head and tail are byte offsets that only grow, and are wrapped to
+// the ring size when used as indices:
+//
+//   head - End of the last record written.
+//   tail - Start of the oldest record that is still intact.
+//
+// Before the writer overwrites a record, it advances tail past it.
+// A reader copies a record out of the ring, and then checks that tail
+// has not passed the record's start. If it has, the copy may be torn
+// and is discarded.  This is the seqlock pattern, with tail serving
+// as the sequence number of the whole ring.
+//
+// Readers are woken through a futex on a doorbell counter in the
+// registry, which publishers increment on every frame written.
+//
+#define REGISTRY_NAME "/vsd-registry"
+#define RING_NAME_FORMAT "/vsd-ring-%d"
+
+#define REGISTRY_MAGIC 0x56534452   // "VSDR"
+#define RING_MAGIC 0x56534442       // "VSDB"
+#define SHM_VERSION 1
+
+// Maximum number of publishing processes per host.
+#define MAX_RINGS 64
+
+// Bytes of record data in each ring. Must be a power of two.
+#define RING_SIZE (1 << 20)
+
+// Maximum size of a single frame.
+#define MAX_FRAME_SIZE 0xFF00
+
+// Record length marking the unused space at the end of the ring
+// when the next record did not fit.
+#define RECORD_PAD 0xFFFFFFFF
+
+// Time to wait for another process to initialize the registry.
+#define REGISTRY_TIMEOUT_MSEC 1000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // Random id shared by all processes attached to this registry.
+    uint64_t host_id;
+    // Incremented by publishers after each frame. Futex.
+    uint32_t doorbell;
+    // Number of readers blocked on doorbell.
+    uint32_t waiters;
+    // Incremented every time owners is changed.
+    uint32_t generation;
+    // Pid of the process owning the ring of each slot, or 0.
+    int32_t owners[MAX_RINGS];
+} shm_registry_t;
+
+typedef struct {
+    uint32_t len;           // Frame length or RECORD_PAD
+    uint32_t signature;
+} shm_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    uint8_t data[] __attribute__((aligned(64)));
+} shm_ring_t;
+
+// A ring of another process that we read from.
+typedef struct {
+    int32_t owner;
+    shm_ring_t* ring;
+    size_t map_size;
+    uint64_t read_pos;
+} shm_reader_t;
+
+#define RECORD_SIZE(len) (((uint64_t) sizeof(shm_record_t) + (len) + 7) & ~(uint64_t) 7)
+
+static vsd_transport_t _shm_transport;
+static uint32_t _shm_flags = 0;
+
+static shm_registry_t* _registry = 0;
+static shm_ring_t* _ring = 0;
+static int _ring_slot = -1;
+
+static shm_reader_t _readers[MAX_RINGS];
+static uint32_t _generation = 0;
+
+// Number of times a reader was overrun and lost records.
+static uint64_t _overruns = 0;
+
+// Frames are copied here out of the ring before being decoded.
+static uint8_t _frame_buf[MAX_FRAME_SIZE];
+
+static long _futex(uint32_t* addr, int op, uint32_t val, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, 0, 0);
+}
+
+
+static void* _map(int fd, size_t size, int prot)
+{
+    void* res = mmap(0, size, prot, MAP_SHARED, fd, 0);
+
+    return (res == MAP_FAILED)?0:res;
+}
+
+
+static uint64_t _random_host_id(void)
+{
+    uint64_t res = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+
+    if (fd != -1) {
+        if (read(fd, &res, sizeof(res)) != sizeof(res))
+            res = 0;
+        close(fd);
+    }
+
+    if (!res)
+        res = (uint64_t) vsd_nsec_monotonic_timestamp() ^ ((uint64_t) getpid() << 32);
+
+    // 0 means no origin.
+    return res?res:1;
+}
+
+
+// Create the registry, or attach to the one created by another process.
+static int _registry_attach(void)
+{
+    int64_t deadline = vsd_msec_monotonic_timestamp() + REGISTRY_TIMEOUT_MSEC;
+    struct stat st;
+    int fd = shm_open(REGISTRY_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+
+    if (fd != -1) {
+        if (ftruncate(fd, sizeof(shm_registry_t)) == -1 ||
+            !(_registry = (shm_registry_t*) _map(fd, sizeof(shm_registry_t), PROT_READ | PROT_WRITE))) {
+            int res = errno;
+
+            close(fd);
+            shm_unlink(REGISTRY_NAME);
+            return res;
+        }
+
+        close(fd);
+        _registry->version = SHM_VERSION;
+        _registry->host_id = _random_host_id();
+
+        // Other processes wait for magic before using the registry.
+        __atomic_store_n(&_registry->magic, REGISTRY_MAGIC, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    if (errno != EEXIST)
+        return errno;
+
+    fd = shm_open(REGISTRY_NAME, O_RDWR, 0);
+    if (fd == -1)
+        return errno;
+
+    // The creator may not yet have sized the object.
+    while(!fstat(fd, &st) && st.st_size < sizeof(shm_registry_t)) {
+        if (vsd_msec_monotonic_timestamp() > deadline) {
+            close(fd);
+            return ETIMEDOUT;
+        }
+        usleep(1000);
+    }
+
+    _registry = (shm_registry_t*) _map(fd, sizeof(shm_registry_t), PROT_READ | PROT_WRITE);
+    close(fd);
+
+    if (!_registry)
+        return errno;
+
+    while(__atomic_load_n(&_registry->magic, __ATOMIC_ACQUIRE) != REGISTRY_MAGIC) {
+        if (vsd_msec_monotonic_timestamp() > deadline) {
+            munmap(_registry, sizeof(shm_registry_t));
+            _registry = 0;
+            return ETIMEDOUT;
+        }
+        usleep(1000);
+    }
+
+    if (_registry->version != SHM_VERSION) {
+        RMC_LOG_ERROR("Shared memory version mismatch. My version: %d. Their version: %d",
+                      SHM_VERSION, _registry->version);
+        munmap(_registry, sizeof(shm_registry_t));
+        _registry = 0;
+        return EPROTO;
+    }
+
+    return 0;
+}
+
+
+// Create our ring and claim a registry slot for it.
+static int _ring_create(void)
+{
+    char name[64];
+    size_t size = sizeof(shm_ring_t) + RING_SIZE;
+    int32_t pid = getpid();
+    int fd = 0;
+    int ind = 0;
+
+    snprintf(name, sizeof(name), RING_NAME_FORMAT, pid);
+
+    // Left behind by a dead process with our pid.
+    shm_unlink(name);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        return errno;
+
+    if (ftruncate(fd, size) == -1 ||
+        !(_ring = (shm_ring_t*) _map(fd, size, PROT_READ | PROT_WRITE))) {
+        int res = errno;
+
+        close(fd);
+        shm_unlink(name);
+        return res;
+    }
+    close(fd);
+
+    _ring->magic = RING_MAGIC;
+    _ring->size = RING_SIZE;
+
+    // Reclaim slots of processes that died without releasing them.
+    for(ind = 0; ind < MAX_RINGS; ++ind) {
+        int32_t owner = __atomic_load_n(&_registry->owners[ind], __ATOMIC_ACQUIRE);
+
+        if (owner && owner != pid && kill(owner, 0) == -1 && errno == ESRCH &&
+            __atomic_compare_exchange_n(&_registry->owners[ind], &owner, 0, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            snprintf(name, sizeof(name), RING_NAME_FORMAT, owner);
+            shm_unlink(name);
+            __atomic_add_fetch(&_registry->generation, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+
+    for(ind = 0; ind < MAX_RINGS; ++ind) {
+        int32_t owner = 0;
+
+        if (__atomic_compare_exchange_n(&_registry->owners[ind], &owner, pid, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            break;
+    }
+
+    if (ind == MAX_RINGS) {
+        RMC_LOG_ERROR("All %d shared memory publisher slots are in use", MAX_RINGS);
+        munmap(_ring, size);
+        _ring = 0;
+        snprintf(name, sizeof(name), RING_NAME_FORMAT, pid);
+        shm_unlink(name);
+        return ENOSPC;
+    }
+
+    _ring_slot = ind;
+    __atomic_add_fetch(&_registry->generation, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+
+static void _ring_destroy(void)
+{
+    char name[64];
+    int32_t pid = getpid();
+
+    if (!_ring)
+        return;
+
+    __atomic_compare_exchange_n(&_registry->owners[_ring_slot], &pid, 0, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&_registry->generation, 1, __ATOMIC_SEQ_CST);
+
+    munmap(_ring, sizeof(shm_ring_t) + RING_SIZE);
+    _ring = 0;
+    _ring_slot = -1;
+
+    snprintf(name, sizeof(name), RING_NAME_FORMAT, (int) getpid());
+    shm_unlink(name);
+}
+
+
+// Advance tail until need bytes from head can be written
+// without overwriting any intact record.
+static void _ring_reserve(uint64_t head, uint32_t need)
+{
+    uint64_t tail = _ring->tail;
+    uint64_t mask = _ring->size - 1;
+
+    if (head + need - tail <= _ring->size)
+        return;
+
+    while(head + need - tail > _ring->size) {
+        shm_record_t* rec = (shm_record_t*) (_ring->data + (tail & mask));
+
+        if (rec->len == RECORD_PAD)
+            tail += _ring->size - (tail & mask);
+        else
+            tail += RECORD_SIZE(rec->len);
+    }
+
+    // Readers must see the new tail before any of the bytes
+    // behind it are overwritten.
+    __atomic_store_n(&_ring->tail, tail, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void _ring_write(uint32_t signature, const uint8_t* data, uint16_t len)
+{
+    uint64_t head = _ring->head;
+    uint64_t mask = _ring->size - 1;
+    uint32_t need = RECORD_SIZE(len);
+    uint32_t pos = head & mask;
+    shm_record_t* rec = 0;
+
+    // Records are never split across the end of the ring.
+    if (_ring->size - pos < need) {
+        _ring_reserve(head, _ring->size - pos);
+        ((shm_record_t*) (_ring->data + pos))->len = RECORD_PAD;
+        head += _ring->size - pos;
+        pos = 0;
+    }
+
+    _ring_reserve(head, need);
+    rec = (shm_record_t*) (_ring->data + pos);
+    rec->len = len;
+    rec->signature = signature;
+    memcpy(rec + 1, data, len);
+
+    __atomic_store_n(&_ring->head, head + need, __ATOMIC_RELEASE);
+}
+
+
+// Map the rings of all other publishers in the registry.
+static void _readers_refresh(void)
+{
+    uint32_t generation = __atomic_load_n(&_registry->generation, __ATOMIC_ACQUIRE);
+    int ind = 0;
+
+    if (generation == _generation)
+        return;
+
+    _generation = generation;
+
+    for(ind = 0; ind < MAX_RINGS; ++ind) {
+        shm_reader_t* reader = &_readers[ind];
+        int32_t owner = __atomic_load_n(&_registry->owners[ind], __ATOMIC_ACQUIRE);
+        struct stat st;
+        char name[64];
+        int fd = 0;
+
+        if (owner == reader->owner)
+            continue;
+
+        if (reader->ring)
+            munmap(reader->ring, reader->map_size);
+
+        memset(reader, 0, sizeof(*reader));
+
+        if (!owner || ind == _ring_slot)
+            continue;
+
+        snprintf(name, sizeof(name), RING_NAME_FORMAT, owner);
+        fd = shm_open(name, O_RDONLY, 0);
+        if (fd == -1)
+            continue;
+
+        if (fstat(fd, &st) || st.st_size < sizeof(shm_ring_t)) {
+            close(fd);
+            continue;
+        }
+
+        reader->ring = (shm_ring_t*) _map(fd, st.st_size, PROT_READ);
+        close(fd);
+
+        if (!reader->ring)
+            continue;
+
+        if (reader->ring->magic != RING_MAGIC ||
+            st.st_size < sizeof(shm_ring_t) + reader->ring->size) {
+            munmap(reader->ring, st.st_size);
+            reader->ring = 0;
+            continue;
+        }
+
+        reader->owner = owner;
+        reader->map_size = st.st_size;
+
+        // Only frames published from now on are delivered.
+        reader->read_pos = __atomic_load_n(&reader->ring->head, __ATOMIC_ACQUIRE);
+        RMC_LOG_DEBUG("Reading shared memory publisher %d", owner);
+    }
+}
+
+
+// Deliver all frames in the ring not yet read.
+// Returns the number of frames delivered.
+static int _reader_process(shm_reader_t* reader)
+{
+    shm_ring_t* ring = reader->ring;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t mask = ring->size - 1;
+    int count = 0;
+
+    while(reader->read_pos < head) {
+        uint64_t pos = reader->read_pos;
+        shm_record_t rec;
+        uint64_t tail = 0;
+
+        memcpy(&rec, ring->data + (pos & mask), sizeof(rec));
+
+        // A torn record may carry any length. Stay within the ring.
+        if (rec.len <= MAX_FRAME_SIZE &&
+            (pos & mask) + sizeof(rec) + rec.len <= ring->size)
+            memcpy(_frame_buf, ring->data + (pos & mask) + sizeof(rec), rec.len);
+
+        // Was the record overwritten while we copied it?
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+        if (pos < tail) {
+            RMC_LOG_WARNING("Shared memory reader overrun by publisher %d. %lu bytes lost.",
+                            reader->owner, tail - pos);
+            _overruns++;
+            reader->read_pos = tail;
+            continue;
+        }
+
+        if (rec.len == RECORD_PAD) {
+            reader->read_pos += ring->size - (pos & mask);
+            continue;
+        }
+
+        // Only a misbehaving writer can get us here.
+        if (rec.len > MAX_FRAME_SIZE ||
+            (pos & mask) + sizeof(rec) + rec.len > ring->size) {
+            RMC_LOG_ERROR("Corrupt shared memory record from publisher %d", reader->owner);
+            reader->read_pos = head;
+            break;
+        }
+
+        reader->read_pos += RECORD_SIZE(rec.len);
+        vsd_receive_frame(0, rec.signature, _frame_buf, rec.len);
+        count++;
+    }
+
+    return count;
+}
+
+
+static int _shm_transmit(vsd_transport_t* transport,
+                         uint32_t signature,
+                         const uint8_t* data,
+                         uint16_t len)
+{
+    _ring_write(signature, data, len);
+
+    // Only enter the kernel if someone is waiting.
+    __atomic_add_fetch(&_registry->doorbell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_registry->waiters, __ATOMIC_SEQ_CST))
+        _futex(&_registry->doorbell, FUTEX_WAKE, INT_MAX, 0);
+
+    if (_shm_flags & VSD_SHM_LOCAL_ONLY)
+        return 0;
+
+    // Remote subscribers. Local subscribers using shared memory
+    // drop this copy, since it carries our host id.
+    return (*vsd_dstc_transport.transmit)(&vsd_dstc_transport, signature, data, len);
+}
+
+
+int vsd_shm_create(vsd_context_t* ctx,
+                   uint32_t flags,
+                   vsd_transport_t** result)
+{
+    int res = 0;
+
+    if (!result)
+        return EINVAL;
+
+    if (_registry)
+        return EBUSY;
+
+    res = _registry_attach();
+    if (res) {
+        RMC_LOG_ERROR("Could not attach to shared memory registry %s: %s",
+                      REGISTRY_NAME, strerror(res));
+        return res;
+    }
+
+    res = _ring_create();
+    if (res) {
+        RMC_LOG_ERROR("Could not create shared memory ring: %s", strerror(res));
+        munmap(_registry, sizeof(shm_registry_t));
+        _registry = 0;
+        return res;
+    }
+
+    memset(_readers, 0, sizeof(_readers));
+    _generation = 0;
+    _readers_refresh();
+
+    _shm_flags = flags;
+    _shm_transport.name = "shm";
+    _shm_transport.transmit = _shm_transmit;
+    _shm_transport.user_data = 0;
+
+    vsd_frame_origin = _registry->host_id;
+    *result = &_shm_transport;
+    return 0;
+}
+
+
+int vsd_shm_process(vsd_context_t* ctx, int timeout_msec)
+{
+    int64_t deadline = vsd_msec_monotonic_timestamp() + timeout_msec;
+
+    if (!_registry)
+        return EINVAL;
+
+    while(1) {
+        uint32_t doorbell = __atomic_load_n(&_registry->doorbell, __ATOMIC_SEQ_CST);
+        struct timespec ts;
+        int64_t remain = 0;
+        int count = 0;
+        int ind = 0;
+
+        _readers_refresh();
+
+        for(ind = 0; ind < MAX_RINGS; ++ind)
+            if (_readers[ind].ring)
+                count += _reader_process(&_readers[ind]);
+
+        if (count)
+            return 0;
+
+        if (!timeout_msec)
+            return ETIME;
+
+        // Wait for any publisher on the host to ring the doorbell.
+        // If one did after we read it above, the wait returns at once.
+        if (timeout_msec > 0) {
+            remain = deadline - vsd_msec_monotonic_timestamp();
+            if (remain <= 0)
+                return ETIME;
+
+            ts.tv_sec = remain / 1000;
+            ts.tv_nsec = (remain % 1000) * 1000000;
+        }
+
+        __atomic_add_fetch(&_registry->waiters, 1, __ATOMIC_SEQ_CST);
+        _futex(&_registry->doorbell, FUTEX_WAIT, doorbell, (timeout_msec > 0)?&ts:0);
+        __atomic_sub_fetch(&_registry->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+uint64_t vsd_shm_get_overrun_count(vsd_context_t* ctx)
+{
+    return _overruns;
+}
+
+
+int vsd_shm_destroy(vsd_transport_t* transport)
+{
+    int ind = 0;
+
+    if (!_registry || transport != &_shm_transport)
+        return EINVAL;
+
+    if (vsd_get_transport(0) == transport)
+        return EBUSY;
+
+    for(ind = 0; ind < MAX_RINGS; ++ind)
+        if (_readers[ind].ring)
+            munmap(_readers[ind].ring, _readers[ind].map_size);
+
+    memset(_readers, 0, sizeof(_readers));
+    _ring_destroy();
+
+    // The registry is left in place for other processes.
+    munmap(_registry, sizeof(shm_registry_t));
+    _registry = 0;
+    vsd_frame_origin = 0;
+    return 0;
+}
@@ -0,0 +1,238 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Traffic statistics
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <rmc_log.h>
+
+// Indexed by signal index. Both are allocated on first use.
+vsd_traffic_stats_t* vsd_stats_table = 0;
+vsd_error_stats_t* vsd_error_stats_table = 0;
+int vsd_stats_table_size = 0;
+
+// Signatures received that did not match any local signal.
+uint64_t vsd_unknown_signatures = 0;
+
+// Counters for signals outside the table end up here.
+static vsd_traffic_stats_t _stats_sink;
+static vsd_error_stats_t _error_stats_sink;
+
+vsd_traffic_stats_t* vsd_stats_alloc(vss_signal_t* sig)
+{
+    if (!vsd_stats_table) {
+        int count = vss_get_signal_count();
+
+        vsd_stats_table = (vsd_traffic_stats_t*) aligned_alloc(sizeof(vsd_traffic_stats_t),
+                                                               count * sizeof(vsd_traffic_stats_t));
+        vsd_error_stats_table = (vsd_error_stats_t*) calloc(count, sizeof(vsd_error_stats_t));
+        if (!vsd_stats_table || !vsd_error_stats_table) {
+            RMC_LOG_FATAL("Failed to allocate %lu bytes.",
+                          count * (sizeof(vsd_traffic_stats_t) + sizeof(vsd_error_stats_t)));
+            exit(255);
+        }
+        memset(vsd_stats_table, 0, count * sizeof(vsd_traffic_stats_t));
+        vsd_stats_table_size = count;
+    }
+
+    if (sig->index >= 0 && sig->index < vsd_stats_table_size)
+        return &vsd_stats_table[sig->index];
+
+    return &_stats_sink;
+}
+
+
+vsd_error_stats_t* vsd_error_stats(vss_signal_t* sig)
+{
+    if (!vsd_stats_table)
+        vsd_stats_alloc(sig);
+
+    if (sig->index >= 0 && sig->index < vsd_stats_table_size)
+        return &vsd_error_stats_table[sig->index];
+
+    return &_error_stats_sink;
+}
+
+
+// Combine the counters of the signal with the given index.
+static void _get_stats(int index, vsd_signal_stats_t* result)
+{
+    const vsd_traffic_stats_t* traffic = &vsd_stats_table[index];
+    const vsd_error_stats_t* errors = &vsd_error_stats_table[index];
+
+    result->published = traffic->published;
+    result->received = traffic->received;
+    result->bytes_encoded = traffic->bytes_encoded;
+    result->bytes_decoded = traffic->bytes_decoded;
+    result->decode_errors = errors->decode_errors;
+    result->oversize_frames = errors->oversize_frames;
+    result->dropped_deliveries = errors->dropped_deliveries;
+    result->invalid_values = errors->invalid_values;
+    result->lazy_frames = traffic->lazy_frames;
+    result->skipped_publishes = traffic->skipped_publishes;
+    result->held_publishes = traffic->held_publishes;
+}
+
+
+int vsd_get_signal_stats(vss_signal_t* sig, vsd_signal_stats_t* result)
+{
+    if (!sig || !result)
+        return EINVAL;
+
+    if (sig->index < 0 || sig->index >= vsd_stats_table_size) {
+        memset(result, 0, sizeof(*result));
+        return 0;
+    }
+
+    _get_stats(sig->index, result);
+    return 0;
+}
+
+
+static uint64_t _stats_key(const vsd_traffic_stats_t* stats, int sort_key)
+{
+    switch(sort_key) {
+    case VSD_STATS_PUBLISHED: return stats->published;
+    case VSD_STATS_RECEIVED: return stats->received;
+    case VSD_STATS_BYTES_ENCODED: return stats->bytes_encoded;
+    case VSD_STATS_BYTES_DECODED: return stats->bytes_decoded;
+    case VSD_STATS_BYTES: return stats->bytes_encoded + stats->bytes_decoded;
+    default: return stats->published + stats->received;
+    }
+}
+
+
+// Restore min heap order from ind downward.
+static void _heap_down(vsd_stats_entry_t* heap, uint64_t* keys, int count, int ind)
+{
+    while(1) {
+        int least = ind;
+        int left = 2 * ind + 1;
+        int right = left + 1;
+        vsd_stats_entry_t tmp_entry;
+        uint64_t tmp_key;
+
+        if (left < count && keys[left] < keys[least])
+            least = left;
+
+        if (right < count && keys[right] < keys[least])
+            least = right;
+
+        if (least == ind)
+            return;
+
+        tmp_entry = heap[ind]; heap[ind] = heap[least]; heap[least] = tmp_entry;
+        tmp_key = keys[ind]; keys[ind] = keys[least]; keys[least] = tmp_key;
+        ind = least;
+    }
+}
+
+
+// Find the *count signals with the highest sort_key value using a
+// min heap of *count entries, making the scan O(signals * log(count)).
+int vsd_get_stats(vsd_context_t* ctx,
+                  int sort_key,
+                  vsd_stats_entry_t* result,
+                  int* count)
+{
+    uint64_t* keys = 0;
+    int max_count = 0;
+    int found = 0;
+    int ind = 0;
+
+    if (!result || !count || *count < 0)
+        return EINVAL;
+
+    max_count = *count;
+    *count = 0;
+
+    if (!max_count || !vsd_stats_table)
+        return 0;
+
+    keys = (uint64_t*) malloc(max_count * sizeof(uint64_t));
+    if (!keys) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", max_count * sizeof(uint64_t));
+        exit(255);
+    }
+
+    for(ind = 0; ind < vsd_stats_table_size; ++ind) {
+        vss_signal_t* sig = 0;
+        uint64_t key = _stats_key(&vsd_stats_table[ind], sort_key);
+
+        // Skip signals with no traffic, and signals that cannot
+        // make it into the heap.
+        if (!key || (found == max_count && key <= keys[0]))
+            continue;
+
+        // Only report leaf signals.
+        sig = vss_get_signal_by_index(ind);
+        if (!sig || sig->element_type == VSS_BRANCH)
+            continue;
+
+        if (found < max_count) {
+            int child = found++;
+
+            // Sift up.
+            result[child].sig = sig;
+            _get_stats(ind, &result[child].stats);
+            keys[child] = key;
+
+            while(child && keys[(child - 1) / 2] > keys[child]) {
+                int parent = (child - 1) / 2;
+                vsd_stats_entry_t tmp_entry = result[parent];
+                uint64_t tmp_key = keys[parent];
+
+                result[parent] = result[child]; result[child] = tmp_entry;
+                keys[parent] = keys[child]; keys[child] = tmp_key;
+                child = parent;
+            }
+            continue;
+        }
+
+        // Replace the smallest entry.
+        result[0].sig = sig;
+        _get_stats(ind, &result[0].stats);
+        keys[0] = key;
+        _heap_down(result, keys, found, 0);
+    }
+
+    // Sort the heap in descending order by repeatedly moving
+    // the smallest entry to the end.
+    *count = found;
+    while(found > 1) {
+        vsd_stats_entry_t tmp_entry = result[0];
+        uint64_t tmp_key = keys[0];
+
+        --found;
+        result[0] = result[found]; result[found] = tmp_entry;
+        keys[0] = keys[found]; keys[found] = tmp_key;
+        _heap_down(result, keys, found, 0);
+    }
+
+    free(keys);
+    return 0;
+}
+
+
+uint64_t vsd_get_unknown_signature_count(vsd_context_t* ctx)
+{
+    return vsd_unknown_signatures;
+}
+
+
+void vsd_reset_stats(vsd_context_t* ctx)
+{
+    if (vsd_stats_table) {
+        memset(vsd_stats_table, 0, vsd_stats_table_size * sizeof(vsd_traffic_stats_t));
+        memset(vsd_error_stats_table, 0, vsd_stats_table_size * sizeof(vsd_error_stats_t));
+    }
+
+    vsd_unknown_signatures = 0;
+}
@@ -0,0 +1,318 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Hierarchical timer wheel and cyclic publishing
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <rmc_log.h>
+
+// Four levels of 256 one-millisecond slots each cover the full
+// 32 bit millisecond range (~49 days). A timer is placed in the
+// lowest level whose span covers its expiry, and is cascaded down
+// one level each time the level below wraps around.
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+// Each slot is the sentinel of a circular, doubly linked list.
+static vsd_timer_t _wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+// Time, in msec, that the wheel has been advanced to.
+static int64_t _wheel_now = 0;
+
+// Number of armed timers.
+static uint32_t _wheel_count = 0;
+
+// A cyclic publish registered by vsd_schedule_publish().
+struct vsd_schedule {
+    vsd_timer_t timer;
+    vss_signal_t* sig;
+    uint32_t period_msec;
+    vsd_jitter_stats_t jitter;
+};
+
+// Number of schedules created with VSD_PHASE_AUTO.
+// Used to spread their phases over the period.
+static uint32_t _auto_phase_count = 0;
+
+static void _wheel_init(void)
+{
+    int level;
+    int slot;
+
+    if (_wheel_now)
+        return;
+
+    for(level = 0; level < WHEEL_LEVELS; ++level)
+        for(slot = 0; slot < WHEEL_SIZE; ++slot) {
+            _wheel[level][slot].next = &_wheel[level][slot];
+            _wheel[level][slot].prev = &_wheel[level][slot];
+        }
+
+    _wheel_now = vsd_msec_monotonic_timestamp();
+}
+
+static void _wheel_link(vsd_timer_t* timer)
+{
+    int64_t expire = timer->expire_msec;
+    vsd_timer_t* head = 0;
+    int level = 0;
+
+    // Find the lowest level where expire and the current time
+    // share all higher digits. The slot for the expire digit at that
+    // level is guaranteed to be reached, or cascaded, before the
+    // timer is due.
+    while(level < WHEEL_LEVELS &&
+          (expire >> (WHEEL_BITS * (level + 1))) != (_wheel_now >> (WHEEL_BITS * (level + 1))))
+        ++level;
+
+    if (expire <= _wheel_now)
+        // Already expired. Fire in the current slot.
+        head = &_wheel[0][_wheel_now & WHEEL_MASK];
+    else if (level == WHEEL_LEVELS)
+        // Beyond the range of the wheel. Park in the last slot of the
+        // top level to be reached, and get re-linked when cascaded.
+        head = &_wheel[WHEEL_LEVELS - 1][((_wheel_now >> (WHEEL_BITS * (WHEEL_LEVELS - 1))) - 1) & WHEEL_MASK];
+    else
+        head = &_wheel[level][(expire >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void _wheel_unlink(vsd_timer_t* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = 0;
+    timer->prev = 0;
+}
+
+
+void vsd_timer_init(vsd_timer_t* timer, vsd_timer_cb_t callback, void* user_data)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+    timer->user_data = user_data;
+}
+
+
+void vsd_timer_start(vsd_timer_t* timer, int64_t expire_msec)
+{
+    _wheel_init();
+
+    if (vsd_timer_is_armed(timer))
+        vsd_timer_cancel(timer);
+
+    timer->expire_msec = expire_msec;
+    _wheel_link(timer);
+    ++_wheel_count;
+}
+
+
+void vsd_timer_cancel(vsd_timer_t* timer)
+{
+    if (!vsd_timer_is_armed(timer))
+        return;
+
+    _wheel_unlink(timer);
+    --_wheel_count;
+}
+
+
+// Move all timers in the given slot of a higher level down to
+// the levels below it.
+static void _wheel_cascade(int level)
+{
+    vsd_timer_t* head = &_wheel[level][(_wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+    while(head->next != head) {
+        vsd_timer_t* timer = head->next;
+
+        _wheel_unlink(timer);
+        _wheel_link(timer);
+    }
+}
+
+
+int vsd_process_timers(vsd_context_t* ctx, int* timeout_msec)
+{
+    int64_t now = vsd_msec_monotonic_timestamp();
+    int slot = 0;
+
+    _wheel_init();
+
+    // Nothing to run. Skip ahead.
+    if (!_wheel_count && _wheel_now < now)
+        _wheel_now = now;
+
+    while(_wheel_now <= now) {
+        vsd_timer_t* head = &_wheel[0][_wheel_now & WHEEL_MASK];
+        int level = 1;
+
+        // Cascade higher levels down when the level below wraps around.
+        // Start at the highest level wrapping, since its timers may
+        // land in the slots of the levels below that are cascaded next.
+        while(level < WHEEL_LEVELS &&
+              !((_wheel_now >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK))
+            ++level;
+
+        while(--level > 0)
+            _wheel_cascade(level);
+
+        // Fire all timers in slot. The callback may re-arm the timer,
+        // which will link it into a later slot.
+        while(head->next != head) {
+            vsd_timer_t* timer = head->next;
+
+            vsd_timer_cancel(timer);
+            (*timer->callback)(timer, vsd_usec_monotonic_timestamp());
+        }
+
+        if (_wheel_now == now)
+            break;
+
+        ++_wheel_now;
+    }
+
+    if (!timeout_msec)
+        return 0;
+
+    if (!_wheel_count) {
+        *timeout_msec = -1;
+        return 0;
+    }
+
+    // Find the next non-empty slot in the lowest level. If there is none,
+    // wake up when the level wraps and the next level is cascaded.
+    for(slot = 1; slot < WHEEL_SIZE; ++slot) {
+        vsd_timer_t* head = &_wheel[0][(_wheel_now + slot) & WHEEL_MASK];
+
+        if (head->next != head)
+            break;
+
+        if (!((_wheel_now + slot) & WHEEL_MASK))
+            break;
+    }
+
+    *timeout_msec = slot;
+    return 0;
+}
+
+
+// Timer callback for cyclic publishing.
+static void _schedule_fire(vsd_timer_t* timer, int64_t now_usec)
+{
+    vsd_schedule_t* sched = (vsd_schedule_t*) timer->user_data;
+    int64_t late_usec = now_usec - timer->expire_msec * 1000;
+    int64_t next = timer->expire_msec + sched->period_msec;
+
+    if (late_usec < 0)
+        late_usec = 0;
+
+    if (!sched->jitter.count || late_usec < sched->jitter.min_usec)
+        sched->jitter.min_usec = late_usec;
+
+    if (late_usec > sched->jitter.max_usec)
+        sched->jitter.max_usec = late_usec;
+
+    sched->jitter.sum_usec += late_usec;
+    sched->jitter.count++;
+
+    // If we have fallen behind, skip the publishes we missed instead
+    // of sending them back to back.
+    if (next * 1000 <= now_usec) {
+        int64_t missed = (now_usec / 1000 - next) / sched->period_msec + 1;
+
+        sched->jitter.missed += missed;
+        next += missed * sched->period_msec;
+    }
+
+    vsd_timer_start(timer, next);
+    vsd_publish(sched->sig);
+}
+
+
+int vsd_schedule_publish(vsd_context_t* ctx,
+                         vss_signal_t* sig,
+                         uint32_t period_msec,
+                         int32_t phase_msec,
+                         vsd_schedule_t** result)
+{
+    vsd_schedule_t* sched = 0;
+    int64_t now = vsd_msec_monotonic_timestamp();
+    int64_t first = 0;
+
+    if (!sig || !period_msec || !result)
+        return EINVAL;
+
+    if (phase_msec != VSD_PHASE_AUTO && (phase_msec < 0 || phase_msec >= period_msec))
+        return ERANGE;
+
+    // Spread automatic phases evenly over the period by bit reversing
+    // a running counter, so that 0, 1/2, 1/4, 3/4, 1/8 ... of the period
+    // is used by each new schedule.
+    if (phase_msec == VSD_PHASE_AUTO) {
+        uint32_t rev = _auto_phase_count++;
+
+        rev = ((rev >> 1) & 0x55555555) | ((rev & 0x55555555) << 1);
+        rev = ((rev >> 2) & 0x33333333) | ((rev & 0x33333333) << 2);
+        rev = ((rev >> 4) & 0x0F0F0F0F) | ((rev & 0x0F0F0F0F) << 4);
+        rev = ((rev >> 8) & 0x00FF00FF) | ((rev & 0x00FF00FF) << 8);
+        rev = (rev >> 16) | (rev << 16);
+        phase_msec = (int32_t) (((uint64_t) rev * period_msec) >> 32);
+    }
+
+    sched = (vsd_schedule_t*) malloc(sizeof(vsd_schedule_t));
+    if (!sched) {
+        RMC_LOG_FATAL("Failed to allocate %lu bytes.", sizeof(vsd_schedule_t));
+        exit(255);
+    }
+
+    memset(sched, 0, sizeof(*sched));
+    sched->sig = sig;
+    sched->period_msec = period_msec;
+    vsd_timer_init(&sched->timer, _schedule_fire, sched);
+
+    // Publish at the next point in time where
+    // (time - phase) is a multiple of period.
+    first = now + ((phase_msec - now) % period_msec + period_msec) % period_msec;
+
+    RMC_LOG_DEBUG("Scheduling %s every %u msec with phase %d msec",
+                  sig->uuid, period_msec, phase_msec);
+
+    vsd_timer_start(&sched->timer, first);
+    *result = sched;
+    return 0;
+}
+
+
+int vsd_unschedule_publish(vsd_context_t* ctx, vsd_schedule_t* sched)
+{
+    if (!sched)
+        return EINVAL;
+
+    vsd_timer_cancel(&sched->timer);
+    free(sched);
+    return 0;
+}
+
+
+int vsd_get_schedule_jitter(vsd_schedule_t* sched, vsd_jitter_stats_t* result)
+{
+    if (!sched || !result)
+        return EINVAL;
+
+    *result = sched->jitter;
+    return 0;
+}
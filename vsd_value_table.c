@@ -0,0 +1,338 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Shared memory table of current signal values
+//
+#include "vsd_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rmc_log.h>
+
+// The table is a shared memory object with a header, followed by one
+// entry per signal index, followed by a fixed size string area for
+// each string signal.
+//
+// The owning process is the only writer. Each entry is guarded by a
+// seqlock: the writer makes seq odd, updates the entry, and makes seq
+// even again. A reader copies the entry and retries if seq was odd or
+// changed during the copy.
+//
+#define TABLE_MAGIC 0x56534454   // "VSDT"
+#define TABLE_VERSION 1
+
+// Attempts made to read an entry that is being written before giving up.
+// After the first READ_SPINS attempts the reader yields between attempts,
+// in case the writer was preempted halfway through the entry.
+#define READ_RETRIES 10000
+#define READ_SPINS 100
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // Cleared when the owner closes the table.
+    uint32_t valid;
+    uint32_t signal_count;
+    // Signature of the root signal. The table is only readable by
+    // processes using the same specification as the owner.
+    uint32_t signature;
+    uint32_t max_string_len;
+} __attribute__((aligned(64))) table_header_t;
+
+typedef struct {
+    uint32_t seq;
+    uint8_t has_value;
+    uint8_t pad;
+    // Length of string values, including null terminator.
+    uint16_t len;
+    uint64_t timestamp;
+    // Scalar values, in the layout of vsd_data_u.
+    uint64_t value;
+    // Offset of the string area of string signals, from table start.
+    uint64_t string_offset;
+} table_entry_t;
+
+int vsd_value_table_mode = VSD_VALUE_TABLE_NONE;
+
+static table_header_t* _table = 0;
+static size_t _table_size = 0;
+static char _table_name[256];
+
+static table_entry_t* _entry(int index)
+{
+    return ((table_entry_t*) (_table + 1)) + index;
+}
+
+
+static void _unmap(void)
+{
+    munmap(_table, _table_size);
+    _table = 0;
+    _table_size = 0;
+    vsd_value_table_mode = VSD_VALUE_TABLE_NONE;
+}
+
+
+void vsd_value_table_store(vss_signal_t* sig, const vsd_data_u* val, uint64_t timestamp)
+{
+    table_entry_t* entry = 0;
+    uint32_t seq = 0;
+    uint16_t len = 0;
+
+    if (sig->index < 0 || sig->index >= _table->signal_count)
+        return;
+
+    // Log before the entry is locked, to keep readers waiting
+    // as briefly as possible.
+    if (sig->data_type == VSS_STRING) {
+        len = val->s.len;
+
+        if (len > _table->max_string_len) {
+            RMC_LOG_WARNING("Value of %s truncated from %d to %d bytes in value table",
+                            sig->uuid, len, _table->max_string_len);
+            len = _table->max_string_len;
+        }
+    }
+
+    entry = _entry(sig->index);
+    seq = entry->seq;
+
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->has_value = 1;
+    entry->timestamp = timestamp;
+
+    if (sig->data_type == VSS_STRING) {
+        memcpy((uint8_t*) _table + entry->string_offset, val->s.data, len);
+
+        // Keep truncated strings terminated.
+        if (len && len < val->s.len)
+            ((char*) _table)[entry->string_offset + len - 1] = 0;
+
+        entry->len = len;
+    } else
+        memcpy(&entry->value, val, sizeof(entry->value));
+
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+int vsd_value_table_load(vss_signal_t* sig, vsd_data_u* val, uint64_t* timestamp)
+{
+    table_entry_t* entry = 0;
+    int attempt = 0;
+
+    if (!__atomic_load_n(&_table->valid, __ATOMIC_ACQUIRE))
+        return ESTALE;
+
+    if (sig->index < 0 || sig->index >= _table->signal_count)
+        return ENOENT;
+
+    entry = _entry(sig->index);
+
+    // Make sure that the largest possible string fits, so that no
+    // allocation is needed while the entry is being read.
+    if (sig->data_type == VSS_STRING && val->s.allocated < _table->max_string_len) {
+        free(val->s.data);
+        val->s.allocated = _table->max_string_len | 0x7FF;
+        val->s.data = (char*) malloc(val->s.allocated);
+        if (!val->s.data) {
+            RMC_LOG_FATAL("Failed to allocate %u bytes of memory", val->s.allocated);
+            exit(255);
+        }
+        val->s.len = 0;
+    }
+
+    for(attempt = 0; attempt < READ_RETRIES; ++attempt) {
+        uint32_t seq = 0;
+        uint8_t has_value = 0;
+        uint64_t ts = 0;
+        uint64_t value = 0;
+        uint16_t len = 0;
+
+        if (attempt >= READ_SPINS)
+            sched_yield();
+
+        seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+
+        // Being written.
+        if (seq & 1)
+            continue;
+
+        has_value = entry->has_value;
+        ts = entry->timestamp;
+        value = entry->value;
+        len = entry->len;
+
+        if (sig->data_type == VSS_STRING && len <= _table->max_string_len)
+            memcpy(val->s.data, (uint8_t*) _table + entry->string_offset, len);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        // Nothing set yet. Leave val as is.
+        if (!has_value)
+            return 0;
+
+        if (sig->data_type == VSS_STRING)
+            val->s.len = len;
+        else
+            memcpy(val, &value, sizeof(value));
+
+        *timestamp = ts;
+        return 0;
+    }
+
+    return EAGAIN;
+}
+
+
+int vsd_value_table_create(vsd_context_t* ctx,
+                           const char* name,
+                           uint16_t max_string_len)
+{
+    int count = vss_get_signal_count();
+    size_t size = sizeof(table_header_t) + count * sizeof(table_entry_t);
+    uint64_t string_offset = size;
+    int fd = 0;
+    int ind = 0;
+
+    if (!name || !count || strlen(name) >= sizeof(_table_name))
+        return EINVAL;
+
+    if (_table)
+        return EBUSY;
+
+    for(ind = 0; ind < count; ++ind)
+        if (vss_get_signal_by_index(ind)->data_type == VSS_STRING)
+            size += max_string_len;
+
+    // Clients still mapping a table left by a previous owner
+    // will find it invalid and need to attach again.
+    shm_unlink(name);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        return errno;
+
+    if (ftruncate(fd, size) == -1) {
+        int res = errno;
+
+        close(fd);
+        shm_unlink(name);
+        return res;
+    }
+
+    _table = (table_header_t*) mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (_table == MAP_FAILED) {
+        int res = errno;
+
+        _table = 0;
+        shm_unlink(name);
+        return res;
+    }
+
+    _table_size = size;
+    strcpy(_table_name, name);
+
+    _table->version = TABLE_VERSION;
+    _table->signal_count = count;
+    _table->signature = vss_get_signal_by_index(0)->signature;
+    _table->max_string_len = max_string_len;
+
+    for(ind = 0; ind < count; ++ind) {
+        if (vss_get_signal_by_index(ind)->data_type != VSS_STRING)
+            continue;
+
+        _entry(ind)->string_offset = string_offset;
+        string_offset += max_string_len;
+    }
+
+    vsd_value_table_mode = VSD_VALUE_TABLE_OWNER;
+
+    // Start out with the values we already have.
+    vsd_value_table_populate();
+
+    _table->valid = 1;
+    __atomic_store_n(&_table->magic, TABLE_MAGIC, __ATOMIC_RELEASE);
+
+    RMC_LOG_INFO("Created value table %s. %d signals, %lu bytes", name, count, size);
+    return 0;
+}
+
+
+int vsd_value_table_attach(vsd_context_t* ctx, const char* name)
+{
+    struct stat st;
+    int fd = 0;
+
+    if (!name)
+        return EINVAL;
+
+    if (_table)
+        return EBUSY;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return errno;
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(table_header_t)) {
+        close(fd);
+        return EPROTO;
+    }
+
+    _table = (table_header_t*) mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (_table == MAP_FAILED) {
+        _table = 0;
+        return errno;
+    }
+
+    _table_size = st.st_size;
+
+    if (__atomic_load_n(&_table->magic, __ATOMIC_ACQUIRE) != TABLE_MAGIC ||
+        _table->version != TABLE_VERSION ||
+        !_table->valid) {
+        _unmap();
+        return EPROTO;
+    }
+
+    if (_table->signal_count != vss_get_signal_count() ||
+        _table->signature != vss_get_signal_by_index(0)->signature) {
+        RMC_LOG_ERROR("Value table %s was created with a different signal specification", name);
+        _unmap();
+        return EPROTO;
+    }
+
+    vsd_value_table_mode = VSD_VALUE_TABLE_CLIENT;
+    return 0;
+}
+
+
+int vsd_value_table_close(vsd_context_t* ctx)
+{
+    if (!_table)
+        return ESRCH;
+
+    if (vsd_value_table_mode == VSD_VALUE_TABLE_OWNER) {
+        __atomic_store_n(&_table->valid, 0, __ATOMIC_RELEASE);
+        shm_unlink(_table_name);
+    }
+
+    _unmap();
+    return 0;
+}